@@ -6,6 +6,7 @@ RTL_ROOT=/home/bekzat/chip_bootcamp
 
 DBG_CFLAGS="-g3 -O0 -fno-omit-frame-pointer"
 DBG_LDFLAGS="-g"
+FAST_TB_CFLAGS="-O2"
 
 usage() {
   echo "Usage:"
@@ -20,9 +21,11 @@ TB_ARGS=("$@")
 case "$MODE" in
   slow)
     DEBUG_BUILD=1
+    TB_CFLAGS=""
     ;;
   fast)
     DEBUG_BUILD=0
+    TB_CFLAGS="$FAST_TB_CFLAGS"
     ;;
   *)
     usage
@@ -36,7 +39,7 @@ TB_BIN="bin/testbench_${MODE}"
 
 cd "$RTL_ROOT"
 
-verilator --trace -cc \
+verilator --trace --savable -cc \
   -Wall \
   -I"$RTL_ROOT/soc" \
   soc/cpu.sv \
@@ -45,7 +48,7 @@ verilator --trace -cc \
   --no-timing \
   --Mdir "$OBJ_CPU"
 
-verilator --trace -cc \
+verilator --trace --savable -cc \
   -IysyxSoC/perip/uart16550/rtl \
   -IysyxSoC/perip/spi/rtl \
   -Isoc \
@@ -72,13 +75,14 @@ else
   make -C "$OBJ_SOC" -f VysyxSoCTop.mk libVysyxSoCTop.a
 fi
 
-g++ -std=c++17 -g \
+g++ -std=c++17 -g $TB_CFLAGS \
   -I"$OBJ_CPU" -I"$OBJ_SOC" \
   -I"$VERILATOR_ROOT/include" \
   -I"$VERILATOR_ROOT/include/vltstd" \
   soc/soc_main.cpp \
   "$OBJ_SOC/libVysyxSoCTop.a" "$OBJ_CPU/libVcpu.a" \
   libverilated.a \
+  -lz -pthread \
   -o "$TB_BIN"
 
 cd - >/dev/null
@@ -21,5 +21,7 @@ case "$CPU" in
 esac
 
 cd $CPU_TESTS
-make ARCH=minirv-npc run cpu="$CPU" verbose=4
+make ARCH=minirv-npc
 cd - >/dev/null
+
+./build_run.sh fast "$CPU" gold check jobs "$(nproc)" suite "$CPU_TESTS/build"
@@ -20,4 +20,48 @@ case "$CPU" in
     ;;
 esac
 
-./build_run.sh fast "$CPU" gold random 1000 100 all delay 1 2 verbose 4
+./build_run.sh fast "$CPU" gold random 1000 100 all delay 1 2 verbose 4 jobs "$(nproc)"
+
+# NOTE: shrink regression: a synthetic program that fails the check (a0 = 1 at ebreak) among filler instructions
+# must shrink to fewer instructions that still fail
+# NOTE: random <n> programs are n instructions after the 2*(N_REGS-1) = 30 that set the registers up
+SHRINK_RANDOM=100
+SHRINK_N=$(( SHRINK_RANDOM + 30 ))
+SHRINK_DIR="$(mktemp -d)"
+SHRINK_INPUT="$SHRINK_DIR/input.bin"
+SHRINK_BIN="$SHRINK_DIR/shrink.bin"
+word() {
+  local bytes
+  printf -v bytes '\\x%02x' $(( $1 & 0xff )) $(( ($1 >> 8) & 0xff )) $(( ($1 >> 16) & 0xff )) $(( ($1 >> 24) & 0xff ))
+  printf "$bytes"
+}
+{
+  for (( i = 0; i < SHRINK_N - 2; i++ )); do
+    if (( i == SHRINK_N / 2 )); then
+      word 0x00100513 # addi a0, x0, 1
+    else
+      word 0x00130313 # addi t1, t1, 1
+    fi
+  done
+  word 0x00100073 # ebreak
+  word 0x00000013 # nop
+} > "$SHRINK_INPUT"
+if ./build_run.sh fast "$CPU" gold random 1 "$SHRINK_RANDOM" all check seed 1 replay "$SHRINK_INPUT" shrink "$SHRINK_BIN" > "$SHRINK_DIR/shrink.log"; then
+  echo "[FAILED] shrink: $SHRINK_INPUT passed, it is expected to fail"
+  exit 1
+fi
+read -r SHRINK_LEFT SHRINK_TOTAL < <(sed -n 's/.*shrink: \([0-9]*\) of \([0-9]*\) instructions left.*/\1 \2/p' "$SHRINK_DIR/shrink.log")
+if [[ -z "${SHRINK_LEFT:-}" || ! -f "$SHRINK_BIN" || ! -f "$SHRINK_BIN.cmd" ]]; then
+  echo "[FAILED] shrink: no shrunk program for $SHRINK_INPUT, see $SHRINK_DIR/shrink.log"
+  exit 1
+fi
+if (( SHRINK_LEFT >= SHRINK_N - 1 )); then
+  echo "[FAILED] shrink: $SHRINK_LEFT of $SHRINK_TOTAL instructions left, the program did not shrink"
+  exit 1
+fi
+if bash "$SHRINK_BIN.cmd" > "$SHRINK_DIR/replay.log"; then
+  echo "[FAILED] shrink: the shrunk program passes, see $SHRINK_DIR/replay.log"
+  exit 1
+fi
+echo "[INFO] shrink: $SHRINK_N instructions shrank to $SHRINK_LEFT and still fail"
+rm -rf "$SHRINK_DIR"
@@ -0,0 +1,66 @@
+// NOTE: vsoc with gold in batches of batch_cycles; the full state is compared at the end of every batch
+bool test_batch(TestBench* tb) {
+  CommitRing* ring = tb->commits;
+  ring->head        = 0;
+  ring->tail        = 0;
+  ring->tail_cached = 0;
+  ring->head_cached = 0;
+  ring->is_overflow = false;
+  dpi_model.commits = ring;
+  CommitRecord g = {};
+  bool is_test_success = true;
+  while (is_test_success) {
+    vsoc_batch(tb, tb->batch_cycles);
+    if (ring->is_overflow) {
+      printf("[ERROR] commit ring overflow at cycle %lu: %lu records\n", tb->vsoc_cycles, ring->mask + 1);
+      is_test_success = false;
+      break;
+    }
+
+    bool is_done = false;
+    const CommitRecord* record;
+    while (!is_done && (record = commit_ring_peek(ring))) {
+      g = gold_commit_step(tb);
+      if (!compare_commit(record, &g)) {
+        printf("[%" PRIx64 "] pc=0x%08x inst: [0x%x] ", tb->instrets, g.pc, g.inst);
+        print_instruction(g.inst);
+        is_test_success = false;
+        break;
+      }
+      commit_ring_pop(ring);
+      is_done = gold_is_done(tb);
+    }
+    // NOTE: a random test also ends on n_insts or an unmapped access of gold, vsoc runs on past them in the batch
+    if (is_test_success && is_done && commit_ring_peek(ring) && (!tb->is_random || tb->gcpu->ebreak)) {
+      printf("[FAILED] vsoc retired past the end of gold\n");
+      is_test_success = false;
+    }
+    // NOTE: vsoc ran past gold here, its state is not at the same instruction
+    if (!is_test_success || commit_ring_peek(ring)) break;
+
+    if (!tb->vsoc_cpu->event_counts.ebreak) {
+      is_test_success &= compare_reg(tb->vsoc_ticks, "vsoc.mcycle  ", tb->vsoc_cpu->event_counts.mcycle,   tb->vsoc_cycles - tb->reset_cycles);
+      is_test_success &= compare_reg(tb->vsoc_ticks, "vsoc.minstret", tb->vsoc_cpu->event_counts.minstret, tb->instrets);
+    }
+    is_test_success &= ebreak_check(tb, "vsoc", tb->vsoc_cpu->event_counts.ebreak, tb->vsoc_cpu->regs[10]);
+    is_test_success &= ebreak_check(tb, "gcpu", tb->gcpu->ebreak, tb->gcpu->regs[10]);
+    if (tb->gcpu->is_not_mapped && tb->is_random) break;
+    is_test_success &= compare_vsoc_gold(tb);
+    if (!is_test_success) {
+      printf("[%" PRIx64 "] pc=0x%08x inst: [0x%x] ", tb->instrets, g.pc, g.inst);
+      print_instruction(g.inst);
+      break;
+    }
+    if (tb->mem_dirty) mem_dirty_clear(tb->mem_dirty);
+    if (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) {
+      printf("[%" PRIx64 "] pc=0x%08x\n", tb->vsoc_cycles, tb->vsoc_cpu->pc);
+      printf("[FAILED] test is not successful: vsoc timeout %" PRIu64 "/%" PRIu64 "\n", tb->vsoc_cycles, tb->max_cycles);
+      is_test_success = false;
+      break;
+    }
+    if (tb->vsoc_cpu->event_counts.ebreak && tb->gcpu->ebreak) break;
+    if (is_done) break;
+  }
+  dpi_model.commits = NULL;
+  return is_test_success;
+}
@@ -0,0 +1,278 @@
+/*
+  A row of measure.csv (written by measure.sh): the counters are looked up by their header names,
+  rows are counted from 1 after the header.
+*/
+#define MEASURE_COLUMNS (12)
+
+static const char* measure_column_names[MEASURE_COLUMNS] = {
+  "instrets", "cycles", "ifu wait", "lsu wait", "load seen", "store seen",
+  "system seen", "calc seen", "jump seen", "branch seen", "branch taken", "icache hits",
+};
+
+enum MeasureColumn {
+  MeasureInstrets,
+  MeasureCycles,
+  MeasureIfuWait,
+  MeasureLsuWait,
+  MeasureIcacheHits = 11,
+};
+
+static uint32_t measure_split(char* line, char** fields, uint32_t max_fields) {
+  uint32_t n = 0;
+  line[strcspn(line, "\r\n")] = 0;
+  char* field = line;
+  while (n < max_fields) {
+    fields[n++] = field;
+    char* comma = strchr(field, ',');
+    if (!comma) break;
+    *comma = 0;
+    field  = comma + 1;
+  }
+  return n;
+}
+
+bool read_measure_row(const char* path, uint32_t row, uint64_t out[MEASURE_COLUMNS], char* notes, size_t notes_size) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    printf("[ERROR] could not open %s\n", path);
+    return false;
+  }
+  char  header[1024];
+  char  line[1024];
+  char* header_fields[32];
+  char* line_fields[32];
+  bool  result = false;
+  if (fgets(header, sizeof(header), f)) {
+    uint32_t n_columns = measure_split(header, header_fields, 32);
+    uint32_t i_row = 0;
+    while (fgets(line, sizeof(line), f)) {
+      if (++i_row != row) continue;
+      uint32_t n_fields = measure_split(line, line_fields, 32);
+      result = true;
+      for (uint32_t i = 0; i < n_columns && i < n_fields; i++) {
+        if (strcmp(header_fields[i], "notes") == 0) snprintf(notes, notes_size, "%s", line_fields[i]);
+      }
+      for (uint32_t c = 0; c < MEASURE_COLUMNS; c++) {
+        bool is_found = false;
+        for (uint32_t i = 0; i < n_columns && i < n_fields; i++) {
+          if (strcmp(header_fields[i], measure_column_names[c]) == 0) {
+            out[c]   = std::stoull(line_fields[i]);
+            is_found = true;
+          }
+        }
+        if (!is_found) {
+          printf("[ERROR] %s row %u has no '%s'\n", path, row, measure_column_names[c]);
+          result = false;
+        }
+      }
+      break;
+    }
+    if (i_row < row) printf("[ERROR] %s has only %u rows\n", path, i_row);
+  }
+  fclose(f);
+  return result;
+}
+
+// NOTE: rows are a comma separated list counted from 1, like "3" or "3,5,8"
+bool calibrate_rows_parse(const char* text, std::vector<uint32_t>* rows) {
+  rows->clear();
+  const char* p = text;
+  while (*p) {
+    char* end = NULL;
+    unsigned long row = strtoul(p, &end, 10);
+    if (end == p || row == 0 || row > UINT32_MAX || (*end && *end != ',')) return false;
+    rows->push_back((uint32_t)row);
+    p = *end ? end + 1 : end;
+  }
+  return !rows->empty();
+}
+
+// NOTE: the timing events of one gold run, all calibrate needs to evaluate the waits for any latencies
+struct CalibrateSample {
+  uint64_t minstret;
+  uint64_t icache_hits;
+  uint64_t icache_misses[GtimingRegions];
+  uint64_t lsu_accesses[GtimingRegions];
+};
+
+CalibrateSample calibrate_sample(const Gtiming* timing) {
+  CalibrateSample sample = {};
+  sample.minstret    = timing->minstret;
+  sample.icache_hits = timing->icache_hits;
+  memcpy(sample.icache_misses, timing->icache_misses, sizeof(sample.icache_misses));
+  memcpy(sample.lsu_accesses,  timing->lsu_accesses,  sizeof(sample.lsu_accesses));
+  return sample;
+}
+
+static double calibrate_ifu_wait(const CalibrateSample& sample, const GtimingParams& params) {
+  double result = params.ifu_hit * sample.icache_hits;
+  for (uint32_t r = 0; r < GtimingRegions; r++) result += params.ifu_miss[r] * sample.icache_misses[r];
+  return result;
+}
+
+static double calibrate_lsu_wait(const CalibrateSample& sample, const GtimingParams& params) {
+  double result = 0;
+  for (uint32_t r = 0; r < GtimingRegions; r++) result += params.lsu[r] * sample.lsu_accesses[r];
+  return result;
+}
+
+// NOTE: solves m x = v for n unknowns in place (gaussian elimination with partial pivoting), false if m is singular
+static bool calibrate_solve(double m[GtimingRegions][GtimingRegions], double v[GtimingRegions], uint32_t n) {
+  for (uint32_t c = 0; c < n; c++) {
+    uint32_t pivot = c;
+    for (uint32_t r = c + 1; r < n; r++) {
+      if (fabs(m[r][c]) > fabs(m[pivot][c])) pivot = r;
+    }
+    if (fabs(m[pivot][c]) < 1e-300) return false;
+    std::swap(m[c], m[pivot]);
+    std::swap(v[c], v[pivot]);
+    for (uint32_t r = c + 1; r < n; r++) {
+      double f = m[r][c] / m[c][c];
+      for (uint32_t k = c; k < n; k++) m[r][k] -= f * m[c][k];
+      v[r] -= f * v[c];
+    }
+  }
+  for (uint32_t c = n; c-- > 0;) {
+    for (uint32_t k = c + 1; k < n; k++) v[c] -= m[c][k] * v[k];
+    v[c] /= m[c][c];
+  }
+  return true;
+}
+
+/*
+  Least squares fit of the region latencies of one counter: row i has the events counts[i][r] of its
+  bin and the wait waits[i] left to them. The unknowns are the factors f[r] of the starting latencies,
+  the residuals are relative to the measured wait, so a long bin does not outweigh a short one, and a
+  small ridge term keeps the factors at 1 where the rows do not constrain them (fewer rows than regions
+  with events, or regions that always come together). Regions without events in any row keep their
+  latency. Returns the number of fitted regions.
+*/
+#define CALIBRATE_RIDGE (1e-6)
+
+static uint32_t calibrate_fit(const char* name, const std::vector<std::array<uint64_t, GtimingRegions>>& counts,
+                              const std::vector<double>& waits, const std::vector<double>& measured, double latencies[GtimingRegions]) {
+  uint32_t regions[GtimingRegions];
+  uint32_t n = 0;
+  for (uint32_t r = 0; r < GtimingRegions; r++) {
+    bool is_seen = false;
+    for (const auto& row : counts) is_seen |= row[r] != 0;
+    if (is_seen && latencies[r] > 0) regions[n++] = r;
+  }
+  if (n == 0) {
+    printf("[WARNING] calibrate: %s latencies are not fitted, no row has %s events\n", name, name);
+    return 0;
+  }
+  double m[GtimingRegions][GtimingRegions] = {};
+  double v[GtimingRegions] = {};
+  for (size_t i = 0; i < counts.size(); i++) {
+    double weight = 1.0 / std::max(measured[i], 1.0);
+    double a[GtimingRegions];
+    for (uint32_t j = 0; j < n; j++) a[j] = weight * counts[i][regions[j]] * latencies[regions[j]];
+    double b = weight * waits[i];
+    for (uint32_t j = 0; j < n; j++) {
+      for (uint32_t k = 0; k < n; k++) m[j][k] += a[j] * a[k];
+      v[j] += a[j] * b;
+    }
+  }
+  for (uint32_t j = 0; j < n; j++) {
+    m[j][j] += CALIBRATE_RIDGE;
+    v[j]    += CALIBRATE_RIDGE;
+  }
+  if (!calibrate_solve(m, v, n)) {
+    printf("[WARNING] calibrate: %s latencies are not fitted, the system is singular\n", name);
+    return 0;
+  }
+  if (counts.size() < n) {
+    printf("[WARNING] calibrate: %zu rows for %u %s latencies, the fit is not unique and stays close to the starting ratios\n", counts.size(), n, name);
+  }
+  for (uint32_t j = 0; j < n; j++) {
+    double latency = latencies[regions[j]] * v[j];
+    if (latency < 0) {
+      printf("[WARNING] calibrate: %s %s latency fitted to %.3f, clamped to 0\n", gtiming_region_names[regions[j]], name, latency);
+      latency = 0;
+    }
+    latencies[regions[j]] = latency;
+  }
+  return n;
+}
+
+static void calibrate_print(const char* name, uint64_t measured, double before, double after) {
+  printf("  %-12s %14lu %14.0f %+8.2f%% %14.0f %+8.2f%%\n", name, measured,
+    before, measured ? 100.0 * (before - measured) / measured : 0.0,
+    after,  measured ? 100.0 * (after  - measured) / measured : 0.0);
+}
+
+/*
+  Fits the timing latencies to rows of measure.csv: samples[i] are the timing events of gold on the bin
+  of row i (a single sample stands for every row, measurements of the same bin). The ifu miss latencies
+  of every region are fitted to the ifu wait left after the hits and the lsu latencies of every region
+  to the lsu wait, by calibrate_fit; ifu_hit is kept. A single bin gives one equation per counter, so
+  the regions are separated only with rows of bins that use them in different proportions.
+*/
+bool calibrate_rows(TestBench* tb, const CalibrateSample* samples, size_t n_samples) {
+  std::vector<uint32_t> rows;
+  if (!calibrate_rows_parse(tb->calibrate_rows, &rows)) return false;
+  if (n_samples != 1 && n_samples != rows.size()) {
+    printf("[ERROR] calibrate: %zu rows for %zu bins, give a row per bin\n", rows.size(), n_samples);
+    return false;
+  }
+  std::vector<std::array<uint64_t, MEASURE_COLUMNS>> measures(rows.size());
+  std::vector<std::string> notes(rows.size());
+  for (size_t i = 0; i < rows.size(); i++) {
+    char row_notes[256] = {};
+    if (!read_measure_row(tb->calibrate_csv, rows[i], measures[i].data(), row_notes, sizeof(row_notes))) return false;
+    notes[i] = row_notes;
+  }
+
+  GtimingParams before = tb->gtiming->params;
+  GtimingParams after  = before;
+  std::vector<std::array<uint64_t, GtimingRegions>> ifu_counts(rows.size()), lsu_counts(rows.size());
+  std::vector<double> ifu_waits(rows.size()), lsu_waits(rows.size()), ifu_measured(rows.size()), lsu_measured(rows.size());
+  for (size_t i = 0; i < rows.size(); i++) {
+    const CalibrateSample& sample = samples[n_samples == 1 ? 0 : i];
+    if (sample.minstret != measures[i][MeasureInstrets]) {
+      printf("[WARNING] calibrate: gold ran %lu instrets, row %u has %lu: is it the same bin?\n", sample.minstret, rows[i], measures[i][MeasureInstrets]);
+    }
+    std::copy(sample.icache_misses, sample.icache_misses + GtimingRegions, ifu_counts[i].begin());
+    std::copy(sample.lsu_accesses,  sample.lsu_accesses  + GtimingRegions, lsu_counts[i].begin());
+    ifu_measured[i] = measures[i][MeasureIfuWait];
+    lsu_measured[i] = measures[i][MeasureLsuWait];
+    ifu_waits[i]    = ifu_measured[i] - before.ifu_hit * sample.icache_hits;
+    lsu_waits[i]    = lsu_measured[i];
+  }
+  calibrate_fit("ifu miss", ifu_counts, ifu_waits, ifu_measured, after.ifu_miss);
+  calibrate_fit("lsu",      lsu_counts, lsu_waits, lsu_measured, after.lsu);
+
+  for (size_t i = 0; i < rows.size(); i++) {
+    const CalibrateSample& sample = samples[n_samples == 1 ? 0 : i];
+    const uint64_t* row = measures[i].data();
+    double ifu_before = calibrate_ifu_wait(sample, before), ifu_after = calibrate_ifu_wait(sample, after);
+    double lsu_before = calibrate_lsu_wait(sample, before), lsu_after = calibrate_lsu_wait(sample, after);
+    printf("[INFO] calibrate on %s row %u (%s):\n", tb->calibrate_csv, rows[i], notes[i].c_str());
+    printf("  %-12s %14s %14s %9s %14s %9s\n", "counter", "measured", "before", "error", "after", "error");
+    calibrate_print("instrets",    row[MeasureInstrets],   sample.minstret, sample.minstret);
+    calibrate_print("cycles",      row[MeasureCycles],     sample.minstret + ifu_before + lsu_before, sample.minstret + ifu_after + lsu_after);
+    calibrate_print("ifu wait",    row[MeasureIfuWait],    ifu_before, ifu_after);
+    calibrate_print("lsu wait",    row[MeasureLsuWait],    lsu_before, lsu_after);
+    calibrate_print("icache hits", row[MeasureIcacheHits], sample.icache_hits, sample.icache_hits);
+  }
+  printf("[INFO] calibrated latencies:\n");
+  printf("  ifu hit %.3f\n", after.ifu_hit);
+  for (uint32_t r = 0; r < GtimingRegions; r++) {
+    uint64_t misses = 0, accesses = 0;
+    for (size_t i = 0; i < n_samples; i++) {
+      misses   += samples[i].icache_misses[r];
+      accesses += samples[i].lsu_accesses[r];
+    }
+    printf("  %-6s ifu miss %10.3f (%lu misses), lsu %10.3f (%lu accesses)\n", gtiming_region_names[r], after.ifu_miss[r], misses, after.lsu[r], accesses);
+  }
+  tb->gtiming->params = after;
+  return g_timing_params_write(tb->calibrate_out, after);
+}
+
+// NOTE: a bin run: gold runs once with the timing layer, every row is a measurement of this bin
+bool test_calibrate(TestBench* tb) {
+  if (!test_gold_run(tb)) return false;
+  CalibrateSample sample = calibrate_sample(tb->gtiming);
+  return calibrate_rows(tb, &sample, 1);
+}
@@ -0,0 +1,348 @@
+/*
+  Checkpoint of the whole testbench: the verilated models through Verilator's savable serialization,
+  Vcpucpu/Gcpu memories and the rest of the testbench state. Everything goes into one gzip stream; the
+  large memory arrays store only their non-zero pages. A restore is valid only for the same bin and
+  the same vsoc|vcpu|gold selection, which is checked by the header.
+*/
+#define CHECKPOINT_MAGIC     (0x31304b4350435652ull) // "RVCPCK01"
+#define CHECKPOINT_PAGE_SIZE (4096u)
+#define CHECKPOINT_PAGE_END  (UINT32_MAX)
+// NOTE: the text state of std::mt19937 is 624 numbers, about 7 KiB
+#define CHECKPOINT_RANDOM_MAX (64 * 1024)
+
+class CheckpointSave : public VerilatedSerialize {
+  gzFile m_file     = NULL;
+  bool   m_isFailed = false; // NOTE: a write or the close failed, e.g. on a full disk
+public:
+  ~CheckpointSave() override { close(); }
+  bool open(const char* path) {
+    m_file   = gzopen(path, "wb1");
+    m_isOpen = m_file != NULL;
+    if (m_isOpen) header();
+    return m_isOpen;
+  }
+  void close() override {
+    if (!m_isOpen) return;
+    flush();
+    if (gzclose(m_file) != Z_OK) m_isFailed = true;
+    m_isOpen = false;
+  }
+  void flush() override {
+    if (m_cp > m_bufp) {
+      unsigned size = m_cp - m_bufp;
+      if ((unsigned)gzwrite(m_file, m_bufp, size) != size) m_isFailed = true;
+    }
+    m_cp = m_bufp;
+  }
+  bool isFailed() const { return m_isFailed; }
+};
+
+class CheckpointRestore : public VerilatedDeserialize {
+  gzFile m_file = NULL;
+public:
+  ~CheckpointRestore() override { close(); }
+  bool open(const char* path) {
+    m_file   = gzopen(path, "rb");
+    m_isOpen = m_file != NULL;
+    if (m_isOpen) {
+      m_cp = m_endp = m_bufp;
+      fill();
+      header();
+    }
+    return m_isOpen;
+  }
+  void close() override {
+    if (!m_isOpen) return;
+    gzclose(m_file);
+    m_isOpen = false;
+  }
+  // NOTE: same as VerilatedRestore::fill, reads through zlib instead of a file descriptor
+  void fill() override {
+    uint8_t* rp = m_bufp;
+    for (uint8_t* sp = m_cp; sp < m_endp; *rp++ = *sp++) {}
+    m_endp = m_bufp + (m_endp - m_cp);
+    m_cp   = m_bufp;
+    while (m_endp < m_bufp + bufferSize()) {
+      int got = gzread(m_file, m_endp, m_bufp + bufferSize() - m_endp);
+      if (got <= 0) {
+        // NOTE: zero fill at eof, so readers do not have to check it
+        memset(m_endp, 0, m_bufp + bufferSize() - m_endp);
+        m_endp = m_bufp + bufferSize();
+        break;
+      }
+      m_endp += got;
+    }
+  }
+};
+
+template <typename T>
+void checkpoint_write(VerilatedSerialize& os, const T& value) {
+  os.write(&value, sizeof(value));
+}
+
+template <typename T>
+void checkpoint_read(VerilatedDeserialize& is, T& value) {
+  is.read(&value, sizeof(value));
+}
+
+// NOTE: only touched pages can be non zero
+void checkpoint_write_pages(VerilatedSerialize& os, const MemBacking* backing) {
+  static const uint8_t zero_page[CHECKPOINT_PAGE_SIZE] = {};
+  for (uint32_t i = 0; i < backing->n_touched; i++) {
+    uint32_t page = backing->touched[i];
+    if (page >= backing->size / CHECKPOINT_PAGE_SIZE) continue;
+    const uint8_t* host = backing->host + page * CHECKPOINT_PAGE_SIZE;
+    if (memcmp(host, zero_page, CHECKPOINT_PAGE_SIZE) == 0) continue;
+    checkpoint_write(os, page);
+    os.write(host, CHECKPOINT_PAGE_SIZE);
+  }
+  checkpoint_write(os, CHECKPOINT_PAGE_END);
+}
+
+bool checkpoint_read_pages(VerilatedDeserialize& is, MemBacking* backing) {
+  mem_backing_clear(backing);
+  while (1) {
+    uint32_t page = 0;
+    checkpoint_read(is, page);
+    if (page == CHECKPOINT_PAGE_END) return true;
+    if (page >= backing->size / CHECKPOINT_PAGE_SIZE) return false;
+    is.read(backing->host + page * CHECKPOINT_PAGE_SIZE, CHECKPOINT_PAGE_SIZE);
+    mem_backing_mark(backing, page * CHECKPOINT_PAGE_SIZE, CHECKPOINT_PAGE_SIZE);
+  }
+}
+
+// NOTE: VEventCounts.mcycle is a model register, it is saved with the model
+void checkpoint_write_counts(VerilatedSerialize& os, VEventCounts* counts) {
+  checkpoint_write(os, counts->ebreak);
+  checkpoint_write(os, counts->minstret);
+  checkpoint_write(os, counts->mifu_wait);
+  checkpoint_write(os, counts->mlsu_wait);
+  checkpoint_write(os, counts->mload_seen);
+  checkpoint_write(os, counts->mstore_seen);
+  checkpoint_write(os, counts->msystem_seen);
+  checkpoint_write(os, counts->mcalc_seen);
+  checkpoint_write(os, counts->mjump_seen);
+  checkpoint_write(os, counts->mbranch_seen);
+  checkpoint_write(os, counts->mbranch_taken);
+  checkpoint_write(os, counts->micache_hits);
+}
+
+void checkpoint_read_counts(VerilatedDeserialize& is, VEventCounts* counts) {
+  checkpoint_read(is, counts->ebreak);
+  checkpoint_read(is, counts->minstret);
+  checkpoint_read(is, counts->mifu_wait);
+  checkpoint_read(is, counts->mlsu_wait);
+  checkpoint_read(is, counts->mload_seen);
+  checkpoint_read(is, counts->mstore_seen);
+  checkpoint_read(is, counts->msystem_seen);
+  checkpoint_read(is, counts->mcalc_seen);
+  checkpoint_read(is, counts->mjump_seen);
+  checkpoint_read(is, counts->mbranch_seen);
+  checkpoint_read(is, counts->mbranch_taken);
+  checkpoint_read(is, counts->micache_hits);
+}
+
+uint64_t checkpoint_flash_hash(TestBench* tb) {
+  uint64_t result = tb->flash_size;
+  for (uint32_t i = 0; i < tb->n_insts; i++) {
+    result = hash_uint64_t(result ^ tb->insts[i]);
+  }
+  return result;
+}
+
+uint8_t checkpoint_cpus(TestBench* tb) {
+  return tb->is_vsoc << 2 | tb->is_vcpu << 1 | tb->is_gold;
+}
+
+// NOTE: written to <path>.tmp and renamed, so an interrupted save keeps the previous checkpoint
+bool checkpoint_save(TestBench* tb, const char* path) {
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  CheckpointSave os;
+  if (!os.open(tmp_path)) {
+    printf("[ERROR] could not open checkpoint %s\n", tmp_path);
+    return false;
+  }
+  checkpoint_write(os, CHECKPOINT_MAGIC);
+  checkpoint_write(os, checkpoint_cpus(tb));
+  checkpoint_write(os, checkpoint_flash_hash(tb));
+
+  checkpoint_write(os, tb->trace_dumps);
+  checkpoint_write(os, tb->vsoc_cycles);
+  checkpoint_write(os, tb->vsoc_ticks);
+  checkpoint_write(os, tb->vcpu_cycles);
+  checkpoint_write(os, tb->vcpu_ticks);
+  checkpoint_write(os, tb->instrets);
+  std::stringstream random_state;
+  random_state << *tb->random_gen;
+  std::string random_string = random_state.str();
+  checkpoint_write(os, (uint64_t)random_string.size());
+  os.write(random_string.data(), random_string.size());
+
+  if (tb->is_vsoc) {
+    os << *tb->vsoc;
+    checkpoint_write_counts(os, &tb->vsoc_cpu->event_counts);
+    checkpoint_write(os, tb->vsoc_cpu->minstret_start);
+    checkpoint_write_pages(os, &vsoc_flash);
+  }
+  if (tb->is_vcpu) {
+    Vcpucpu* cpu = tb->vcpu_cpu;
+    os << *tb->vcpu;
+    checkpoint_write_counts(os, &cpu->event_counts);
+    checkpoint_write_pages(os, &cpu->mem);
+    checkpoint_write_pages(os, &cpu->flash);
+    os.write(cpu->uart, UART_SIZE);
+    checkpoint_write(os, cpu->clock_now);
+    checkpoint_write(os, cpu->clock_pre);
+    checkpoint_write(os, cpu->is_mem_write);
+    checkpoint_write(os, cpu->written_address);
+    checkpoint_write(os, cpu->minstret_start);
+    checkpoint_write(os, cpu->io_ifu_reqValid);
+    checkpoint_write(os, cpu->io_ifu_addr);
+    checkpoint_write(os, cpu->io_lsu_reqValid);
+    checkpoint_write(os, cpu->io_lsu_addr);
+    checkpoint_write(os, cpu->io_lsu_wdata);
+    checkpoint_write(os, cpu->io_lsu_wmask);
+    checkpoint_write(os, cpu->io_lsu_wen);
+    checkpoint_write(os, cpu->io_ifu_respValid_ticks);
+    checkpoint_write(os, cpu->io_lsu_respValid_ticks);
+    checkpoint_write(os, cpu->io_ifu_waitRespValid);
+    checkpoint_write(os, cpu->io_lsu_waitRespValid);
+  }
+  if (tb->is_gold) {
+    Gcpu* cpu = tb->gcpu;
+    checkpoint_write(os, cpu->pc);
+    checkpoint_write(os, cpu->regs);
+    checkpoint_write_pages(os, &cpu->mem);
+    checkpoint_write_pages(os, &cpu->flash);
+    checkpoint_write(os, cpu->instret);
+    checkpoint_write(os, cpu->uart);
+    checkpoint_write(os, cpu->ebreak);
+    checkpoint_write(os, cpu->is_not_mapped);
+    checkpoint_write(os, cpu->is_mem_write);
+    checkpoint_write(os, cpu->written_address);
+  }
+  checkpoint_write(os, CHECKPOINT_MAGIC);
+  os.close();
+  if (os.isFailed()) {
+    printf("[ERROR] could not write checkpoint %s, keeping the previous one\n", tmp_path);
+    unlink(tmp_path);
+    return false;
+  }
+  if (rename(tmp_path, path) != 0) {
+    printf("[ERROR] could not rename checkpoint %s to %s\n", tmp_path, path);
+    return false;
+  }
+  if (tb->verbose >= VerboseInfo4) {
+    printf("[INFO] checkpoint saved to %s at %lu instrets\n", path, tb->instrets);
+  }
+  return true;
+}
+
+bool checkpoint_restore(TestBench* tb, const char* path) {
+  CheckpointRestore is;
+  if (!is.open(path)) {
+    printf("[ERROR] could not open checkpoint %s\n", path);
+    return false;
+  }
+  uint64_t magic = 0; uint8_t cpus = 0; uint64_t flash_hash = 0;
+  checkpoint_read(is, magic);
+  checkpoint_read(is, cpus);
+  checkpoint_read(is, flash_hash);
+  if (magic != CHECKPOINT_MAGIC) {
+    printf("[ERROR] %s is not a checkpoint\n", path);
+    return false;
+  }
+  if (cpus != checkpoint_cpus(tb) || flash_hash != checkpoint_flash_hash(tb)) {
+    printf("[ERROR] checkpoint %s was saved for another bin or vsoc|vcpu|gold selection\n", path);
+    return false;
+  }
+
+  checkpoint_read(is, tb->trace_dumps);
+  checkpoint_read(is, tb->vsoc_cycles);
+  checkpoint_read(is, tb->vsoc_ticks);
+  checkpoint_read(is, tb->vcpu_cycles);
+  checkpoint_read(is, tb->vcpu_ticks);
+  checkpoint_read(is, tb->instrets);
+  uint64_t random_size = 0;
+  checkpoint_read(is, random_size);
+  if (random_size > CHECKPOINT_RANDOM_MAX) {
+    printf("[ERROR] checkpoint %s is corrupted: %" PRIu64 " bytes of random generator state\n", path, random_size);
+    return false;
+  }
+  std::string random_string(random_size, '\0');
+  is.read(&random_string[0], random_size);
+  // NOTE: the read can not fail by itself, it zero fills past the end of the stream
+  std::stringstream random_state(random_string);
+  random_state >> *tb->random_gen;
+  if (random_state.fail()) {
+    printf("[ERROR] checkpoint %s is corrupted: the random generator state does not parse\n", path);
+    return false;
+  }
+
+  bool is_valid = true;
+  if (tb->is_vsoc) {
+    is >> *tb->vsoc;
+    // NOTE: the SDRAM comes with the model, any page of it may be written
+    mem_backing_mark(&tb->vsoc_cpu->mem_written, 0, MEM_SIZE);
+    checkpoint_read_counts(is, &tb->vsoc_cpu->event_counts);
+    checkpoint_read(is, tb->vsoc_cpu->minstret_start);
+    is_valid &= checkpoint_read_pages(is, &vsoc_flash);
+  }
+  if (tb->is_vcpu) {
+    Vcpucpu* cpu = tb->vcpu_cpu;
+    is >> *tb->vcpu;
+    checkpoint_read_counts(is, &cpu->event_counts);
+    is_valid &= checkpoint_read_pages(is, &cpu->mem);
+    is_valid &= checkpoint_read_pages(is, &cpu->flash);
+    is.read(cpu->uart, UART_SIZE);
+    checkpoint_read(is, cpu->clock_now);
+    checkpoint_read(is, cpu->clock_pre);
+    checkpoint_read(is, cpu->is_mem_write);
+    checkpoint_read(is, cpu->written_address);
+    checkpoint_read(is, cpu->minstret_start);
+    checkpoint_read(is, cpu->io_ifu_reqValid);
+    checkpoint_read(is, cpu->io_ifu_addr);
+    checkpoint_read(is, cpu->io_lsu_reqValid);
+    checkpoint_read(is, cpu->io_lsu_addr);
+    checkpoint_read(is, cpu->io_lsu_wdata);
+    checkpoint_read(is, cpu->io_lsu_wmask);
+    checkpoint_read(is, cpu->io_lsu_wen);
+    checkpoint_read(is, cpu->io_ifu_respValid_ticks);
+    checkpoint_read(is, cpu->io_lsu_respValid_ticks);
+    checkpoint_read(is, cpu->io_ifu_waitRespValid);
+    checkpoint_read(is, cpu->io_lsu_waitRespValid);
+  }
+  if (tb->is_gold) {
+    Gcpu* cpu = tb->gcpu;
+    checkpoint_read(is, cpu->pc);
+    checkpoint_read(is, cpu->regs);
+    is_valid &= checkpoint_read_pages(is, &cpu->mem);
+    is_valid &= checkpoint_read_pages(is, &cpu->flash);
+    checkpoint_read(is, cpu->instret);
+    checkpoint_read(is, cpu->uart);
+    checkpoint_read(is, cpu->ebreak);
+    checkpoint_read(is, cpu->is_not_mapped);
+    checkpoint_read(is, cpu->is_mem_write);
+    checkpoint_read(is, cpu->written_address);
+    g_dec_invalidate_all(cpu);
+  }
+  uint64_t end_magic = 0;
+  checkpoint_read(is, end_magic);
+  if (!is_valid || end_magic != CHECKPOINT_MAGIC) {
+    printf("[ERROR] checkpoint %s is corrupted\n", path);
+    return false;
+  }
+  if (tb->mem_dirty) mem_dirty_all(tb->mem_dirty);
+  tb->flash_loaded = 0;
+  if (tb->verbose >= VerboseInfo4) {
+    printf("[INFO] checkpoint restored from %s at %lu instrets\n", path, tb->instrets);
+  }
+  return true;
+}
+
+uint64_t checkpoint_cycles(TestBench* tb) {
+  if (tb->is_vsoc) return tb->vsoc_cycles;
+  if (tb->is_vcpu) return tb->vcpu_cycles;
+  return tb->instrets;
+}
@@ -0,0 +1,340 @@
+/*
+  Commit records and the commit log: the stream of retired instructions of one run written once and
+  compared later against another run of the same bin, so the reference model does not have to run again.
+
+  The log is a header followed by a byte stream. Every record starts with a tag byte:
+    bit 0    -- the pc is not the previous one + 4: zigzag varint of the difference follows
+    bit 1    -- the register file is written: rd byte and zigzag varint of the difference to the previous
+                value of rd follow
+    bits 2-3 -- store of 0 -- nothing, 1 -- byte, 2 -- half, 3 -- word: zigzag varint of the difference to
+                the previous store address and varint of the stored bytes follow
+  Every sync_every records there is a sync point: the index of the next record, the pc of the last one and
+  the registers, which the reader checks against the state it rebuilt. The log ends with the final state
+  of the model. Instructions are not logged: they are in the bin, whose hash is in the header.
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct CommitRecord {
+  uint64_t cycle;
+  uint32_t pc;
+  uint32_t inst;
+  uint32_t rd_wdata;
+  uint32_t mem_addr;
+  uint32_t mem_wdata;
+  uint8_t  rd;        // NOTE: 0 -- the register file is not written
+  uint8_t  mem_wmask; // NOTE: 0 -- not a store, 0b0001|0b0011|0b1111 -- store of the low byte|half|word
+};
+
+// NOTE: the bits of mem_wdata that are stored
+static inline uint32_t commit_mem_mask(uint8_t wmask) {
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < 4; i++) {
+    if (wmask & (1 << i)) mask |= 0xffu << 8*i;
+  }
+  return mask;
+}
+
+#define COMMITLOG_MAGIC      (0x31474f4c4d435652ull) // NOTE: "RVCMLOG1"
+#define COMMITLOG_SYNC_EVERY (1u << 16)
+#define COMMITLOG_BUFFER     (1u << 20)
+
+#define COMMITLOG_PC_JUMP    (0x01)
+#define COMMITLOG_RD         (0x02)
+#define COMMITLOG_STORE_SHIFT (2)
+#define COMMITLOG_SYNC       (0xfe)
+#define COMMITLOG_END        (0xff)
+
+struct CommitLogHeader {
+  uint64_t magic;
+  uint64_t flash_hash;
+  uint32_t sync_every;
+  uint32_t n_regs;
+};
+
+// NOTE: the state both sides rebuild from the records, the deltas are taken against it
+struct CommitLogState {
+  uint64_t n_records;
+  uint32_t pc;
+  uint32_t store_addr;
+  uint32_t regs[N_REGS];
+};
+
+struct CommitLogWriter {
+  FILE*          file;
+  uint8_t*       buffer;
+  size_t         used;
+  uint32_t       sync_every;
+  CommitLogState state;
+};
+
+struct CommitLogReader {
+  uint8_t*       data;
+  size_t         size;
+  size_t         pos;
+  uint32_t       sync_every;
+  CommitLogState state;
+  bool           is_end;
+  bool           is_corrupt;
+  // NOTE: the final state of the logged model, valid once is_end is set
+  uint32_t       end_pc;
+  uint32_t       end_regs[N_REGS];
+  uint8_t        end_ebreak;
+};
+
+static inline uint8_t commitlog_store_size(uint8_t wmask) {
+  switch (wmask) {
+    case 0b0001: return 1;
+    case 0b0011: return 2;
+    case 0b1111: return 3;
+    default:     return 0;
+  }
+}
+
+static inline uint32_t commitlog_store_mask(uint8_t size) {
+  switch (size) {
+    case 1:  return 0x000000ffu;
+    case 2:  return 0x0000ffffu;
+    case 3:  return 0xffffffffu;
+    default: return 0;
+  }
+}
+
+static inline void commitlog_put_varint(CommitLogWriter* w, uint64_t value) {
+  while (value >= 0x80) {
+    w->buffer[w->used++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  w->buffer[w->used++] = (uint8_t)value;
+}
+
+static inline void commitlog_put_zigzag(CommitLogWriter* w, int32_t value) {
+  commitlog_put_varint(w, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static inline void commitlog_put_u32(CommitLogWriter* w, uint32_t value) {
+  memcpy(w->buffer + w->used, &value, sizeof(value));
+  w->used += sizeof(value);
+}
+
+// NOTE: flushed while there is room for the largest item, a sync point or the end
+static inline void commitlog_reserve(CommitLogWriter* w) {
+  if (w->used + 64 + 4 * (N_REGS + 2) > COMMITLOG_BUFFER) {
+    fwrite(w->buffer, 1, w->used, w->file);
+    w->used = 0;
+  }
+}
+
+bool commitlog_open_write(CommitLogWriter* w, const char* path, uint64_t flash_hash) {
+  *w = {};
+  w->file = fopen(path, "wb");
+  if (!w->file) {
+    printf("[ERROR] could not open commit log %s\n", path);
+    return false;
+  }
+  CommitLogHeader header = {
+    .magic      = COMMITLOG_MAGIC,
+    .flash_hash = flash_hash,
+    .sync_every = COMMITLOG_SYNC_EVERY,
+    .n_regs     = N_REGS,
+  };
+  fwrite(&header, sizeof(header), 1, w->file);
+  w->buffer     = (uint8_t*)malloc(COMMITLOG_BUFFER);
+  w->sync_every = COMMITLOG_SYNC_EVERY;
+  w->state.pc   = 0 - 4;
+  return true;
+}
+
+void commitlog_write(CommitLogWriter* w, const CommitRecord* record) {
+  CommitLogState* s = &w->state;
+  commitlog_reserve(w);
+  uint8_t store_size = commitlog_store_size(record->mem_wmask);
+  uint8_t tag = store_size << COMMITLOG_STORE_SHIFT;
+  if (record->pc != s->pc + 4)           tag |= COMMITLOG_PC_JUMP;
+  if (record->rd && record->rd < N_REGS) tag |= COMMITLOG_RD;
+  w->buffer[w->used++] = tag;
+  if (tag & COMMITLOG_PC_JUMP) commitlog_put_zigzag(w, (int32_t)(record->pc - (s->pc + 4)));
+  if (tag & COMMITLOG_RD) {
+    w->buffer[w->used++] = record->rd;
+    commitlog_put_zigzag(w, (int32_t)(record->rd_wdata - s->regs[record->rd]));
+    s->regs[record->rd] = record->rd_wdata;
+  }
+  if (store_size) {
+    commitlog_put_zigzag(w, (int32_t)(record->mem_addr - s->store_addr));
+    commitlog_put_varint(w, record->mem_wdata & commitlog_store_mask(store_size));
+    s->store_addr = record->mem_addr;
+  }
+  s->pc = record->pc;
+  s->n_records++;
+  if (s->n_records % w->sync_every == 0) {
+    w->buffer[w->used++] = COMMITLOG_SYNC;
+    commitlog_put_varint(w, s->n_records);
+    commitlog_put_u32(w, s->pc);
+    for (uint32_t i = 0; i < N_REGS; i++) commitlog_put_u32(w, s->regs[i]);
+  }
+}
+
+// NOTE: the log ends with the final state of the model
+bool commitlog_close_write(CommitLogWriter* w, uint32_t pc, const uint32_t* regs, bool ebreak) {
+  commitlog_reserve(w);
+  w->buffer[w->used++] = COMMITLOG_END;
+  commitlog_put_varint(w, w->state.n_records);
+  commitlog_put_u32(w, pc);
+  for (uint32_t i = 0; i < N_REGS; i++) commitlog_put_u32(w, regs[i]);
+  w->buffer[w->used++] = ebreak;
+  fwrite(w->buffer, 1, w->used, w->file);
+  bool is_ok = !ferror(w->file);
+  is_ok &= fclose(w->file) == 0;
+  free(w->buffer);
+  *w = {};
+  return is_ok;
+}
+
+bool commitlog_open_read(CommitLogReader* r, const char* path, uint64_t flash_hash) {
+  *r = {};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("[ERROR] could not open commit log %s\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CommitLogHeader)) {
+    printf("[ERROR] commit log %s is too short\n", path);
+    close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("[ERROR] could not map commit log %s\n", path);
+    return false;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  r->data = (uint8_t*)data;
+  r->size = st.st_size;
+
+  CommitLogHeader header;
+  memcpy(&header, r->data, sizeof(header));
+  if (header.magic != COMMITLOG_MAGIC || header.n_regs != N_REGS || !header.sync_every) {
+    printf("[ERROR] %s is not a commit log\n", path);
+    return false;
+  }
+  if (header.flash_hash != flash_hash) {
+    printf("[ERROR] commit log %s was written for another bin: hash 0x%lx vs 0x%lx\n", path, header.flash_hash, flash_hash);
+    return false;
+  }
+  r->pos        = sizeof(header);
+  r->sync_every = header.sync_every;
+  r->state.pc   = 0 - 4;
+  return true;
+}
+
+void commitlog_close_read(CommitLogReader* r) {
+  if (r->data) munmap(r->data, r->size);
+  *r = {};
+}
+
+static inline bool commitlog_get_byte(CommitLogReader* r, uint8_t* value) {
+  if (r->pos >= r->size) return false;
+  *value = r->data[r->pos++];
+  return true;
+}
+
+static inline bool commitlog_get_varint(CommitLogReader* r, uint64_t* value) {
+  uint64_t result = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!commitlog_get_byte(r, &byte)) return false;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool commitlog_get_zigzag(CommitLogReader* r, uint32_t* value) {
+  uint64_t raw;
+  if (!commitlog_get_varint(r, &raw)) return false;
+  *value = (uint32_t)(raw >> 1) ^ (0 - (uint32_t)(raw & 1));
+  return true;
+}
+
+static inline bool commitlog_get_u32(CommitLogReader* r, uint32_t* value) {
+  if (r->pos + sizeof(*value) > r->size) return false;
+  memcpy(value, r->data + r->pos, sizeof(*value));
+  r->pos += sizeof(*value);
+  return true;
+}
+
+static bool commitlog_corrupt(CommitLogReader* r, const char* what) {
+  printf("[ERROR] commit log is corrupt at byte %lu, record %lu: %s\n", r->pos, r->state.n_records, what);
+  r->is_corrupt = true;
+  return false;
+}
+
+// NOTE: false at the end of the log (is_end) or if it is corrupt (is_corrupt); the record has no instruction
+bool commitlog_read(CommitLogReader* r, CommitRecord* record) {
+  CommitLogState* s = &r->state;
+  while (1) {
+    if (r->is_end || r->is_corrupt) return false;
+    uint8_t tag;
+    if (!commitlog_get_byte(r, &tag)) return commitlog_corrupt(r, "no end");
+    if (tag == COMMITLOG_SYNC) {
+      uint64_t n_records;
+      uint32_t pc;
+      if (!commitlog_get_varint(r, &n_records) || !commitlog_get_u32(r, &pc)) return commitlog_corrupt(r, "short sync point");
+      if (n_records != s->n_records || pc != s->pc) return commitlog_corrupt(r, "sync point position");
+      for (uint32_t i = 0; i < N_REGS; i++) {
+        uint32_t value;
+        if (!commitlog_get_u32(r, &value)) return commitlog_corrupt(r, "short sync point");
+        if (value != s->regs[i]) return commitlog_corrupt(r, "sync point registers");
+      }
+      continue;
+    }
+    if (tag == COMMITLOG_END) {
+      uint64_t n_records;
+      if (!commitlog_get_varint(r, &n_records) || !commitlog_get_u32(r, &r->end_pc)) return commitlog_corrupt(r, "short end");
+      if (n_records != s->n_records) return commitlog_corrupt(r, "end position");
+      for (uint32_t i = 0; i < N_REGS; i++) {
+        if (!commitlog_get_u32(r, &r->end_regs[i])) return commitlog_corrupt(r, "short end");
+      }
+      if (!commitlog_get_byte(r, &r->end_ebreak)) return commitlog_corrupt(r, "short end");
+      r->is_end = true;
+      return false;
+    }
+    if (tag >> (COMMITLOG_STORE_SHIFT + 2)) return commitlog_corrupt(r, "unknown tag");
+
+    *record = {};
+    record->cycle = s->n_records;
+    record->pc    = s->pc + 4;
+    if (tag & COMMITLOG_PC_JUMP) {
+      uint32_t delta;
+      if (!commitlog_get_zigzag(r, &delta)) return commitlog_corrupt(r, "short pc");
+      record->pc += delta;
+    }
+    if (tag & COMMITLOG_RD) {
+      uint32_t delta;
+      if (!commitlog_get_byte(r, &record->rd) || !commitlog_get_zigzag(r, &delta)) return commitlog_corrupt(r, "short register write");
+      if (!record->rd || record->rd >= N_REGS) return commitlog_corrupt(r, "register number");
+      record->rd_wdata = s->regs[record->rd] + delta;
+      s->regs[record->rd] = record->rd_wdata;
+    }
+    uint8_t store_size = (tag >> COMMITLOG_STORE_SHIFT) & 0b11;
+    if (store_size) {
+      uint32_t delta;
+      uint64_t data;
+      if (!commitlog_get_zigzag(r, &delta) || !commitlog_get_varint(r, &data)) return commitlog_corrupt(r, "short store");
+      record->mem_addr  = s->store_addr + delta;
+      record->mem_wdata = (uint32_t)data;
+      record->mem_wmask = store_size == 1 ? 0b0001 : store_size == 2 ? 0b0011 : 0b1111;
+      s->store_addr = record->mem_addr;
+    }
+    s->pc = record->pc;
+    s->n_records++;
+    return true;
+  }
+}
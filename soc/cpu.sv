@@ -33,6 +33,7 @@ start ------->|IFU|------->|IDU| -------> |LSU|
                      +---+<-----------------+
 */
 
+  logic [REG_W_END:0]     idu_inst;
   logic [REG_A_END:0]     idu_rd;
   logic [REG_A_END:0]     idu_rs1;
   logic [REG_A_END:0]     idu_rs2;
@@ -103,6 +104,7 @@ start ------->|IFU|------->|IDU| -------> |LSU|
     .reqValid (idu_reqValid),
 
     .inst_in  (ifu_inst),
+    .inst_out (idu_inst),
 
     .rd       (idu_rd),
     .rs1      (idu_rs1),
@@ -190,6 +192,8 @@ start ------->|IFU|------->|IDU| -------> |LSU|
     .alu_op   (idu_alu_op),
     .com_op   (idu_com_op),
     .imm      (idu_imm),
+    .inst     (idu_inst),
+    .rd       (idu_rd),
     .inst_type(idu_inst_type));
 
   logic is_start;
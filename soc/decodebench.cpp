@@ -0,0 +1,65 @@
+/*
+  Decodes every 32-bit encoding with decode_reference() and the table driven decode(), prints the
+  throughput of both and checks that they agree on every encoding.
+*/
+static bool dec_equal(const Dec_out& a, const Dec_out& b) {
+  return a.reg_dest    == b.reg_dest    &&
+         a.reg_src1    == b.reg_src1    &&
+         a.reg_src2    == b.reg_src2    &&
+         a.imm         == b.imm         &&
+         a.mem_wbmask  == b.mem_wbmask  &&
+         a.is_mem_sign == b.is_mem_sign &&
+         a.alu_op      == b.alu_op      &&
+         a.com_op      == b.com_op      &&
+         a.ebreak      == b.ebreak      &&
+         a.inst_type   == b.inst_type   &&
+         a.opcode_funct3 == b.opcode_funct3;
+}
+
+// NOTE: folds every field, so the decode loops can not be optimized away
+static uint64_t dec_fold(uint64_t acc, const Dec_out& d) {
+  acc += d.imm ^ d.inst_type << 8 ^ d.alu_op << 16 ^ d.com_op << 20 ^ d.mem_wbmask << 24;
+  acc += d.reg_dest ^ d.reg_src1 << 5 ^ d.reg_src2 << 10 ^ d.is_mem_sign << 15 ^ d.ebreak << 16;
+  return acc;
+}
+
+template <Dec_out (*DECODE)(uint32_t)>
+static double decode_bench_run(const char* name, uint64_t* acc) {
+  auto start = std::chrono::steady_clock::now();
+  uint32_t inst = 0;
+  do {
+    *acc = dec_fold(*acc, DECODE(inst));
+  } while (++inst != 0);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("[INFO] %-9s decode: %" PRIu64 " encodings in %.3f s, %.2f M/s\n", name, (uint64_t)1 << 32, seconds, ((uint64_t)1 << 32) / seconds / 1e6);
+  return seconds;
+}
+
+bool decode_bench() {
+  uint64_t acc_reference = 0;
+  uint64_t acc_tables    = 0;
+  double reference_seconds = decode_bench_run<decode_reference>("reference", &acc_reference);
+  double tables_seconds    = decode_bench_run<decode>("tables", &acc_tables);
+  printf("[INFO] tables speedup: x%.2f\n", reference_seconds / tables_seconds);
+
+  uint32_t inst = 0;
+  do {
+    Dec_out expected = decode_reference(inst);
+    Dec_out actual   = decode(inst);
+    if (!dec_equal(expected, actual)) {
+      printf("[FAILED] decode mismatch on 0x%08x: ", inst);
+      print_instruction(inst);
+      printf("  reference: type=%u imm=0x%x alu=%u com=%u wbmask=%u sign=%u ebreak=%u\n",
+             expected.inst_type, expected.imm, expected.alu_op, expected.com_op, expected.mem_wbmask, expected.is_mem_sign, expected.ebreak);
+      printf("  tables   : type=%u imm=0x%x alu=%u com=%u wbmask=%u sign=%u ebreak=%u\n",
+             actual.inst_type, actual.imm, actual.alu_op, actual.com_op, actual.mem_wbmask, actual.is_mem_sign, actual.ebreak);
+      return false;
+    }
+  } while (++inst != 0);
+  if (acc_reference != acc_tables) {
+    printf("[FAILED] decode checksums differ: 0x%" PRIx64 " != 0x%" PRIx64 "\n", acc_reference, acc_tables);
+    return false;
+  }
+  printf("[INFO] decode tables match the reference on every encoding\n");
+  return true;
+}
@@ -24,6 +24,8 @@ module exu (
   input  logic [ALU_OP_END:0]    alu_op,
   input  logic [COM_OP_END:0]    com_op,
   input  logic [REG_W_END:0]     imm,
+  input  logic [REG_W_END:0]     inst,
+  input  logic [REG_A_END:0]     rd,
   input  logic [INST_TYPE_END:0] inst_type);
 
 /* verilator lint_off UNUSEDPARAM */
@@ -198,12 +200,37 @@ import "DPI-C" context task exu_perf_measure(
 
 import "DPI-C" context task exu_perf_reset();
 
+// NOTE: one record per retired instruction, rd is 0 if it does not write the register file
+import "DPI-C" context task exu_commit(
+  input int pc,
+  input int inst,
+  input int rd,
+  input int rd_wdata,
+  input int mem_addr,
+  input int mem_wdata,
+  input int mem_wmask);
+
+logic [3:0] commit_wmask;
+always_comb begin
+  commit_wmask = 4'b0000;
+  if (inst_type[5:3] == INST_STORE) begin
+    case (inst_type[1:0])
+      2'b00:   commit_wmask = 4'b0001;
+      2'b01:   commit_wmask = 4'b0011;
+      default: commit_wmask = 4'b1111;
+    endcase
+  end
+end
+
 always_ff @(posedge clock or posedge reset) begin
   if (reset) begin
     exu_perf_reset();
   end
   else begin
     exu_perf_measure(is_ebreak, is_instret, is_ifu_wait, is_lsu_wait, is_load_seen, is_store_seen, is_system_seen, is_calc_seen, is_jump_seen, is_branch_seen, is_branch_taken);
+    if (is_instret) begin
+      exu_commit(pc, inst, rf_wen ? 32'(rd) : 32'd0, rf_wdata, lsu_addr, lsu_wdata, 32'(commit_wmask));
+    end
   end
 end
 
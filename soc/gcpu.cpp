@@ -1,5 +1,11 @@
 #include <cstdint>
 #include <assert.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
 #include "mem_map.h"
 
 #define ALU_OP_ADD  (0b0000)
@@ -94,35 +100,223 @@ struct VSoCcpu {
   uint32_t& pc;
   VlUnpacked<uint32_t, 16>&  regs;
   VlUnpacked<uint16_t, 16777216>& mem;
+  // NOTE: pages of mem written by the lsu since the last vsoc_reset, host is mem
+  MemBacking mem_written;
   Vuart uart;
 
   VEventCounts event_counts;
   uint64_t minstret_start;
 };
 
+struct Dec_out {
+  uint8_t  reg_dest;
+  uint8_t  reg_src1;
+  uint8_t  reg_src2;
+  uint32_t imm;
+  uint8_t  mem_wbmask;
+  uint8_t  is_mem_sign;
+  uint8_t  alu_op;
+  uint8_t  com_op;
+  uint8_t  ebreak;
+  uint32_t inst_type;
+  bool     not_implemented;
+  // NOTE: opcode | funct3 << 7, the key of DEC_TABLE
+  uint16_t opcode_funct3;
+};
+
+// NOTE: predecoded instructions of one 4KB page of flash or mem; allocated on the first fetch from the page
+#define DEC_PAGE_BITS  (12)
+#define DEC_PAGE_INSTS (1 << (DEC_PAGE_BITS - 2))
+
+struct Dec_page {
+  uint8_t valid[DEC_PAGE_INSTS];
+  Dec_out dec[DEC_PAGE_INSTS];
+};
+
+enum GcpuEngine {
+  GcpuEngineInterp,
+  GcpuEngineThreaded,
+  GcpuEngineJit,
+};
+
+struct Sb_block;
+struct Jit_entry;
+struct Gtiming;
+struct Gprofile;
+
 struct Gcpu {
   uint32_t pc = INITIAL_PC;
   uint32_t regs[N_REGS];
 
-  uint8_t mem[MEM_SIZE+4];
-  uint8_t flash[FLASH_SIZE+4];
+  MemBacking mem;
+  MemBacking flash;
+  MemMap     mem_map;
+  bool       is_hugepages  = false;
+
+  Dec_page* dec_flash[FLASH_SIZE >> DEC_PAGE_BITS];
+  Dec_page* dec_mem[MEM_SIZE >> DEC_PAGE_BITS];
+  Dec_out   dec_uncached;
+  // NOTE: decoded instructions were dropped, each engine flushes its own translations and clears its flag
+  bool      sb_dirty;
+  bool      jit_dirty;
+
+  GcpuEngine engine        = GcpuEngineInterp;
+  Sb_block** sb_table;
+  uint8_t*   sb_arena;
+  size_t     sb_arena_used;
+
+  uint8_t*   jit_code;
+  size_t     jit_code_start;
+  size_t     jit_code_used;
+  uint8_t*   jit_enter;
+  uint8_t*   jit_exit;
+  uint8_t*   jit_epilogue;
+  Jit_entry* jit_table;
+  uint64_t   jit_left;
+  uint64_t   jit_generation;
+  bool       jit_failed;
+
+  uint64_t instret         = 0;
+  // NOTE: optional timing layer, set only for runs that estimate vsoc cycles
+  Gtiming*  timing         = NULL;
+  // NOTE: optional workload profiler
+  Gprofile* profile        = NULL;
+  // NOTE: uart registers used when no verilated model provides them (gold only runs)
+  uint8_t uart[8];
+  Vuart*  own_vuart        = NULL;
 
   uint8_t ebreak           = false;
   bool    is_not_mapped    = false;
   bool    is_mem_write     = false;
   uint32_t written_address = 0;
+  // NOTE: optional, the SDRAM lines written since the last memcmp of the models
+  MemDirty* mem_dirty      = NULL;
   VerboseLevel verbose     = VerboseFailed;
   Vuart*  vuart;
 };
 
-void g_reset(Gcpu* cpu) {
+uint32_t g_uart_read(void* ctx, uint32_t offset) {
+  Gcpu* cpu = (Gcpu*)ctx;
+  uint8_t byte = 0;
+  switch (offset) {
+    case 0 : byte = (cpu->vuart->dl >> 0) & 0xff; break;
+    case 1 : byte = cpu->vuart->ier; break;
+    case 2 : byte = cpu->vuart->iir; break;
+    case 3 : byte = cpu->vuart->lcr; break;
+    case 5 : {
+      if (cpu->vuart->lsr_packed) byte = cpu->vuart->lsr;
+      else byte =
+        (cpu->vuart->lsr0 << 0) |
+        (cpu->vuart->lsr1 << 1) |
+        (cpu->vuart->lsr2 << 2) |
+        (cpu->vuart->lsr3 << 3) |
+        (cpu->vuart->lsr4 << 4) |
+        (cpu->vuart->lsr5 << 5) |
+        (cpu->vuart->lsr6 << 6) |
+        (cpu->vuart->lsr7 << 7) ;
+    } break;
+    case 6 : byte = cpu->vuart->msr; break;
+    default:
+      cpu->is_not_mapped = true;
+      if (cpu->verbose >= VerboseWarning) {
+        printf("[WARNING]: gcpu uart register is not implemented 0x%x\n", offset);
+      }
+      break;
+  }
+  return
+    byte << 24 | byte << 16 |
+    byte <<  8 | byte <<  0 ;
+}
+
+void g_uart_write(void* ctx, uint32_t offset, uint8_t wbmask, uint32_t wdata) {
+  Gcpu* cpu = (Gcpu*)ctx;
+  if (!cpu->own_vuart || cpu->vuart != cpu->own_vuart) return;
+  uint8_t byte = (wdata >> 8*(offset & 0b11)) & 0xff;
+  if (offset == 0) {
+    fputc(byte, stderr);
+  }
+  else if (offset != 5 && offset != 6 && offset < sizeof(cpu->uart)) {
+    cpu->uart[offset] = byte;
+  }
+}
+
+// NOTE: uart over cpu->uart, used instead of the verilated model's uart when gold runs on its own
+Vuart* g_own_uart(Gcpu* cpu) {
+  if (!cpu->own_vuart) {
+    cpu->own_vuart = new Vuart {
+      .dl  = ((uint16_t*)cpu->uart)[0],
+      .ier = cpu->uart[1],
+      .iir = cpu->uart[2],
+      .fcr = cpu->uart[2],
+      .mcr = cpu->uart[4],
+      .msr = cpu->uart[6],
+      .lcr = cpu->uart[3],
+      .lsr = cpu->uart[5],
+      .lsr0= cpu->uart[5],
+      .lsr1= cpu->uart[5],
+      .lsr2= cpu->uart[5],
+      .lsr3= cpu->uart[5],
+      .lsr4= cpu->uart[5],
+      .lsr5= cpu->uart[5],
+      .lsr6= cpu->uart[5],
+      .lsr7= cpu->uart[5],
+      .lsr_packed = true,
+    };
+  }
+  return cpu->own_vuart;
+}
+
+void g_mem_map_init(Gcpu* cpu) {
+  mem_backing_init(&cpu->mem,   MEM_SIZE,   cpu->is_hugepages);
+  mem_backing_init(&cpu->flash, FLASH_SIZE, cpu->is_hugepages);
+  mem_map_init(&cpu->mem_map, ~0u);
+  mem_map_region(&cpu->mem_map, FLASH_START, FLASH_SIZE, cpu->flash.host, false);
+  mem_map_region(&cpu->mem_map, MEM_START,   MEM_SIZE,   cpu->mem.host,   true);
+  mem_map_mmio(&cpu->mem_map, UART_START, UART_END, cpu, g_uart_read, g_uart_write);
+}
+
+static void g_code_dirty(Gcpu* cpu) {
+  cpu->sb_dirty  = true;
+  cpu->jit_dirty = true;
+}
+
+static void g_dec_invalidate_pages(Gcpu* cpu, Dec_page** pages, uint32_t n_pages, const MemBacking* backing) {
+  for (uint32_t i = 0; i < backing->n_touched; i++) {
+    uint32_t page = backing->touched[i];
+    if (page < n_pages && pages[page]) {
+      memset(pages[page]->valid, 0, sizeof(pages[page]->valid));
+      g_code_dirty(cpu);
+    }
+  }
+}
+
+// NOTE: zeroes the touched pages of mem, instructions decoded from them are dropped
+void g_mem_clear(Gcpu* cpu) {
+  static_assert(DEC_PAGE_BITS == MEM_MAP_PAGE_BITS, "decoded pages are the touched pages");
+  g_dec_invalidate_pages(cpu, cpu->dec_mem, MEM_SIZE >> DEC_PAGE_BITS, &cpu->mem);
+  mem_backing_clear(&cpu->mem);
+}
+
+// NOTE: same as g_mem_clear for flash
+void g_flash_clear(Gcpu* cpu) {
+  g_dec_invalidate_pages(cpu, cpu->dec_flash, FLASH_SIZE >> DEC_PAGE_BITS, &cpu->flash);
+  mem_backing_clear(&cpu->flash);
+}
+
+// NOTE: g_reset for the next program of a campaign, g_flash_rewrite replaces the previous program in flash
+void g_reset_keep_flash(Gcpu* cpu) {
   if (cpu->verbose >= VerboseInfo4) {
     printf("[INFO4] gold reset\n");
   }
-  // memset(cpu->mem, 0, MEM_SIZE);
-  // memset(cpu->flash, 0, FLASH_SIZE);
+  if (!cpu->mem_map.read_pages) g_mem_map_init(cpu);
+  g_mem_clear(cpu);
   cpu->pc = INITIAL_PC;
   cpu->ebreak = 0;
+  cpu->instret = 0;
+  memset(cpu->uart, 0, sizeof(cpu->uart));
+  cpu->uart[2] = 0b1100'0000;
+  cpu->uart[3] = 0b0000'0011;
+  cpu->uart[5] = 0b0010'0000;
   for (uint32_t i = 0; i < N_REGS; i++) {
     cpu->regs[i] = 0;
   }
@@ -131,9 +325,55 @@ void g_reset(Gcpu* cpu) {
   cpu->written_address = 0;
 }
 
+void g_reset(Gcpu* cpu) {
+  g_flash_clear(cpu);
+  g_reset_keep_flash(cpu);
+}
+
+void g_dec_invalidate(Gcpu* cpu, uint32_t mapped_addr) {
+  // NOTE: a store of up to 4 bytes at any alignment touches at most two instruction words
+  for (uint32_t addr = mapped_addr & ~3; addr <= mapped_addr + 3; addr += 4) {
+    Dec_page* page = cpu->dec_mem[addr >> DEC_PAGE_BITS];
+    uint32_t  i    = (addr >> 2) & (DEC_PAGE_INSTS-1);
+    if (page && page->valid[i]) {
+      page->valid[i] = 0;
+      g_code_dirty(cpu);
+    }
+  }
+}
+
+// NOTE: drops all decoded instructions, used when memory is written around g_mem_write (restore)
+void g_dec_invalidate_all(Gcpu* cpu) {
+  for (uint32_t i = 0; i < (FLASH_SIZE >> DEC_PAGE_BITS); i++) {
+    if (cpu->dec_flash[i]) memset(cpu->dec_flash[i]->valid, 0, sizeof(cpu->dec_flash[i]->valid));
+  }
+  for (uint32_t i = 0; i < (MEM_SIZE >> DEC_PAGE_BITS); i++) {
+    if (cpu->dec_mem[i]) memset(cpu->dec_mem[i]->valid, 0, sizeof(cpu->dec_mem[i]->valid));
+  }
+  g_code_dirty(cpu);
+}
+
+// NOTE: flash holds only the previous program of old_size bytes, only the bytes of both are written
+void g_flash_rewrite(Gcpu* cpu, uint8_t* data, uint32_t size, uint32_t old_size) {
+  mem_backing_rewrite(&cpu->flash, data, size, old_size);
+  uint32_t end = size > old_size ? size : old_size;
+  for (uint32_t i = 0; i < end; i += 1 << DEC_PAGE_BITS) {
+    Dec_page* page = cpu->dec_flash[i >> DEC_PAGE_BITS];
+    if (page) {
+      memset(page->valid, 0, sizeof(page->valid));
+      g_code_dirty(cpu);
+    }
+  }
+}
+
 void g_flash_init(Gcpu* cpu, uint8_t* data, uint32_t size) {
-  for (uint32_t i = 0; i < size; i++) {
-    cpu->flash[i] = data[i];
+  mem_backing_write(&cpu->flash, 0, data, size);
+  for (uint32_t i = 0; i < size; i += 1 << DEC_PAGE_BITS) {
+    Dec_page* page = cpu->dec_flash[i >> DEC_PAGE_BITS];
+    if (page) {
+      memset(page->valid, 0, sizeof(page->valid));
+      g_code_dirty(cpu);
+    }
   }
   if (cpu->verbose >= VerboseInfo4) {
     printf("[INFO4] gold flash written: %u bytes\n", size);
@@ -144,26 +384,26 @@ void g_mem_write(Gcpu* cpu, uint8_t wen, uint8_t wbmask, uint32_t addr, uint32_t
   cpu->is_mem_write = wen;
   if (wen) {
     cpu->written_address = addr;
-    if (addr >= FLASH_START && addr < FLASH_END-3) {
-      cpu->is_not_mapped = true;
-      if (cpu->verbose >= VerboseWarning) {
-        printf("[WARNING]: gcpu tried to write to flash memory 0x%x\n", addr);
-      }
-    }
-    else if (addr >= UART_START && addr < UART_END) {
-    }
-    else if (addr >= MEM_START && addr < MEM_END-3) {
-      uint32_t mapped_addr = addr - MEM_START;
-      if (wbmask & 0b0001) cpu->mem[mapped_addr + 0] = (wdata >>  0) & 0xff;
-      if (wbmask & 0b0010) cpu->mem[mapped_addr + 1] = (wdata >>  8) & 0xff;
-      if (wbmask & 0b0100) cpu->mem[mapped_addr + 2] = (wdata >> 16) & 0xff;
-      if (wbmask & 0b1000) cpu->mem[mapped_addr + 3] = (wdata >> 24) & 0xff;
-    }
-    else {
-      cpu->is_not_mapped = true;
-      if (cpu->verbose >= VerboseWarning) {
-        printf("[WARNING]: gcpu mem write is not mapped 0x%x\n", addr);
-      }
+    switch (mem_map_write(&cpu->mem_map, addr, wbmask, wdata)) {
+      case MemMapOk: {
+        if (addr - MEM_START < MEM_SIZE) {
+          mem_backing_mark(&cpu->mem, addr - MEM_START, 4);
+          if (cpu->mem_dirty) mem_dirty_mark(cpu->mem_dirty, addr - MEM_START, 4);
+          g_dec_invalidate(cpu, addr - MEM_START);
+        }
+      } break;
+      case MemMapReadOnly: {
+        cpu->is_not_mapped = true;
+        if (cpu->verbose >= VerboseWarning) {
+          printf("[WARNING]: gcpu tried to write to flash memory 0x%x\n", addr);
+        }
+      } break;
+      case MemMapNotMapped: {
+        cpu->is_not_mapped = true;
+        if (cpu->verbose >= VerboseWarning) {
+          printf("[WARNING]: gcpu mem write is not mapped 0x%x\n", addr);
+        }
+      } break;
     }
     if (cpu->verbose >= VerboseInfo5) {
       printf("[INFO5] gcpu mem write:(%x) 0x%x to 0x%x\n", wbmask, wdata, addr);
@@ -171,61 +411,16 @@ void g_mem_write(Gcpu* cpu, uint8_t wen, uint8_t wbmask, uint32_t addr, uint32_t
   }
 }
 
-uint32_t g_mem_read(Gcpu* cpu, uint32_t un_addr) {
-  uint32_t addr = un_addr;
+uint32_t g_mem_read(Gcpu* cpu, uint32_t addr) {
   uint32_t result = 0;
-  if (addr >= FLASH_START && addr < FLASH_END-3) {
-    addr -= FLASH_START;
-    result = 
-      cpu->flash[addr+3] << 24 | cpu->flash[addr+2] << 16 |
-      cpu->flash[addr+1] <<  8 | cpu->flash[addr+0] <<  0 ;
-  }
-  else if (addr >= UART_START && addr < UART_END) {
-    addr -= UART_START;
-    uint8_t byte = 0;
-    switch (addr) {
-      case 0 : byte = (cpu->vuart->dl >> 0) & 0xff; break;
-      case 1 : byte = cpu->vuart->ier; break;
-      case 2 : byte = cpu->vuart->iir; break;
-      case 3 : byte = cpu->vuart->lcr; break;
-      case 5 : {
-        if (cpu->vuart->lsr_packed) byte = cpu->vuart->lsr;
-        else byte =
-          (cpu->vuart->lsr0 << 0) |
-          (cpu->vuart->lsr1 << 1) |
-          (cpu->vuart->lsr2 << 2) |
-          (cpu->vuart->lsr3 << 3) |
-          (cpu->vuart->lsr4 << 4) |
-          (cpu->vuart->lsr5 << 5) |
-          (cpu->vuart->lsr6 << 6) |
-          (cpu->vuart->lsr7 << 7) ;
-      } break;
-      case 6 : byte = cpu->vuart->msr; break;
-      default:
-        cpu->is_not_mapped = true;
-        if (cpu->verbose >= VerboseWarning) {
-          printf("[WARNING]: gcpu uart register is not implemented 0x%x\n", addr);
-        }
-        break;
-    }
-    result = 
-      byte << 24 | byte << 16 |
-      byte <<  8 | byte <<  0 ;
-  }
-  else if (addr >= MEM_START && addr < MEM_END-3) {
-    addr -= MEM_START;
-    result = 
-      cpu->mem[addr+3] << 24 | cpu->mem[addr+2] << 16 |
-      cpu->mem[addr+1] <<  8 | cpu->mem[addr+0] <<  0 ;
-  }
-  else {
+  if (mem_map_read(&cpu->mem_map, addr, &result) != MemMapOk) {
     cpu->is_not_mapped = true;
     if (cpu->verbose >= VerboseWarning) {
-      printf("[WARNING]: gcpu mem read  memory is not mapped 0x%x\n", un_addr);
+      printf("[WARNING]: gcpu mem read  memory is not mapped 0x%x\n", addr);
     }
   }
   if (cpu->verbose >= VerboseInfo5) {
-    printf("[INFO5] gcpu mem read memory: 0x%x from 0x%x\n", result, un_addr);
+    printf("[INFO5] gcpu mem read memory: 0x%x from 0x%x\n", result, addr);
   }
   return result;
 }
@@ -242,7 +437,7 @@ static bool slt(uint32_t a, uint32_t b) {
 }
 
 uint32_t alu_eval(uint8_t op, uint32_t lhs, uint32_t rhs) {
-  uint32_t shamt = take_bits_range(rhs, 0, 4);
+  uint32_t shamt = rhs & 0x1f;
   uint32_t result = 0;
   switch (op) {
     case ALU_OP_ADD:  result = lhs + rhs;         break;
@@ -299,32 +494,17 @@ void rf_write(Gcpu* cpu, uint8_t write_enable, uint8_t reg_dest, uint32_t write_
   }
 }
 
-struct Dec_out {
-  uint8_t  reg_dest;
-  uint8_t  reg_src1;
-  uint8_t  reg_src2;
-  uint32_t imm;
-  uint8_t  mem_wbmask;
-  uint8_t  is_mem_sign;
-  uint8_t  alu_op;
-  uint8_t  com_op;
-  uint8_t  ebreak;
-  uint32_t inst_type;
-  bool     not_implemented;
-};
-
-Dec_out decode(uint32_t inst) {
+// NOTE: the field by field decoder the tables replaced; decodebench checks decode() against it
+Dec_out decode_reference(uint32_t inst) {
   Dec_out out = {};
   uint8_t opcode = take_bits_range(inst, 0, 6);
   out.reg_dest   = take_bits_range(inst, 7, 11);
   uint8_t funct3 = take_bits_range(inst, 12, 14);
-  uint8_t funct7 = take_bits_range(inst, 25, 31);
   out.reg_src1   = take_bits_range(inst, 15, 19);
   out.reg_src2   = take_bits_range(inst, 20, 24);
   uint8_t sign   = take_bit(inst, 31);
   uint8_t sub    = take_bit(inst, 30);
 
-
   uint32_t i_imm = 0;
   if (sign) i_imm = (~0u << 12) | take_bits_range(inst, 20, 31);
   else      i_imm = ( 0u << 12) | take_bits_range(inst, 20, 31);
@@ -350,7 +530,7 @@ Dec_out decode(uint32_t inst) {
     case OPCODE_CALC_IMM: {
       out.imm = i_imm;
       out.inst_type = INST_IMM;
-      out.alu_op = (sub & funct3==FUNCT3_SR) << 3 | funct3;
+      out.alu_op = (sub & (funct3==FUNCT3_SR)) << 3 | funct3;
     } break;
     case OPCODE_CALC_REG: {
       out.inst_type = INST_REG;
@@ -359,11 +539,11 @@ Dec_out decode(uint32_t inst) {
     case OPCODE_LOAD: {
       out.imm = i_imm;
       switch (funct3) {
-        case FUNCT3_LB:  out.inst_type = (0b011 << 2)|funct3 & 0b11; break;
-        case FUNCT3_LH:  out.inst_type = (0b011 << 2)|funct3 & 0b11; break;
-        case FUNCT3_LW:  out.inst_type = (0b011 << 2)|funct3 & 0b11; break;
-        case FUNCT3_LBU: out.inst_type = (0b011 << 2)|funct3 & 0b11; break;
-        case FUNCT3_LHU: out.inst_type = (0b011 << 2)|funct3 & 0b11; break;
+        case FUNCT3_LB:  out.inst_type = (0b011 << 2)|(funct3 & 0b11); break;
+        case FUNCT3_LH:  out.inst_type = (0b011 << 2)|(funct3 & 0b11); break;
+        case FUNCT3_LW:  out.inst_type = (0b011 << 2)|(funct3 & 0b11); break;
+        case FUNCT3_LBU: out.inst_type = (0b011 << 2)|(funct3 & 0b11); break;
+        case FUNCT3_LHU: out.inst_type = (0b011 << 2)|(funct3 & 0b11); break;
         default:         out.inst_type = 0;                          break;
       }
     } break;
@@ -408,12 +588,701 @@ Dec_out decode(uint32_t inst) {
   }
 
   out.is_mem_sign = !(funct3 & 0b100);
+  out.opcode_funct3 = opcode | funct3 << 7;
   return out;
 }
 
+/*
+  Decode table keyed on opcode and funct3, built at compile time. An entry holds everything decode()
+  needs besides the register fields and the immediate: inst_type, the immediate format (shared with
+  inst_info() through IMM_FORMATS), alu_op, com_op and the store byte mask. alu_sub marks the entries
+  where funct7[5] selects sub/sra and becomes alu_op bit 3.
+*/
+struct Dec_entry {
+  uint8_t inst_type;
+  uint8_t imm_format;
+  uint8_t alu_op;
+  uint8_t alu_sub;
+  uint8_t com_op;
+  uint8_t mem_wbmask;
+  uint8_t is_system;
+};
+
+#define DEC_TABLE_SIZE (1 << 10)
+
+struct Dec_table {
+  Dec_entry entry[DEC_TABLE_SIZE];
+};
+
+static constexpr Dec_entry dec_entry_build(uint32_t opcode, uint32_t funct3) {
+  Dec_entry entry = {};
+  entry.imm_format = IMM_FORMATS.format[opcode];
+  entry.alu_op     = ALU_OP_ADD;
+  switch (opcode) {
+    case OPCODE_CALC_IMM: {
+      entry.inst_type = INST_IMM;
+      entry.alu_op    = funct3;
+      entry.alu_sub   = funct3 == FUNCT3_SR ? 0b1000 : 0;
+    } break;
+    case OPCODE_CALC_REG: {
+      entry.inst_type = INST_REG;
+      entry.alu_op    = funct3;
+      entry.alu_sub   = funct3 == FUNCT3_SR || funct3 == FUNCT3_ADD ? 0b1000 : 0;
+    } break;
+    case OPCODE_LOAD: {
+      switch (funct3) {
+        case FUNCT3_LB:
+        case FUNCT3_LH:
+        case FUNCT3_LW:
+        case FUNCT3_LBU:
+        case FUNCT3_LHU: entry.inst_type = (0b011 << 2) | (funct3 & 0b11); break;
+        default:         entry.inst_type = 0;                              break;
+      }
+    } break;
+    case OPCODE_STORE: {
+      switch (funct3) {
+        case FUNCT3_SB: entry.mem_wbmask = 0b0001; break;
+        case FUNCT3_SH: entry.mem_wbmask = 0b0011; break;
+        case FUNCT3_SW: entry.mem_wbmask = 0b1111; break;
+        default:        entry.mem_wbmask = 0b0000; break;
+      }
+      entry.inst_type = INST_STORE;
+    } break;
+    case OPCODE_LUI:    entry.inst_type = INST_UPP;    break;
+    case OPCODE_AUIPC:  entry.inst_type = INST_AUIPC;  break;
+    case OPCODE_JALR:   entry.inst_type = INST_JUMPR;  break;
+    case OPCODE_JAL:    entry.inst_type = INST_JUMP;   break;
+    case OPCODE_BRANCH: {
+      entry.inst_type = INST_BRANCH;
+      entry.com_op    = funct3;
+    } break;
+    case OPCODE_SYSTEM: entry.is_system = 1;           break;
+  }
+  return entry;
+}
+
+static constexpr Dec_table dec_table_build() {
+  Dec_table table = {};
+  for (uint32_t i = 0; i < DEC_TABLE_SIZE; i++) {
+    table.entry[i] = dec_entry_build(i & 0x7f, i >> 7);
+  }
+  return table;
+}
+
+static constexpr Dec_table DEC_TABLE = dec_table_build();
+
+Dec_out decode(uint32_t inst) {
+  uint32_t funct3 = inst_funct3(inst);
+  uint32_t key    = inst_opcode(inst) | funct3 << 7;
+  const Dec_entry& entry = DEC_TABLE.entry[key];
+  Dec_out out = {};
+  out.reg_dest    = inst_rd(inst);
+  out.reg_src1    = inst_rs1(inst);
+  out.reg_src2    = inst_rs2(inst);
+  out.imm         = imm_decode((ImmFormat)entry.imm_format, inst);
+  out.inst_type   = entry.inst_type;
+  out.alu_op      = entry.alu_op | (entry.alu_sub & (inst >> 27));
+  out.com_op      = entry.com_op;
+  out.mem_wbmask  = entry.mem_wbmask;
+  out.ebreak      = entry.is_system & (inst >> 20);
+  out.is_mem_sign = !(funct3 & 0b100);
+  out.opcode_funct3 = key;
+  return out;
+}
+
+const Dec_out* g_fetch_decode(Gcpu* cpu, uint32_t pc) {
+  uint32_t addr = pc & ~3;
+  Dec_page** slot = NULL;
+  if      (addr >= FLASH_START && addr < FLASH_END) slot = &cpu->dec_flash[(addr - FLASH_START) >> DEC_PAGE_BITS];
+  else if (addr >= MEM_START   && addr < MEM_END)   slot = &cpu->dec_mem[(addr - MEM_START) >> DEC_PAGE_BITS];
+  else {
+    cpu->dec_uncached = decode(g_mem_read(cpu, addr));
+    return &cpu->dec_uncached;
+  }
+  if (!*slot) *slot = (Dec_page*)calloc(1, sizeof(Dec_page));
+  Dec_page* page = *slot;
+  uint32_t  i    = (addr >> 2) & (DEC_PAGE_INSTS-1);
+  if (!page->valid[i]) {
+    page->dec[i]   = decode(g_mem_read(cpu, addr));
+    page->valid[i] = 1;
+  }
+  return &page->dec[i];
+}
+
+/*
+  Cycle-approximate timing layer. cpu_eval charges every instruction with the cycles vsoc spends on it
+  following the IFU/EXU/LSU handshakes of diagrams.txt: one EXU_EXECUTE cycle, the EXU_STALL_IDU
+  cycles of the fetch (ifu wait) and the EXU_STALL_LSU cycles of every bus access of a load or a
+  store (lsu wait). Fetches go through a model of the direct-mapped icache.sv with 2^index_bits lines
+  of 2^line_bits bytes: a hit costs ifu_hit, a miss the latency of the region the line comes from.
+  A misaligned word or a half crossing a word takes two bus accesses as in lsu.sv.
+  Only events are counted while running; the waits are the events times the latencies, so calibrate
+  refits the latencies without running the program again.
+*/
+enum GtimingRegion {
+  GtimingFlash,
+  GtimingSdram,
+  GtimingUart,
+  GtimingOther,
+  GtimingRegions,
+};
+
+static const char* gtiming_region_names[GtimingRegions] = { "flash", "sdram", "uart", "other" };
+
+struct GtimingParams {
+  uint32_t icache_line_bits;
+  uint32_t icache_index_bits;
+  double   ifu_hit;
+  double   ifu_miss[GtimingRegions];
+  double   lsu[GtimingRegions];
+};
+
+// NOTE: icache.sv geometry (m = 2, n = 8); the latencies are a rough starting point for calibrate
+static const GtimingParams GTIMING_DEFAULT = {
+  .icache_line_bits  = 2,
+  .icache_index_bits = 8,
+  .ifu_hit           = 1,
+  .ifu_miss          = { 100, 50, 10, 1 },
+  .lsu               = { 100, 45, 10, 1 },
+};
+
+struct Gtiming {
+  GtimingParams params;
+  // NOTE: line address + 1 of every icache line, 0 is an invalid line
+  uint32_t* icache_lines;
+  uint32_t  icache_mask;
+
+  uint64_t  mcycle;
+  uint64_t  minstret;
+  uint64_t  icache_hits;
+  uint64_t  icache_misses[GtimingRegions];
+  uint64_t  lsu_accesses[GtimingRegions];
+  uint64_t  load_seen;
+  uint64_t  store_seen;
+  uint64_t  system_seen;
+  uint64_t  calc_seen;
+  uint64_t  jump_seen;
+  uint64_t  branch_seen;
+  uint64_t  branch_taken;
+};
+
+Gtiming* g_timing_new(const GtimingParams& params) {
+  Gtiming* timing      = new Gtiming{};
+  timing->params       = params;
+  timing->icache_mask  = (1u << params.icache_index_bits) - 1;
+  timing->icache_lines = (uint32_t*)calloc(1u << params.icache_index_bits, sizeof(uint32_t));
+  return timing;
+}
+
+void g_timing_free(Gtiming* timing) {
+  free(timing->icache_lines);
+  delete timing;
+}
+
+// NOTE: clears the counters and invalidates the icache, like a vsoc reset
+void g_timing_reset(Gtiming* timing) {
+  memset(timing->icache_lines, 0, (timing->icache_mask + 1) * sizeof(uint32_t));
+  timing->mcycle       = 0;
+  timing->minstret     = 0;
+  timing->icache_hits  = 0;
+  memset(timing->icache_misses, 0, sizeof(timing->icache_misses));
+  memset(timing->lsu_accesses,  0, sizeof(timing->lsu_accesses));
+  timing->load_seen    = 0;
+  timing->store_seen   = 0;
+  timing->system_seen  = 0;
+  timing->calc_seen    = 0;
+  timing->jump_seen    = 0;
+  timing->branch_seen  = 0;
+  timing->branch_taken = 0;
+}
+
+static GtimingRegion g_timing_region(uint32_t addr) {
+  if (addr >= FLASH_START && addr < FLASH_END)  return GtimingFlash;
+  if (addr >= MEM_START   && addr < MEM_END)    return GtimingSdram;
+  if (addr >= UART_START  && addr <= UART_END)  return GtimingUart;
+  return GtimingOther;
+}
+
+static void g_timing_step(Gtiming* timing, uint32_t pc, const Dec_out& dec, uint32_t mem_addr, bool is_branch_taken) {
+  timing->minstret++;
+  uint32_t line  = pc >> timing->params.icache_line_bits;
+  uint32_t index = line & timing->icache_mask;
+  if (timing->icache_lines[index] == line + 1) {
+    timing->icache_hits++;
+  }
+  else {
+    timing->icache_lines[index] = line + 1;
+    timing->icache_misses[g_timing_region(pc)]++;
+  }
+
+  uint32_t size = 0;
+  switch (dec.inst_type) {
+    case INST_LOAD_BYTE: size = 1; timing->load_seen++;  break;
+    case INST_LOAD_HALF: size = 2; timing->load_seen++;  break;
+    case INST_LOAD_WORD: size = 4; timing->load_seen++;  break;
+    case INST_STORE:     size = dec.mem_wbmask == 0b1111 ? 4 : dec.mem_wbmask == 0b0011 ? 2 : 1; timing->store_seen++; break;
+    case INST_IMM:
+    case INST_REG:
+    case INST_UPP:
+    case INST_AUIPC:     timing->calc_seen++;   break;
+    case INST_JUMP:
+    case INST_JUMPR:     timing->jump_seen++;   break;
+    case INST_BRANCH: {
+      timing->branch_seen++;
+      timing->branch_taken += is_branch_taken;
+    } break;
+    default: {
+      timing->system_seen += dec.ebreak;
+    } break;
+  }
+  if (size) {
+    uint32_t offset = mem_addr & 0b11;
+    bool is_misalign = (size == 4 && offset != 0) || (size == 2 && offset == 0b11);
+    timing->lsu_accesses[g_timing_region(mem_addr)] += is_misalign ? 2 : 1;
+  }
+}
+
+double g_timing_ifu_wait(const Gtiming* timing, const GtimingParams& params) {
+  double result = params.ifu_hit * timing->icache_hits;
+  for (uint32_t r = 0; r < GtimingRegions; r++) {
+    result += params.ifu_miss[r] * timing->icache_misses[r];
+  }
+  return result;
+}
+
+double g_timing_lsu_wait(const Gtiming* timing, const GtimingParams& params) {
+  double result = 0;
+  for (uint32_t r = 0; r < GtimingRegions; r++) {
+    result += params.lsu[r] * timing->lsu_accesses[r];
+  }
+  return result;
+}
+
+// NOTE: the counters exu.sv and icache.sv report, mcycle is kept in timing->mcycle
+VEventCounts g_timing_event_counts(Gtiming* timing) {
+  uint64_t ifu_wait = (uint64_t)(g_timing_ifu_wait(timing, timing->params) + 0.5);
+  uint64_t lsu_wait = (uint64_t)(g_timing_lsu_wait(timing, timing->params) + 0.5);
+  timing->mcycle = timing->minstret + ifu_wait + lsu_wait;
+  return VEventCounts {
+    .mcycle        = timing->mcycle,
+    .ebreak        = 0,
+    .minstret      = timing->minstret,
+    .mifu_wait     = ifu_wait,
+    .mlsu_wait     = lsu_wait,
+    .mload_seen    = timing->load_seen,
+    .mstore_seen   = timing->store_seen,
+    .msystem_seen  = timing->system_seen,
+    .mcalc_seen    = timing->calc_seen,
+    .mjump_seen    = timing->jump_seen,
+    .mbranch_seen  = timing->branch_seen,
+    .mbranch_taken = timing->branch_taken,
+    .micache_hits  = timing->icache_hits,
+  };
+}
+
+// NOTE: one "<name> <value>" per line, the names are the GtimingParams fields with the region appended
+bool g_timing_params_write(const char* path, const GtimingParams& params) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    printf("[ERROR] could not open timing parameters %s\n", path);
+    return false;
+  }
+  fprintf(f, "icache_line_bits %u\n",  params.icache_line_bits);
+  fprintf(f, "icache_index_bits %u\n", params.icache_index_bits);
+  fprintf(f, "ifu_hit %.6f\n",         params.ifu_hit);
+  for (uint32_t r = 0; r < GtimingRegions; r++) {
+    fprintf(f, "ifu_miss_%s %.6f\n", gtiming_region_names[r], params.ifu_miss[r]);
+  }
+  for (uint32_t r = 0; r < GtimingRegions; r++) {
+    fprintf(f, "lsu_%s %.6f\n", gtiming_region_names[r], params.lsu[r]);
+  }
+  fclose(f);
+  return true;
+}
+
+bool g_timing_params_read(const char* path, GtimingParams* params) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    printf("[ERROR] could not open timing parameters %s\n", path);
+    return false;
+  }
+  bool result = true;
+  char   name[64];
+  double value;
+  while (result && fscanf(f, "%63s %lf", name, &value) == 2) {
+    bool is_known = false;
+    if (strcmp(name, "icache_line_bits") == 0)  { params->icache_line_bits  = (uint32_t)value; is_known = true; }
+    if (strcmp(name, "icache_index_bits") == 0) { params->icache_index_bits = (uint32_t)value; is_known = true; }
+    if (strcmp(name, "ifu_hit") == 0)           { params->ifu_hit           = value;           is_known = true; }
+    for (uint32_t r = 0; r < GtimingRegions; r++) {
+      char key[64];
+      snprintf(key, sizeof(key), "ifu_miss_%s", gtiming_region_names[r]);
+      if (strcmp(name, key) == 0) { params->ifu_miss[r] = value; is_known = true; }
+      snprintf(key, sizeof(key), "lsu_%s", gtiming_region_names[r]);
+      if (strcmp(name, key) == 0) { params->lsu[r] = value; is_known = true; }
+    }
+    if (!is_known) {
+      printf("[ERROR] unknown timing parameter '%s' in %s\n", name, path);
+      result = false;
+    }
+  }
+  if (result && !feof(f)) {
+    printf("[ERROR] could not parse timing parameters %s\n", path);
+    result = false;
+  }
+  if (result && (params->icache_index_bits > 24 || params->icache_line_bits + params->icache_index_bits > 32)) {
+    printf("[ERROR] invalid icache geometry in %s: 2^%u lines of 2^%u bytes\n", path, params->icache_index_bits, params->icache_line_bits);
+    result = false;
+  }
+  fclose(f);
+  return result;
+}
+
+/*
+  Workload profiler, driven by cpu_eval. It collects:
+  - the opcode/funct3 mix;
+  - register read-after-write distances in instructions;
+  - taken/not taken of every static branch;
+  - the address stride of every static load/store and the reuse distance of 64B lines, counted
+    in memory accesses since the previous access to the line;
+  - the call depth (jal/jalr linking ra or t0 call, jalr ra/t0 with rd = 0 returns);
+  - calls to the soft multiply/divide helpers of libgcc, found in an nm symbol list.
+  Static sites and lines live in fixed open addressing / direct mapped tables so the cost per
+  instruction stays a few table updates. Sites that do not fit are counted as dropped, a line
+  evicted by another one is seen as cold again.
+*/
+#define GPROF_RAW_MAX      (32)
+#define GPROF_LOG2_BUCKETS (33)
+#define GPROF_SITES_BITS   (16)
+#define GPROF_SITES        (1u << GPROF_SITES_BITS)
+#define GPROF_LINE_BITS    (6)
+#define GPROF_REUSE_BITS   (20)
+#define GPROF_DEPTH_MAX    (64)
+#define GPROF_HELPERS_MAX  (32)
+#define GPROF_NAME_MAX     (128)
+
+static const char* gprof_helper_prefixes[] = {
+  "__mul", "__div", "__udiv", "__mod", "__umod",
+};
+
+struct Gprof_branch {
+  uint32_t pc;
+  uint64_t taken;
+  uint64_t not_taken;
+};
+
+struct Gprof_mem_site {
+  uint32_t pc;
+  uint32_t last_addr;
+};
+
+struct Gprof_line {
+  uint32_t line;
+  uint64_t last_access;
+};
+
+struct Gprof_helper {
+  uint32_t addr;
+  char     name[GPROF_NAME_MAX];
+  uint64_t calls;
+};
+
+struct Gprofile {
+  uint64_t n_insts;
+  uint64_t op_counts[DEC_TABLE_SIZE];
+
+  uint64_t last_write[N_REGS];
+  uint64_t raw[GPROF_RAW_MAX + 1];
+
+  Gprof_branch*   branches;
+  uint64_t        branches_dropped;
+
+  Gprof_mem_site* mem_sites;
+  uint64_t        mem_sites_dropped;
+  // NOTE: 0 -- same address, 1 + log2(stride) for positive strides, 1 + GPROF_LOG2_BUCKETS + log2(-stride) for negative
+  uint64_t        strides[1 + 2*GPROF_LOG2_BUCKETS];
+  uint64_t        strides_first;
+
+  Gprof_line*     lines;
+  uint64_t        mem_accesses;
+  // NOTE: log2 of the accesses since the previous access to the line
+  uint64_t        reuse[GPROF_LOG2_BUCKETS + 32];
+  uint64_t        reuse_cold;
+
+  uint32_t        depth;
+  uint32_t        max_depth;
+  uint64_t        calls;
+  uint64_t        returns;
+  uint64_t        depth_at_call[GPROF_DEPTH_MAX + 1];
+
+  Gprof_helper    helpers[GPROF_HELPERS_MAX];
+  uint32_t        n_helpers;
+};
+
+Gprofile* g_profile_new() {
+  Gprofile* prof  = new Gprofile{};
+  prof->branches  = (Gprof_branch*)  calloc(GPROF_SITES, sizeof(Gprof_branch));
+  prof->mem_sites = (Gprof_mem_site*)calloc(GPROF_SITES, sizeof(Gprof_mem_site));
+  prof->lines     = (Gprof_line*)    calloc(1u << GPROF_REUSE_BITS, sizeof(Gprof_line));
+  return prof;
+}
+
+void g_profile_free(Gprofile* prof) {
+  free(prof->branches);
+  free(prof->mem_sites);
+  free(prof->lines);
+  delete prof;
+}
+
+// NOTE: reads `nm` output ("<addr> <type> <name>" per line) and keeps the multiply/divide helpers
+bool g_profile_symbols_read(Gprofile* prof, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    printf("[ERROR] could not open symbols %s\n", path);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned addr = 0;
+    char type = 0;
+    char name[GPROF_NAME_MAX];
+    if (sscanf(line, "%x %c %127s", &addr, &type, name) != 3) continue;
+    if (type != 'T' && type != 't') continue;
+    for (const char* prefix : gprof_helper_prefixes) {
+      if (strncmp(name, prefix, strlen(prefix)) != 0) continue;
+      if (prof->n_helpers == GPROF_HELPERS_MAX) {
+        printf("[WARNING] profile: too many helpers, ignoring %s\n", name);
+        break;
+      }
+      Gprof_helper* helper = &prof->helpers[prof->n_helpers++];
+      helper->addr = addr;
+      snprintf(helper->name, sizeof(helper->name), "%s", name);
+      break;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static uint32_t gprof_log2(uint64_t x) {
+  return 63 - __builtin_clzll(x);
+}
+
+static uint32_t gprof_slot(uint32_t pc) {
+  return ((pc >> 2) * 0x9e3779b1u) >> (32 - GPROF_SITES_BITS);
+}
+
+// NOTE: slot of pc in an open addressing table of GPROF_SITES entries with pc as the key, NULL if it is full
+template <typename Site>
+static Site* gprof_site(Site* sites, uint32_t pc) {
+  uint32_t slot = gprof_slot(pc);
+  for (uint32_t probe = 0; probe < 16; probe++) {
+    Site* site = &sites[(slot + probe) & (GPROF_SITES - 1)];
+    if (site->pc == pc) return site;
+    if (site->pc == 0) {
+      site->pc = pc;
+      return site;
+    }
+  }
+  return NULL;
+}
+
+static void g_profile_mem(Gprofile* prof, uint32_t pc, uint32_t addr) {
+  Gprof_mem_site* site = gprof_site(prof->mem_sites, pc);
+  if (!site) {
+    prof->mem_sites_dropped++;
+  }
+  else if (site->last_addr == 0) {
+    prof->strides_first++;
+    site->last_addr = addr;
+  }
+  else {
+    int32_t stride = (int32_t)(addr - site->last_addr);
+    if      (stride == 0) prof->strides[0]++;
+    else if (stride >  0) prof->strides[1 + gprof_log2(stride)]++;
+    else                  prof->strides[1 + GPROF_LOG2_BUCKETS + gprof_log2(-(int64_t)stride)]++;
+    site->last_addr = addr;
+  }
+
+  prof->mem_accesses++;
+  uint32_t    line  = addr >> GPROF_LINE_BITS;
+  Gprof_line* entry = &prof->lines[(line * 0x9e3779b1u) >> (32 - GPROF_REUSE_BITS)];
+  if (entry->last_access && entry->line == line) {
+    prof->reuse[gprof_log2(prof->mem_accesses - entry->last_access)]++;
+  }
+  else {
+    prof->reuse_cold++;
+  }
+  entry->line        = line;
+  entry->last_access = prof->mem_accesses;
+}
+
+static void g_profile_raw(Gprofile* prof, uint8_t reg) {
+  if (reg == 0 || reg >= N_REGS) return;
+  uint64_t distance = prof->n_insts - prof->last_write[reg];
+  prof->raw[distance < GPROF_RAW_MAX ? distance : GPROF_RAW_MAX]++;
+}
+
+static bool gprof_is_link(uint8_t reg) {
+  return reg == 1 || reg == 5;
+}
+
+static void g_profile_step(Gprofile* prof, uint32_t pc, const Dec_out& dec, uint32_t mem_addr, bool is_jump, uint32_t next_pc) {
+  prof->n_insts++;
+  prof->op_counts[dec.opcode_funct3]++;
+
+  bool is_rs1 = false, is_rs2 = false, is_rd = false;
+  switch (dec.inst_type) {
+    case INST_LOAD_BYTE:
+    case INST_LOAD_HALF:
+    case INST_LOAD_WORD: is_rs1 = true;                 is_rd = true; break;
+    case INST_STORE:     is_rs1 = true; is_rs2 = true;                break;
+    case INST_BRANCH:    is_rs1 = true; is_rs2 = true;                break;
+    case INST_REG:       is_rs1 = true; is_rs2 = true;  is_rd = true; break;
+    case INST_IMM:       is_rs1 = true;                 is_rd = true; break;
+    case INST_JUMPR:     is_rs1 = true;                 is_rd = true; break;
+    case INST_UPP:
+    case INST_AUIPC:
+    case INST_JUMP:                                     is_rd = true; break;
+  }
+  if (is_rs1) g_profile_raw(prof, dec.reg_src1);
+  if (is_rs2) g_profile_raw(prof, dec.reg_src2);
+  if (is_rd && dec.reg_dest < N_REGS) prof->last_write[dec.reg_dest] = prof->n_insts;
+
+  switch (dec.inst_type) {
+    case INST_BRANCH: {
+      Gprof_branch* site = gprof_site(prof->branches, pc);
+      if      (!site)   prof->branches_dropped++;
+      else if (is_jump) site->taken++;
+      else              site->not_taken++;
+    } break;
+    case INST_LOAD_BYTE:
+    case INST_LOAD_HALF:
+    case INST_LOAD_WORD:
+    case INST_STORE: {
+      g_profile_mem(prof, pc, mem_addr);
+    } break;
+    case INST_JUMP:
+    case INST_JUMPR: {
+      if (gprof_is_link(dec.reg_dest)) {
+        prof->calls++;
+        prof->depth_at_call[prof->depth < GPROF_DEPTH_MAX ? prof->depth : GPROF_DEPTH_MAX]++;
+        prof->depth++;
+        if (prof->depth > prof->max_depth) prof->max_depth = prof->depth;
+        for (uint32_t i = 0; i < prof->n_helpers; i++) {
+          prof->helpers[i].calls += prof->helpers[i].addr == next_pc;
+        }
+      }
+      else if (dec.inst_type == INST_JUMPR && dec.reg_dest == 0 && gprof_is_link(dec.reg_src1)) {
+        prof->returns++;
+        if (prof->depth) prof->depth--;
+      }
+    } break;
+  }
+}
+
+static const char* gprof_opcode_name(uint32_t opcode) {
+  switch (opcode) {
+    case OPCODE_LUI:      return "lui";
+    case OPCODE_AUIPC:    return "auipc";
+    case OPCODE_JAL:      return "jal";
+    case OPCODE_JALR:     return "jalr";
+    case OPCODE_BRANCH:   return "branch";
+    case OPCODE_LOAD:     return "load";
+    case OPCODE_STORE:    return "store";
+    case OPCODE_CALC_IMM: return "op-imm";
+    case OPCODE_CALC_REG: return "op";
+    case OPCODE_SYSTEM:   return "system";
+  }
+  return "unknown";
+}
+
+static void gprof_log2_label(char* label, size_t size, const char* sign, uint32_t bucket) {
+  if (bucket == 0) snprintf(label, size, "%s1", sign);
+  else             snprintf(label, size, "%s%" PRIu64 "..%s%" PRIu64, sign, (uint64_t)1 << bucket, sign, ((uint64_t)2 << bucket) - 1);
+}
+
+/*
+  CSV summary, one "section,key,count,extra" row per value:
+  summary, opcode (key opcode.funct3), raw (distance, the last one is GPROF_RAW_MAX and more),
+  branch (key pc, count taken, extra not taken), stride, reuse, call depth, helper (extra address).
+*/
+bool g_profile_write(Gprofile* prof, const char* path) {
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    printf("[ERROR] could not open profile %s\n", path);
+    return false;
+  }
+  char label[64];
+  fprintf(f, "section,key,count,extra\n");
+  fprintf(f, "summary,insts,%lu,\n",               prof->n_insts);
+  fprintf(f, "summary,mem accesses,%lu,\n",        prof->mem_accesses);
+  fprintf(f, "summary,calls,%lu,\n",               prof->calls);
+  fprintf(f, "summary,returns,%lu,\n",             prof->returns);
+  fprintf(f, "summary,max call depth,%u,\n",       prof->max_depth);
+  fprintf(f, "summary,branches dropped,%lu,\n",    prof->branches_dropped);
+  fprintf(f, "summary,mem sites dropped,%lu,\n",   prof->mem_sites_dropped);
+
+  for (uint32_t opcode = 0; opcode < 128; opcode++) {
+    // NOTE: lui, auipc and jal have immediate bits in place of funct3
+    bool is_funct3 = opcode != OPCODE_LUI && opcode != OPCODE_AUIPC && opcode != OPCODE_JAL;
+    uint64_t total = 0;
+    for (uint32_t funct3 = 0; funct3 < 8; funct3++) {
+      uint64_t count = prof->op_counts[opcode | funct3 << 7];
+      total += count;
+      if (is_funct3 && count) fprintf(f, "opcode,%s.%u,%lu,\n", gprof_opcode_name(opcode), funct3, count);
+    }
+    if (!is_funct3 && total) fprintf(f, "opcode,%s,%lu,\n", gprof_opcode_name(opcode), total);
+  }
+  for (uint32_t d = 1; d <= GPROF_RAW_MAX; d++) {
+    fprintf(f, "raw,%u%s,%lu,\n", d, d == GPROF_RAW_MAX ? "+" : "", prof->raw[d]);
+  }
+
+  std::vector<Gprof_branch> branches;
+  for (uint32_t i = 0; i < GPROF_SITES; i++) {
+    if (prof->branches[i].pc) branches.push_back(prof->branches[i]);
+  }
+  std::sort(branches.begin(), branches.end(), [](const Gprof_branch& a, const Gprof_branch& b) {
+    return a.taken + a.not_taken > b.taken + b.not_taken;
+  });
+  for (const Gprof_branch& branch : branches) {
+    fprintf(f, "branch,0x%08x,%lu,%lu\n", branch.pc, branch.taken, branch.not_taken);
+  }
+
+  fprintf(f, "stride,first,%lu,\n", prof->strides_first);
+  fprintf(f, "stride,0,%lu,\n",     prof->strides[0]);
+  for (uint32_t b = 0; b < GPROF_LOG2_BUCKETS; b++) {
+    if (prof->strides[1 + b]) {
+      gprof_log2_label(label, sizeof(label), "+", b);
+      fprintf(f, "stride,%s,%lu,\n", label, prof->strides[1 + b]);
+    }
+    if (prof->strides[1 + GPROF_LOG2_BUCKETS + b]) {
+      gprof_log2_label(label, sizeof(label), "-", b);
+      fprintf(f, "stride,%s,%lu,\n", label, prof->strides[1 + GPROF_LOG2_BUCKETS + b]);
+    }
+  }
+
+  fprintf(f, "reuse,cold,%lu,\n", prof->reuse_cold);
+  for (uint32_t b = 0; b < sizeof(prof->reuse) / sizeof(prof->reuse[0]); b++) {
+    if (!prof->reuse[b]) continue;
+    gprof_log2_label(label, sizeof(label), "", b);
+    fprintf(f, "reuse,%s,%lu,\n", label, prof->reuse[b]);
+  }
+
+  for (uint32_t d = 0; d <= GPROF_DEPTH_MAX; d++) {
+    if (!prof->depth_at_call[d]) continue;
+    fprintf(f, "call depth,%u%s,%lu,\n", d, d == GPROF_DEPTH_MAX ? "+" : "", prof->depth_at_call[d]);
+  }
+  for (uint32_t i = 0; i < prof->n_helpers; i++) {
+    fprintf(f, "helper,%s,%lu,0x%08x\n", prof->helpers[i].name, prof->helpers[i].calls, prof->helpers[i].addr);
+  }
+  fclose(f);
+  return true;
+}
+
 uint8_t cpu_eval(Gcpu* cpu) {
-  uint32_t inst = g_mem_read(cpu, cpu->pc & ~3);
-  Dec_out  dec  = decode(inst);
+  uint32_t inst_pc   = cpu->pc;
+  const Dec_out& dec = *g_fetch_decode(cpu, cpu->pc);
   if (dec.inst_type == 0) cpu->is_not_mapped = 1;
   RF_out   rf   = rf_read(cpu, dec.reg_src1, dec.reg_src2);
   bool is_mem_op =
@@ -467,5 +1336,815 @@ uint8_t cpu_eval(Gcpu* cpu) {
   g_mem_write(cpu, mem_wen, dec.mem_wbmask, alu_res, rf.rdata2);
   pc_write(cpu, alu_res, pc_jump);
   cpu->ebreak = dec.ebreak;
+  if (cpu->timing)  g_timing_step(cpu->timing, inst_pc, dec, alu_res, pc_jump && dec.inst_type == INST_BRANCH);
+  if (cpu->profile) g_profile_step(cpu->profile, inst_pc, dec, alu_res, pc_jump, cpu->pc);
   return dec.ebreak;
 }
+
+/*
+  Threaded superblock engine: straight-line code starting at a pc is translated into a block of
+  handler pointers, dispatched with computed goto. A block ends with a branch, a jump, an
+  instruction the handlers do not cover (executed with cpu_eval) or after SB_MAX_INSTS.
+  Blocks are chained through next[] on their exits. Any store to a predecoded word flushes all blocks.
+*/
+#define SB_MAX_INSTS   (64)
+#define SB_TABLE_BITS  (16)
+#define SB_ARENA_SIZE  (16 * 1024 * 1024)
+
+enum Sb_op {
+  SB_OP_LI, SB_OP_JAL, SB_OP_JALR,
+  SB_OP_BEQ, SB_OP_BNE, SB_OP_BLT, SB_OP_BGE, SB_OP_BLTU, SB_OP_BGEU, SB_OP_BNEVER,
+  SB_OP_ADD_I, SB_OP_SUB_I, SB_OP_SLL_I, SB_OP_SLT_I, SB_OP_SLTU_I, SB_OP_XOR_I, SB_OP_SRL_I, SB_OP_SRA_I, SB_OP_OR_I, SB_OP_AND_I,
+  SB_OP_ADD_R, SB_OP_SUB_R, SB_OP_SLL_R, SB_OP_SLT_R, SB_OP_SLTU_R, SB_OP_XOR_R, SB_OP_SRL_R, SB_OP_SRA_R, SB_OP_OR_R, SB_OP_AND_R,
+  SB_OP_LB, SB_OP_LBU, SB_OP_LH, SB_OP_LHU, SB_OP_LW,
+  SB_OP_STORE,
+  SB_OP_FALLBACK,
+  SB_OP_FALLTHROUGH,
+  SB_OP_COUNT,
+};
+
+struct Sb_inst {
+  const void* handler;
+  uint32_t    pc;
+  uint32_t    imm;
+  uint8_t     rd;
+  uint8_t     rs1;
+  uint8_t     rs2;
+  uint8_t     wbmask;
+};
+
+struct Sb_block {
+  uint32_t  pc;
+  uint32_t  n_insts;
+  Sb_block* next[2]; // 0 -- fall through / not taken, 1 -- taken / jump target
+  Sb_inst   insts[];
+};
+
+static uint8_t alu_op_sb_op(uint8_t alu_op, bool is_reg) {
+  uint8_t op = 0;
+  switch (alu_op) {
+    case ALU_OP_ADD:  op = SB_OP_ADD_I;  break;
+    case ALU_OP_SUB:  op = SB_OP_SUB_I;  break;
+    case ALU_OP_SLL:  op = SB_OP_SLL_I;  break;
+    case ALU_OP_SLT:  op = SB_OP_SLT_I;  break;
+    case ALU_OP_SLTU: op = SB_OP_SLTU_I; break;
+    case ALU_OP_XOR:  op = SB_OP_XOR_I;  break;
+    case ALU_OP_SRL:  op = SB_OP_SRL_I;  break;
+    case ALU_OP_SRA:  op = SB_OP_SRA_I;  break;
+    case ALU_OP_OR:   op = SB_OP_OR_I;   break;
+    case ALU_OP_AND:  op = SB_OP_AND_I;  break;
+    default:          return SB_OP_FALLBACK;
+  }
+  return is_reg ? op + (SB_OP_ADD_R - SB_OP_ADD_I) : op;
+}
+
+static bool sb_is_code_address(uint32_t pc) {
+  return (pc >= FLASH_START && pc < FLASH_END) || (pc >= MEM_START && pc < MEM_END);
+}
+
+void g_sb_flush(Gcpu* cpu) {
+  if (cpu->sb_table) memset(cpu->sb_table, 0, sizeof(Sb_block*) << SB_TABLE_BITS);
+  cpu->sb_arena_used = 0;
+  cpu->sb_dirty      = false;
+}
+
+Sb_block* g_sb_translate(Gcpu* cpu, uint32_t pc, const void* const* handlers) {
+  size_t size = sizeof(Sb_block) + (SB_MAX_INSTS + 1) * sizeof(Sb_inst);
+  if (cpu->sb_arena_used + size > SB_ARENA_SIZE) {
+    // NOTE: blocks may still be running, so the arena is flushed on the next block entry
+    cpu->sb_dirty = true;
+    return NULL;
+  }
+  Sb_block* block = (Sb_block*)(cpu->sb_arena + cpu->sb_arena_used);
+  block->pc      = pc;
+  block->next[0] = NULL;
+  block->next[1] = NULL;
+
+  uint32_t n = 0;
+  uint32_t inst_pc = pc;
+  while (1) {
+    Sb_inst* inst = &block->insts[n++];
+    inst->pc = inst_pc;
+    if (n > SB_MAX_INSTS || !sb_is_code_address(inst_pc)) {
+      inst->handler = handlers[SB_OP_FALLTHROUGH];
+      break;
+    }
+    const Dec_out& dec = *g_fetch_decode(cpu, inst_pc);
+    // NOTE: registers outside of RV32E read as zero, writes to them and to x0 go to the sink x[N_REGS]
+    inst->rd     = dec.reg_dest == 0 || dec.reg_dest >= N_REGS ? N_REGS : dec.reg_dest;
+    inst->rs1    = dec.reg_src1 >= N_REGS ? 0 : dec.reg_src1;
+    inst->rs2    = dec.reg_src2 >= N_REGS ? 0 : dec.reg_src2;
+    inst->imm    = dec.imm;
+    inst->wbmask = dec.mem_wbmask;
+    uint8_t op = SB_OP_FALLBACK;
+    switch (dec.inst_type) {
+      case INST_UPP:       op = SB_OP_LI;                        break;
+      case INST_AUIPC:     op = SB_OP_LI; inst->imm += inst_pc;  break;
+      case INST_IMM:       op = alu_op_sb_op(dec.alu_op, false); break;
+      case INST_REG:       op = alu_op_sb_op(dec.alu_op, true);  break;
+      case INST_JUMP:      op = SB_OP_JAL;                       break;
+      case INST_JUMPR:     op = SB_OP_JALR;                      break;
+      case INST_LOAD_BYTE: op = dec.is_mem_sign ? SB_OP_LB : SB_OP_LBU; break;
+      case INST_LOAD_HALF: op = dec.is_mem_sign ? SB_OP_LH : SB_OP_LHU; break;
+      case INST_LOAD_WORD: op = SB_OP_LW;                        break;
+      case INST_STORE: {
+        if (dec.mem_wbmask) op = SB_OP_STORE;
+      } break;
+      case INST_BRANCH: {
+        switch (dec.com_op) {
+          case COM_OP_EQ:  op = SB_OP_BEQ;  break;
+          case COM_OP_NE:  op = SB_OP_BNE;  break;
+          case COM_OP_LT:  op = SB_OP_BLT;  break;
+          case COM_OP_GE:  op = SB_OP_BGE;  break;
+          case COM_OP_LTU: op = SB_OP_BLTU; break;
+          case COM_OP_GEU: op = SB_OP_BGEU; break;
+          default:         op = SB_OP_BNEVER; break;
+        }
+      } break;
+    }
+    inst->handler = handlers[op];
+    if (op == SB_OP_JAL || op == SB_OP_JALR || op == SB_OP_FALLBACK || dec.inst_type == INST_BRANCH) {
+      break;
+    }
+    inst_pc += 4;
+  }
+  block->n_insts = n;
+  cpu->sb_arena_used += sizeof(Sb_block) + n * sizeof(Sb_inst);
+  cpu->sb_arena_used  = (cpu->sb_arena_used + 7) & ~(size_t)7;
+  return block;
+}
+
+Sb_block* g_sb_lookup(Gcpu* cpu, uint32_t pc, const void* const* handlers) {
+  if ((pc & 3) || !sb_is_code_address(pc)) return NULL;
+  Sb_block** slot = &cpu->sb_table[(pc >> 2) & ((1 << SB_TABLE_BITS) - 1)];
+  if (*slot && (*slot)->pc == pc) return *slot;
+  Sb_block* block = g_sb_translate(cpu, pc, handlers);
+  if (block) *slot = block;
+  return block;
+}
+
+uint64_t g_sb_exec(Gcpu* cpu, uint64_t max_insts) {
+  static const void* const handlers[SB_OP_COUNT] = {
+    &&sb_li, &&sb_jal, &&sb_jalr,
+    &&sb_beq, &&sb_bne, &&sb_blt, &&sb_bge, &&sb_bltu, &&sb_bgeu, &&sb_bnever,
+    &&sb_add_i, &&sb_sub_i, &&sb_sll_i, &&sb_slt_i, &&sb_sltu_i, &&sb_xor_i, &&sb_srl_i, &&sb_sra_i, &&sb_or_i, &&sb_and_i,
+    &&sb_add_r, &&sb_sub_r, &&sb_sll_r, &&sb_slt_r, &&sb_sltu_r, &&sb_xor_r, &&sb_srl_r, &&sb_sra_r, &&sb_or_r, &&sb_and_r,
+    &&sb_lb, &&sb_lbu, &&sb_lh, &&sb_lhu, &&sb_lw,
+    &&sb_store,
+    &&sb_fallback,
+    &&sb_fallthrough,
+  };
+  if (!cpu->sb_table) {
+    cpu->sb_table = (Sb_block**)calloc(1 << SB_TABLE_BITS, sizeof(Sb_block*));
+    cpu->sb_arena = (uint8_t*)malloc(SB_ARENA_SIZE);
+  }
+
+  // NOTE: x[N_REGS] is a sink for writes to x0 and to registers outside of RV32E
+  uint32_t x[N_REGS + 1];
+  memcpy(x, cpu->regs, sizeof(cpu->regs));
+  x[N_REGS] = 0;
+
+  uint64_t left    = max_insts;
+  uint32_t next_pc = cpu->pc;
+  Sb_block*      block = NULL;
+  const Sb_inst* ip    = NULL;
+  cpu->ebreak = 0;
+
+#define SB_NEXT(is_store) do {                                  \
+    if (--left == 0) {                                          \
+      cpu->pc = ip->pc + 4;                                     \
+      cpu->is_mem_write = (is_store);                           \
+      goto sb_exit;                                             \
+    }                                                           \
+    ip++;                                                       \
+    goto *ip->handler;                                          \
+  } while (0)
+
+#define SB_CHAIN(slot, target) do {                             \
+    next_pc = (target);                                         \
+    if (--left == 0) goto sb_exit_at_next_pc;                   \
+    Sb_block* next = block->next[slot];                         \
+    if (!next || next->pc != next_pc) {                         \
+      next = g_sb_lookup(cpu, next_pc, handlers);               \
+      if (!next) goto sb_interp;                                \
+      block->next[slot] = next;                                 \
+    }                                                           \
+    block = next;                                               \
+    ip    = block->insts;                                       \
+    goto *ip->handler;                                          \
+  } while (0)
+
+#define SB_ALU(name, expr_i, expr_r)                            \
+  sb_##name##_i: { uint32_t lhs = x[ip->rs1]; uint32_t rhs = ip->imm;      x[ip->rd] = (expr_i); SB_NEXT(0); } \
+  sb_##name##_r: { uint32_t lhs = x[ip->rs1]; uint32_t rhs = x[ip->rs2];   x[ip->rd] = (expr_r); SB_NEXT(0); }
+
+#define SB_BRANCH(name, cond)                                   \
+  sb_##name: {                                                  \
+    uint32_t lhs = x[ip->rs1]; uint32_t rhs = x[ip->rs2];       \
+    if (cond) SB_CHAIN(1, ip->pc + ip->imm);                    \
+    else      SB_CHAIN(0, ip->pc + 4);                          \
+  }
+
+#define SB_LOAD(name, expr)                                     \
+  sb_##name: {                                                  \
+    uint32_t d = g_mem_read(cpu, x[ip->rs1] + ip->imm);         \
+    x[ip->rd] = (expr);                                         \
+    if (cpu->is_not_mapped) {                                   \
+      left--;                                                   \
+      cpu->pc = ip->pc + 4;                                     \
+      cpu->is_mem_write = 0;                                    \
+      goto sb_exit;                                             \
+    }                                                           \
+    SB_NEXT(0);                                                 \
+  }
+
+sb_enter:
+  if (cpu->sb_dirty) g_sb_flush(cpu);
+  block = g_sb_lookup(cpu, next_pc, handlers);
+  if (!block) goto sb_interp;
+  ip = block->insts;
+  goto *ip->handler;
+
+  sb_li:   { x[ip->rd] = ip->imm; SB_NEXT(0); }
+  sb_jal:  { x[ip->rd] = ip->pc + 4; SB_CHAIN(1, ip->pc + ip->imm); }
+  sb_jalr: {
+    uint32_t target = x[ip->rs1] + ip->imm;
+    x[ip->rd] = ip->pc + 4;
+    SB_CHAIN(1, target);
+  }
+
+  SB_BRANCH(beq,  lhs == rhs)
+  SB_BRANCH(bne,  lhs != rhs)
+  SB_BRANCH(blt,  slt(lhs, rhs))
+  SB_BRANCH(bge,  !slt(lhs, rhs))
+  SB_BRANCH(bltu, lhs <  rhs)
+  SB_BRANCH(bgeu, lhs >= rhs)
+  sb_bnever: { SB_CHAIN(0, ip->pc + 4); }
+
+  SB_ALU(add,  lhs + rhs,                lhs + rhs)
+  SB_ALU(sub,  lhs - rhs,                lhs - rhs)
+  SB_ALU(sll,  lhs << (rhs & 31),        lhs << (rhs & 31))
+  SB_ALU(slt,  slt(lhs, rhs),            slt(lhs, rhs))
+  SB_ALU(sltu, lhs < rhs,                lhs < rhs)
+  SB_ALU(xor,  lhs ^ rhs,                lhs ^ rhs)
+  SB_ALU(srl,  lhs >> (rhs & 31),        lhs >> (rhs & 31))
+  SB_ALU(sra,  sra32(lhs, rhs & 31),     sra32(lhs, rhs & 31))
+  SB_ALU(or,   lhs | rhs,                lhs | rhs)
+  SB_ALU(and,  lhs & rhs,                lhs & rhs)
+
+  SB_LOAD(lb,  (uint32_t)(int32_t)(int8_t)d)
+  SB_LOAD(lbu, d & 0xff)
+  SB_LOAD(lh,  (uint32_t)(int32_t)(int16_t)d)
+  SB_LOAD(lhu, d & 0xffff)
+  SB_LOAD(lw,  d)
+
+  sb_store: {
+    uint32_t addr = x[ip->rs1] + ip->imm;
+    // NOTE: cpu_eval also reads the stored address, which flags unmapped reads (e.g. uart registers)
+    if (addr - MEM_START >= MEM_SIZE - 3) g_mem_read(cpu, addr);
+    g_mem_write(cpu, 1, ip->wbmask, addr, x[ip->rs2]);
+    if (cpu->is_not_mapped || cpu->sb_dirty) {
+      left--;
+      cpu->pc = ip->pc + 4;
+      if (cpu->is_not_mapped || left == 0) goto sb_exit;
+      next_pc = cpu->pc;
+      goto sb_enter;
+    }
+    SB_NEXT(1);
+  }
+
+  sb_fallback: {
+    next_pc = ip->pc;
+    goto sb_interp;
+  }
+
+  sb_fallthrough: {
+    next_pc = ip->pc;
+    Sb_block* next = block->next[0];
+    if (!next || next->pc != next_pc) {
+      next = g_sb_lookup(cpu, next_pc, handlers);
+      if (!next) goto sb_interp;
+      block->next[0] = next;
+    }
+    block = next;
+    ip    = block->insts;
+    goto *ip->handler;
+  }
+
+sb_interp:
+  memcpy(cpu->regs, x, sizeof(cpu->regs));
+  cpu->pc = next_pc;
+  cpu_eval(cpu);
+  memcpy(x, cpu->regs, sizeof(cpu->regs));
+  left--;
+  if (cpu->ebreak || cpu->is_not_mapped || left == 0) goto sb_exit;
+  next_pc = cpu->pc;
+  goto sb_enter;
+
+sb_exit_at_next_pc:
+  cpu->pc = next_pc;
+  cpu->is_mem_write = 0;
+sb_exit:
+  memcpy(cpu->regs, x, sizeof(cpu->regs));
+  return max_insts - left;
+
+#undef SB_NEXT
+#undef SB_CHAIN
+#undef SB_ALU
+#undef SB_BRANCH
+#undef SB_LOAD
+}
+
+#if defined(__x86_64__)
+/*
+  x86-64 translator: the same blocks as the threaded engine are compiled into host code in an mmap'd
+  code cache. Guest registers stay in cpu->regs. SDRAM/flash loads and SDRAM stores are done inline;
+  everything else (uart, unmapped, stores to pages with decoded code) leaves the block and is executed
+  with cpu_eval. Direct exits are patched to jump to the next block; jalr looks up jit_table inline.
+  Host registers: rbx -- Gcpu*, r12 -- cpu->mem.host, r13 -- cpu->flash.host, r14 -- instructions left, r15 -- jit_table.
+*/
+#define JIT_CODE_SIZE   (64 * 1024 * 1024)
+#define JIT_TABLE_BITS  (16)
+#define JIT_INST_MAX    (128)
+#define JIT_BLOCK_MAX   ((SB_MAX_INSTS + 1) * 3 * JIT_INST_MAX)
+
+#define JIT_EXIT_DISPATCH (0)
+#define JIT_EXIT_EVAL     (1)
+
+#define JIT_AX (0)
+#define JIT_CX (1)
+#define JIT_DX (2)
+
+struct Jit_entry {
+  uint32_t pc;
+  uint32_t n_insts;
+  uint8_t* code;
+};
+
+typedef uint64_t (*Jit_enter_fn)(Gcpu* cpu, uint8_t* code, uint64_t left, uint8_t* mem, uint8_t* flash, Jit_entry* table);
+
+// NOTE: out of line exit of a block: sets cpu->pc and returns exit (JIT_EXIT_*) or the fixup to patch when chain is set
+struct Jit_stub {
+  uint8_t* fixup;
+  uint32_t pc;
+  uint32_t left;   // instructions of the block that are not executed when the stub is taken
+  uint32_t exit;
+  bool     chain;
+};
+
+static void jit_b(uint8_t** p, uint8_t b) {
+  *(*p)++ = b;
+}
+
+static void jit_d(uint8_t** p, uint32_t d) {
+  memcpy(*p, &d, sizeof(d));
+  *p += sizeof(d);
+}
+
+static void jit_q(uint8_t** p, uint64_t q) {
+  memcpy(*p, &q, sizeof(q));
+  *p += sizeof(q);
+}
+
+static void jit_patch(uint8_t* fixup, uint8_t* target) {
+  uint32_t rel = (uint32_t)(target - (fixup + 4));
+  memcpy(fixup, &rel, sizeof(rel));
+}
+
+// NOTE: emits a rel32 placeholder and returns its address for jit_patch
+static uint8_t* jit_fixup(uint8_t** p) {
+  uint8_t* fixup = *p;
+  jit_d(p, 0);
+  return fixup;
+}
+
+static uint32_t jit_reg_offset(uint8_t x) {
+  return offsetof(Gcpu, regs) + 4 * x;
+}
+
+static void jit_reg_load(uint8_t** p, uint8_t r, uint8_t x) {
+  if (x == 0 || x >= N_REGS) {
+    jit_b(p, 0x31); jit_b(p, 0xc0 | r << 3 | r);                  // xor r, r
+  }
+  else {
+    jit_b(p, 0x8b); jit_b(p, 0x83 | r << 3); jit_d(p, jit_reg_offset(x)); // mov r, [rbx + x]
+  }
+}
+
+static void jit_reg_store(uint8_t** p, uint8_t r, uint8_t x) {
+  if (x == 0 || x >= N_REGS) return;
+  jit_b(p, 0x89); jit_b(p, 0x83 | r << 3); jit_d(p, jit_reg_offset(x));   // mov [rbx + x], r
+}
+
+static void jit_cpu_store_imm32(uint8_t** p, uint32_t offset, uint32_t imm) {
+  jit_b(p, 0xc7); jit_b(p, 0x83); jit_d(p, offset); jit_d(p, imm);      // mov dword [rbx + offset], imm
+}
+
+static void jit_cpu_store_imm8(uint8_t** p, uint32_t offset, uint8_t imm) {
+  jit_b(p, 0xc6); jit_b(p, 0x83); jit_d(p, offset); jit_b(p, imm);      // mov byte [rbx + offset], imm
+}
+
+static void jit_setcc(uint8_t** p, uint8_t cc) {
+  jit_b(p, 0x0f); jit_b(p, 0x90 | cc); jit_b(p, 0xc0);                 // setcc al
+  jit_b(p, 0x0f); jit_b(p, 0xb6); jit_b(p, 0xc0);                      // movzx eax, al
+}
+
+// NOTE: eax = eax op (is_reg ? ecx : imm)
+static bool jit_alu(uint8_t** p, uint8_t alu_op, bool is_reg, uint32_t imm) {
+  uint8_t op_reg = 0; uint8_t ext = 0; uint8_t shift = 0; uint8_t cc = 0;
+  switch (alu_op) {
+    case ALU_OP_ADD:  op_reg = 0x01; ext = 0; break;
+    case ALU_OP_SUB:  op_reg = 0x29; ext = 5; break;
+    case ALU_OP_XOR:  op_reg = 0x31; ext = 6; break;
+    case ALU_OP_OR:   op_reg = 0x09; ext = 1; break;
+    case ALU_OP_AND:  op_reg = 0x21; ext = 4; break;
+    case ALU_OP_SLL:  shift = 4; break;
+    case ALU_OP_SRL:  shift = 5; break;
+    case ALU_OP_SRA:  shift = 7; break;
+    case ALU_OP_SLT:  cc = 0xc; break;
+    case ALU_OP_SLTU: cc = 0x2; break;
+    default:          return false;
+  }
+  if (shift) {
+    if (is_reg) { jit_b(p, 0xd3); jit_b(p, 0xc0 | shift << 3); }                      // shift eax, cl
+    else        { jit_b(p, 0xc1); jit_b(p, 0xc0 | shift << 3); jit_b(p, imm & 31); }  // shift eax, imm8
+  }
+  else if (cc) {
+    if (is_reg) { jit_b(p, 0x39); jit_b(p, 0xc8); }                                   // cmp eax, ecx
+    else        { jit_b(p, 0x81); jit_b(p, 0xf8); jit_d(p, imm); }                    // cmp eax, imm32
+    jit_setcc(p, cc);
+  }
+  else {
+    if (is_reg) { jit_b(p, op_reg); jit_b(p, 0xc8); }                                 // op eax, ecx
+    else        { jit_b(p, 0x81); jit_b(p, 0xc0 | ext << 3); jit_d(p, imm); }         // op eax, imm32
+  }
+  return true;
+}
+
+// NOTE: eax = x[rs1] + imm, ecx = eax - start, jumps to the returned fixup if ecx is out of [0, size-3)
+static uint8_t* jit_address(uint8_t** p, uint32_t start, uint32_t size) {
+  jit_b(p, 0x8d); jit_b(p, 0x88); jit_d(p, 0u - start);                // lea ecx, [rax - start]
+  jit_b(p, 0x81); jit_b(p, 0xf9); jit_d(p, size - 3);                  // cmp ecx, size-3
+  jit_b(p, 0x0f); jit_b(p, 0x83);                                      // jae
+  return jit_fixup(p);
+}
+
+// NOTE: edx = load [base + rcx], base is r12 (mem) or r13 (flash)
+static void jit_load(uint8_t** p, uint8_t inst_type, bool is_sign, bool is_flash) {
+  jit_b(p, 0x41);
+  switch (inst_type) {
+    case INST_LOAD_BYTE: jit_b(p, 0x0f); jit_b(p, is_sign ? 0xbe : 0xb6); break;
+    case INST_LOAD_HALF: jit_b(p, 0x0f); jit_b(p, is_sign ? 0xbf : 0xb7); break;
+    default:             jit_b(p, 0x8b); break;
+  }
+  // NOTE: r13 as a base needs a displacement
+  if (is_flash) { jit_b(p, 0x54); jit_b(p, 0x0d); jit_b(p, 0x00); }
+  else          { jit_b(p, 0x14); jit_b(p, 0x0c); }
+}
+
+static void jit_store(uint8_t** p, uint8_t wbmask) {
+  if (wbmask == 0b0011) jit_b(p, 0x66);
+  jit_b(p, 0x41);
+  jit_b(p, wbmask == 0b0001 ? 0x88 : 0x89);
+  jit_b(p, 0x14); jit_b(p, 0x0c);                                      // mov [r12 + rcx], dl/dx/edx
+}
+
+// NOTE: jumps to the returned fixup if the mem page of edx has decoded instructions
+static uint8_t* jit_code_page_check(uint8_t** p) {
+  jit_b(p, 0xc1); jit_b(p, 0xea); jit_b(p, DEC_PAGE_BITS);              // shr edx, DEC_PAGE_BITS
+  jit_b(p, 0x48); jit_b(p, 0x83); jit_b(p, 0xbc); jit_b(p, 0xd3);       // cmp qword [rbx + rdx*8 + dec_mem], 0
+  jit_d(p, offsetof(Gcpu, dec_mem)); jit_b(p, 0x00);
+  jit_b(p, 0x0f); jit_b(p, 0x85);                                      // jne
+  return jit_fixup(p);
+}
+
+// NOTE: after jit_code_page_check, jumps to the returned fixup if the page in edx is not dirty yet;
+// the first store to a page goes through cpu_eval, which marks it
+static uint8_t* jit_dirty_page_check(uint8_t** p) {
+  jit_b(p, 0x48); jit_b(p, 0x8b); jit_b(p, 0xb3);                      // mov rsi, [rbx + mem.dirty]
+  jit_d(p, offsetof(Gcpu, mem.dirty));
+  jit_b(p, 0x80); jit_b(p, 0x3c); jit_b(p, 0x16); jit_b(p, 0x00);       // cmp byte [rsi + rdx], 0
+  jit_b(p, 0x0f); jit_b(p, 0x84);                                      // je
+  return jit_fixup(p);
+}
+
+static void jit_jmp(uint8_t** p, uint8_t* target) {
+  jit_b(p, 0xe9);
+  jit_patch(jit_fixup(p), target);
+}
+
+static bool jit_is_supported(const Dec_out& dec) {
+  switch (dec.inst_type) {
+    case INST_UPP: case INST_AUIPC: case INST_JUMP: case INST_JUMPR: case INST_BRANCH:
+    case INST_LOAD_BYTE: case INST_LOAD_HALF: case INST_LOAD_WORD:
+      return true;
+    case INST_IMM: case INST_REG:
+      return dec.alu_op == ALU_OP_ADD || dec.alu_op == ALU_OP_SUB || dec.alu_op == ALU_OP_SLL ||
+             dec.alu_op == ALU_OP_SLT || dec.alu_op == ALU_OP_SLTU || dec.alu_op == ALU_OP_XOR ||
+             dec.alu_op == ALU_OP_SRL || dec.alu_op == ALU_OP_SRA || dec.alu_op == ALU_OP_OR ||
+             dec.alu_op == ALU_OP_AND;
+    case INST_STORE:
+      return dec.mem_wbmask == 0b0001 || dec.mem_wbmask == 0b0011 || dec.mem_wbmask == 0b1111;
+  }
+  return false;
+}
+
+bool g_jit_init(Gcpu* cpu) {
+  if (cpu->jit_code) return true;
+  if (cpu->jit_failed) return false;
+  void* code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    cpu->jit_failed = true;
+    if (cpu->verbose >= VerboseWarning) {
+      printf("[WARNING]: gcpu jit code cache is not available, using the threaded engine\n");
+    }
+    return false;
+  }
+  cpu->jit_code  = (uint8_t*)code;
+  cpu->jit_table = (Jit_entry*)calloc(1 << JIT_TABLE_BITS, sizeof(Jit_entry));
+
+  uint8_t* p = cpu->jit_code;
+  cpu->jit_enter = p;
+  jit_b(&p, 0x53); jit_b(&p, 0x55);                                    // push rbx; push rbp
+  jit_b(&p, 0x41); jit_b(&p, 0x54); jit_b(&p, 0x41); jit_b(&p, 0x55);  // push r12; push r13
+  jit_b(&p, 0x41); jit_b(&p, 0x56); jit_b(&p, 0x41); jit_b(&p, 0x57);  // push r14; push r15
+  jit_b(&p, 0x48); jit_b(&p, 0x89); jit_b(&p, 0xfb);                   // mov rbx, rdi
+  jit_b(&p, 0x49); jit_b(&p, 0x89); jit_b(&p, 0xd6);                   // mov r14, rdx
+  jit_b(&p, 0x49); jit_b(&p, 0x89); jit_b(&p, 0xcc);                   // mov r12, rcx
+  jit_b(&p, 0x4d); jit_b(&p, 0x89); jit_b(&p, 0xc5);                   // mov r13, r8
+  jit_b(&p, 0x4d); jit_b(&p, 0x89); jit_b(&p, 0xcf);                   // mov r15, r9
+  jit_b(&p, 0xff); jit_b(&p, 0xe6);                                    // jmp rsi
+
+  cpu->jit_epilogue = p;
+  jit_b(&p, 0x4c); jit_b(&p, 0x89); jit_b(&p, 0xb3);                   // mov [rbx + jit_left], r14
+  jit_d(&p, offsetof(Gcpu, jit_left));
+  jit_b(&p, 0x41); jit_b(&p, 0x5f); jit_b(&p, 0x41); jit_b(&p, 0x5e);  // pop r15; pop r14
+  jit_b(&p, 0x41); jit_b(&p, 0x5d); jit_b(&p, 0x41); jit_b(&p, 0x5c);  // pop r13; pop r12
+  jit_b(&p, 0x5d); jit_b(&p, 0x5b);                                    // pop rbp; pop rbx
+  jit_b(&p, 0xc3);                                                     // ret
+
+  // NOTE: empty jit_table entries point here, so a false hit from translated code just goes back to g_jit_exec
+  cpu->jit_exit = p;
+  jit_b(&p, 0x31); jit_b(&p, 0xc0);                                    // xor eax, eax
+  jit_jmp(&p, cpu->jit_epilogue);
+
+  cpu->jit_code_start = (p - cpu->jit_code + 15) & ~(size_t)15;
+  cpu->jit_code_used  = cpu->jit_code_start;
+  for (uint32_t i = 0; i < (1 << JIT_TABLE_BITS); i++) {
+    cpu->jit_table[i].code = cpu->jit_exit;
+  }
+  return true;
+}
+
+void g_jit_flush(Gcpu* cpu) {
+  for (uint32_t i = 0; i < (1 << JIT_TABLE_BITS); i++) {
+    cpu->jit_table[i] = Jit_entry{.pc = 0, .n_insts = 0, .code = cpu->jit_exit};
+  }
+  cpu->jit_code_used = cpu->jit_code_start;
+  cpu->jit_generation++;
+  cpu->jit_dirty = false;
+}
+
+Jit_entry* g_jit_translate(Gcpu* cpu, uint32_t pc) {
+  const Dec_out* decs[SB_MAX_INSTS];
+  uint32_t n = 0;
+  bool is_fallback = false;
+  for (uint32_t inst_pc = pc; n < SB_MAX_INSTS && sb_is_code_address(inst_pc); inst_pc += 4) {
+    const Dec_out* dec = g_fetch_decode(cpu, inst_pc);
+    if (!jit_is_supported(*dec)) {
+      is_fallback = true;
+      break;
+    }
+    decs[n++] = dec;
+    if (dec->inst_type == INST_JUMP || dec->inst_type == INST_JUMPR || dec->inst_type == INST_BRANCH) break;
+  }
+  if (n == 0) return NULL;
+
+  if (cpu->jit_code_used + JIT_BLOCK_MAX > JIT_CODE_SIZE) g_jit_flush(cpu);
+  uint8_t* block = cpu->jit_code + cpu->jit_code_used;
+  uint8_t* p     = block;
+  Jit_stub stubs[SB_MAX_INSTS * 5 + 2];
+  uint32_t n_stubs = 0;
+
+  jit_b(&p, 0x49); jit_b(&p, 0x81); jit_b(&p, 0xfe); jit_d(&p, n);      // cmp r14, n
+  jit_b(&p, 0x0f); jit_b(&p, 0x82);                                    // jb
+  stubs[n_stubs++] = Jit_stub{.fixup = jit_fixup(&p), .pc = pc, .left = 0, .exit = JIT_EXIT_DISPATCH, .chain = false};
+  jit_b(&p, 0x49); jit_b(&p, 0x81); jit_b(&p, 0xee); jit_d(&p, n);      // sub r14, n
+
+  // NOTE: is_mem_write is only written when it changes, the block can be entered after a store
+  bool is_mem_write_clear = false;
+  uint32_t inst_pc = pc;
+  for (uint32_t i = 0; i < n; i++, inst_pc += 4) {
+    const Dec_out& dec = *decs[i];
+    Jit_stub side_exit = {.fixup = NULL, .pc = inst_pc, .left = n - i, .exit = JIT_EXIT_EVAL, .chain = false};
+    if (dec.inst_type != INST_STORE && !is_mem_write_clear) {
+      jit_cpu_store_imm8(&p, offsetof(Gcpu, is_mem_write), 0);
+      is_mem_write_clear = true;
+    }
+    switch (dec.inst_type) {
+      case INST_UPP:
+      case INST_AUIPC: {
+        uint32_t imm = dec.inst_type == INST_AUIPC ? dec.imm + inst_pc : dec.imm;
+        if (dec.reg_dest != 0 && dec.reg_dest < N_REGS) jit_cpu_store_imm32(&p, jit_reg_offset(dec.reg_dest), imm);
+      } break;
+      case INST_IMM:
+      case INST_REG: {
+        if (dec.reg_dest == 0 || dec.reg_dest >= N_REGS) break;
+        jit_reg_load(&p, JIT_AX, dec.reg_src1);
+        if (dec.inst_type == INST_REG) jit_reg_load(&p, JIT_CX, dec.reg_src2);
+        jit_alu(&p, dec.alu_op, dec.inst_type == INST_REG, dec.imm);
+        jit_reg_store(&p, JIT_AX, dec.reg_dest);
+      } break;
+      case INST_LOAD_BYTE:
+      case INST_LOAD_HALF:
+      case INST_LOAD_WORD: {
+        jit_reg_load(&p, JIT_AX, dec.reg_src1);
+        jit_b(&p, 0x05); jit_d(&p, dec.imm);                            // add eax, imm
+        uint8_t* not_mem = jit_address(&p, MEM_START, MEM_SIZE);
+        jit_load(&p, dec.inst_type, dec.is_mem_sign, false);
+        jit_b(&p, 0xe9);                                               // jmp done
+        uint8_t* done = jit_fixup(&p);
+        jit_patch(not_mem, p);
+        side_exit.fixup = jit_address(&p, FLASH_START, FLASH_SIZE);
+        stubs[n_stubs++] = side_exit;
+        jit_load(&p, dec.inst_type, dec.is_mem_sign, true);
+        jit_patch(done, p);
+        jit_reg_store(&p, JIT_DX, dec.reg_dest);
+      } break;
+      case INST_STORE: {
+        jit_reg_load(&p, JIT_AX, dec.reg_src1);
+        jit_b(&p, 0x05); jit_d(&p, dec.imm);                            // add eax, imm
+        side_exit.fixup = jit_address(&p, MEM_START, MEM_SIZE);
+        stubs[n_stubs++] = side_exit;
+        // NOTE: stores to pages with decoded instructions go through cpu_eval to invalidate them
+        jit_b(&p, 0x89); jit_b(&p, 0xca);                              // mov edx, ecx
+        side_exit.fixup = jit_code_page_check(&p);
+        stubs[n_stubs++] = side_exit;
+        side_exit.fixup = jit_dirty_page_check(&p);
+        stubs[n_stubs++] = side_exit;
+        if (dec.mem_wbmask != 0b0001) {
+          jit_b(&p, 0x8d); jit_b(&p, 0x51);                            // lea edx, [rcx + size-1]
+          jit_b(&p, dec.mem_wbmask == 0b0011 ? 1 : 3);
+          side_exit.fixup = jit_code_page_check(&p);
+          stubs[n_stubs++] = side_exit;
+          side_exit.fixup = jit_dirty_page_check(&p);
+          stubs[n_stubs++] = side_exit;
+        }
+        jit_reg_load(&p, JIT_DX, dec.reg_src2);
+        jit_store(&p, dec.mem_wbmask);
+        jit_b(&p, 0x89); jit_b(&p, 0x83); jit_d(&p, offsetof(Gcpu, written_address)); // mov [rbx + written_address], eax
+        jit_cpu_store_imm8(&p, offsetof(Gcpu, is_mem_write), 1);
+        is_mem_write_clear = false;
+      } break;
+      case INST_BRANCH: {
+        uint8_t cc = 0;
+        switch (dec.com_op) {
+          case COM_OP_EQ:  cc = 0x4; break;
+          case COM_OP_NE:  cc = 0x5; break;
+          case COM_OP_LT:  cc = 0xc; break;
+          case COM_OP_GE:  cc = 0xd; break;
+          case COM_OP_LTU: cc = 0x2; break;
+          case COM_OP_GEU: cc = 0x3; break;
+        }
+        if (cc) {
+          jit_reg_load(&p, JIT_AX, dec.reg_src1);
+          jit_reg_load(&p, JIT_CX, dec.reg_src2);
+          jit_b(&p, 0x39); jit_b(&p, 0xc8);                            // cmp eax, ecx
+          jit_b(&p, 0x0f); jit_b(&p, 0x80 | cc);                       // jcc taken
+          stubs[n_stubs++] = Jit_stub{.fixup = jit_fixup(&p), .pc = inst_pc + dec.imm, .left = 0, .exit = 0, .chain = true};
+        }
+        jit_b(&p, 0xe9);                                               // jmp not taken
+        stubs[n_stubs++] = Jit_stub{.fixup = jit_fixup(&p), .pc = inst_pc + 4, .left = 0, .exit = 0, .chain = true};
+      } break;
+      case INST_JUMP: {
+        if (dec.reg_dest != 0 && dec.reg_dest < N_REGS) jit_cpu_store_imm32(&p, jit_reg_offset(dec.reg_dest), inst_pc + 4);
+        jit_b(&p, 0xe9);
+        stubs[n_stubs++] = Jit_stub{.fixup = jit_fixup(&p), .pc = inst_pc + dec.imm, .left = 0, .exit = 0, .chain = true};
+      } break;
+      case INST_JUMPR: {
+        jit_reg_load(&p, JIT_AX, dec.reg_src1);
+        jit_b(&p, 0x05); jit_d(&p, dec.imm);                            // add eax, imm
+        if (dec.reg_dest != 0 && dec.reg_dest < N_REGS) jit_cpu_store_imm32(&p, jit_reg_offset(dec.reg_dest), inst_pc + 4);
+        jit_b(&p, 0x89); jit_b(&p, 0x83); jit_d(&p, offsetof(Gcpu, pc)); // mov [rbx + pc], eax
+        jit_b(&p, 0x89); jit_b(&p, 0xc2);                              // mov edx, eax
+        jit_b(&p, 0xc1); jit_b(&p, 0xea); jit_b(&p, 2);                // shr edx, 2
+        jit_b(&p, 0x81); jit_b(&p, 0xe2); jit_d(&p, (1 << JIT_TABLE_BITS) - 1); // and edx, mask
+        jit_b(&p, 0x48); jit_b(&p, 0xc1); jit_b(&p, 0xe2); jit_b(&p, 4);  // shl rdx, 4
+        jit_b(&p, 0x41); jit_b(&p, 0x39); jit_b(&p, 0x04); jit_b(&p, 0x17); // cmp [r15 + rdx], eax
+        jit_b(&p, 0x0f); jit_b(&p, 0x85);                              // jne jit_exit
+        jit_patch(jit_fixup(&p), cpu->jit_exit);
+        jit_b(&p, 0x41); jit_b(&p, 0xff); jit_b(&p, 0x64); jit_b(&p, 0x17); jit_b(&p, 8); // jmp [r15 + rdx + 8]
+      } break;
+    }
+  }
+  uint32_t last = decs[n - 1]->inst_type;
+  if (last != INST_JUMP && last != INST_JUMPR && last != INST_BRANCH) {
+    // NOTE: the block was cut by an unsupported instruction (left to g_jit_exec, the budget can be used up here),
+    // the region end or SB_MAX_INSTS
+    jit_b(&p, 0xe9);
+    stubs[n_stubs++] = Jit_stub{.fixup = jit_fixup(&p), .pc = inst_pc, .left = 0, .exit = JIT_EXIT_DISPATCH, .chain = !is_fallback};
+  }
+
+  for (uint32_t i = 0; i < n_stubs; i++) {
+    Jit_stub* stub = &stubs[i];
+    jit_patch(stub->fixup, p);
+    if (stub->left) {
+      jit_b(&p, 0x49); jit_b(&p, 0x81); jit_b(&p, 0xc6); jit_d(&p, stub->left); // add r14, left
+    }
+    jit_cpu_store_imm32(&p, offsetof(Gcpu, pc), stub->pc);
+    if (stub->chain) {
+      jit_b(&p, 0x48); jit_b(&p, 0xb8); jit_q(&p, (uint64_t)stub->fixup);   // mov rax, fixup
+    }
+    else {
+      jit_b(&p, 0xb8); jit_d(&p, stub->exit);                          // mov eax, exit
+    }
+    jit_jmp(&p, cpu->jit_epilogue);
+  }
+  assert(p - block <= JIT_BLOCK_MAX);
+  cpu->jit_code_used = (p - cpu->jit_code + 15) & ~(size_t)15;
+
+  Jit_entry* entry = &cpu->jit_table[(pc >> 2) & ((1 << JIT_TABLE_BITS) - 1)];
+  *entry = Jit_entry{.pc = pc, .n_insts = n, .code = block};
+  return entry;
+}
+
+Jit_entry* g_jit_lookup(Gcpu* cpu, uint32_t pc) {
+  if ((pc & 3) || !sb_is_code_address(pc)) return NULL;
+  Jit_entry* entry = &cpu->jit_table[(pc >> 2) & ((1 << JIT_TABLE_BITS) - 1)];
+  if (entry->pc == pc && entry->code != cpu->jit_exit) return entry;
+  return g_jit_translate(cpu, pc);
+}
+
+uint64_t g_jit_exec(Gcpu* cpu, uint64_t max_insts) {
+  if (!g_jit_init(cpu)) return g_sb_exec(cpu, max_insts);
+  Jit_enter_fn enter = (Jit_enter_fn)cpu->jit_enter;
+  uint64_t left       = max_insts;
+  uint8_t* patch      = NULL;
+  uint64_t patch_gen  = 0;
+  cpu->ebreak = 0;
+  while (left) {
+    if (cpu->jit_dirty) g_jit_flush(cpu);
+    Jit_entry* entry = g_jit_lookup(cpu, cpu->pc);
+    if (!entry || left < entry->n_insts) {
+      cpu_eval(cpu);
+      left--;
+      patch = NULL;
+      if (cpu->ebreak || cpu->is_not_mapped) break;
+      continue;
+    }
+    if (patch && patch_gen == cpu->jit_generation) jit_patch(patch, entry->code);
+    uint64_t exit = enter(cpu, entry->code, left, cpu->mem.host, cpu->flash.host, cpu->jit_table);
+    left  = cpu->jit_left;
+    patch = NULL;
+    if (exit == JIT_EXIT_EVAL) {
+      cpu_eval(cpu);
+      left--;
+      if (cpu->ebreak || cpu->is_not_mapped) break;
+    }
+    else if (exit != JIT_EXIT_DISPATCH) {
+      patch     = (uint8_t*)exit;
+      patch_gen = cpu->jit_generation;
+    }
+  }
+  return max_insts - left;
+}
+#else
+uint64_t g_jit_exec(Gcpu* cpu, uint64_t max_insts) {
+  return g_sb_exec(cpu, max_insts);
+}
+#endif
+
+// NOTE: runs up to max_insts instructions with the selected engine, stops early on ebreak or unmapped access
+uint64_t g_exec(Gcpu* cpu, uint64_t max_insts) {
+  uint64_t n = 0;
+  // NOTE: the threaded and jit engines skip the INFO5 memory prints and cannot tell a new unmapped access from an old one.
+  //       The timing layer and the profiler are driven by cpu_eval only.
+  if (cpu->engine != GcpuEngineInterp && !cpu->is_not_mapped && cpu->verbose < VerboseInfo5 && !cpu->timing && !cpu->profile) {
+    // NOTE: jit stores to dirty pages skip g_mem_write, which marks mem_dirty
+    if (cpu->engine == GcpuEngineJit && !cpu->mem_dirty) n = g_jit_exec(cpu, max_insts);
+    else                              n = g_sb_exec(cpu, max_insts);
+  }
+  else while (n < max_insts) {
+    cpu_eval(cpu);
+    n++;
+    if (cpu->ebreak || cpu->is_not_mapped) break;
+  }
+  cpu->instret += n;
+  return n;
+}
+
+enum GcpuStop {
+  GcpuStopEbreak,
+  GcpuStopNotMapped,
+  GcpuStopBudget,
+};
+
+GcpuStop g_run(Gcpu* cpu, uint64_t max_insts) {
+  uint64_t left = max_insts;
+  while (left) {
+    left -= g_exec(cpu, left);
+    if (cpu->ebreak)        return GcpuStopEbreak;
+    if (cpu->is_not_mapped) return GcpuStopNotMapped;
+  }
+  return GcpuStopBudget;
+}
@@ -0,0 +1,204 @@
+/*
+  Structure-of-arrays golden model for random campaigns: up to GLANES_MAX independent programs step in
+  lockstep, one lane per program. Decode, register file reads and writes, ALU, compare and the next pc
+  are computed for all lanes at once with GCC vector extensions; glanes_step is built for AVX-512 and
+  for the baseline target and the host picks one at run time. Instruction fetch is a gather from the
+  flat code buffer and memory accesses are done per lane. A lane that stops is masked out of the
+  following steps and instret shows how many instructions each lane executed.
+
+  Every lane behaves like cpu_eval on a freshly created Gcpu (flash holds only the program, SDRAM is
+  zero, the uart is the gold's own one) stepped by the gold only loop of test_instructions. The only
+  difference is that uart THR writes are not printed.
+
+  With 16 lanes on AVX-512 the step runs at about 60-70 MIPS against 22-26 for the scalar gold, about 3x and
+  not 16x: fetch is a gather, loads and stores leave the vectors for per lane memory accesses, and lanes
+  that stopped are masked but still take their slot until the longest program of the batch ends (100
+  instruction programs retire about 35 instructions each in about 51 steps, so about 70% of the lane
+  slots do work). In a whole campaign the step is only about 3% of the time and random_program (seeding
+  mt19937 and drawing every instruction) takes the rest, so a campaign with lanes is only about 1.1x faster.
+*/
+#define GLANES_MAX (16)
+
+// NOTE: the vector helpers are static and inlined, their ABI does not matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// NOTE: aligned explicitly, otherwise the alignment follows the target and the AVX-512 glanes_step would
+//       use aligned accesses on a Glanes laid out for the baseline
+typedef uint32_t Glanes_u32 __attribute__((vector_size(GLANES_MAX * sizeof(uint32_t)), aligned(GLANES_MAX * sizeof(uint32_t))));
+typedef int32_t  Glanes_i32 __attribute__((vector_size(GLANES_MAX * sizeof(int32_t)), aligned(GLANES_MAX * sizeof(int32_t))));
+
+enum GlaneStop {
+  GlaneRunning,
+  GlaneStopEbreak,
+  GlaneStopNotMapped,
+  GlaneStopInvalidPc,
+  GlaneStopBudget,
+};
+
+// NOTE: SDRAM pages are allocated on the first write, unallocated pages read as zero
+struct Glane_mem {
+  uint8_t*  pages[MEM_SIZE >> MEM_MAP_PAGE_BITS];
+  uint32_t  touched[MEM_SIZE >> MEM_MAP_PAGE_BITS];
+  uint32_t  n_touched;
+};
+
+struct Glanes {
+  uint32_t   n_lanes;
+  uint32_t   n_insts;
+
+  Glanes_u32 pc;
+  Glanes_u32 regs[N_REGS];
+  Glanes_u32 instret;
+  Glanes_u32 is_running;
+
+  uint8_t    ebreak[GLANES_MAX];
+  GlaneStop  stop[GLANES_MAX];
+  uint8_t    uart[GLANES_MAX][8];
+  // NOTE: program of lane l starts at code[l * (n_insts + 1)] and is followed by a zero word
+  uint32_t*  code;
+  Glanes_u32 code_base;
+  Glane_mem  mem[GLANES_MAX];
+};
+
+Glanes* glanes_new(uint32_t n_lanes, uint32_t n_insts) {
+  Glanes* g  = (Glanes*)aligned_alloc(alignof(Glanes), sizeof(Glanes));
+  memset(g, 0, sizeof(Glanes));
+  g->n_lanes = n_lanes < GLANES_MAX ? n_lanes : GLANES_MAX;
+  g->n_insts = n_insts;
+  g->code    = (uint32_t*)calloc(GLANES_MAX * (n_insts + 1), sizeof(uint32_t));
+  for (uint32_t l = 0; l < GLANES_MAX; l++) {
+    g->code_base[l] = l * (n_insts + 1);
+  }
+  return g;
+}
+
+void glanes_free(Glanes* g) {
+  free(g->code);
+  for (uint32_t l = 0; l < GLANES_MAX; l++) {
+    for (uint32_t i = 0; i < (MEM_SIZE >> MEM_MAP_PAGE_BITS); i++) {
+      free(g->mem[l].pages[i]);
+    }
+  }
+  free(g);
+}
+
+uint32_t* glanes_insts(Glanes* g, uint32_t lane) {
+  return g->code + g->code_base[lane];
+}
+
+// NOTE: resets the lane as g_reset + g_flash_init would do on a fresh Gcpu
+void glanes_load(Glanes* g, uint32_t lane, const uint32_t* insts) {
+  memcpy(glanes_insts(g, lane), insts, g->n_insts * sizeof(uint32_t));
+
+  Glane_mem* mem = &g->mem[lane];
+  for (uint32_t i = 0; i < mem->n_touched; i++) {
+    memset(mem->pages[mem->touched[i]], 0, MEM_MAP_PAGE_SIZE);
+  }
+  mem->n_touched = 0;
+
+  g->pc[lane]         = INITIAL_PC;
+  g->instret[lane]    = 0;
+  g->is_running[lane] = ~0u;
+  g->ebreak[lane]     = 0;
+  g->stop[lane]       = GlaneRunning;
+  for (uint32_t r = 0; r < N_REGS; r++) {
+    g->regs[r][lane] = 0;
+  }
+  memset(g->uart[lane], 0, sizeof(g->uart[lane]));
+  g->uart[lane][2] = 0b1100'0000;
+  g->uart[lane][3] = 0b0000'0011;
+  g->uart[lane][5] = 0b0010'0000;
+}
+
+static uint8_t glane_mem_byte(Glanes* g, uint32_t lane, uint32_t offset) {
+  uint8_t* page = g->mem[lane].pages[offset >> MEM_MAP_PAGE_BITS];
+  return page ? page[offset & (MEM_MAP_PAGE_SIZE - 1)] : 0;
+}
+
+static uint8_t glane_flash_byte(Glanes* g, uint32_t lane, uint32_t offset) {
+  if (offset >= g->n_insts * 4) return 0;
+  return ((uint8_t*)glanes_insts(g, lane))[offset];
+}
+
+// NOTE: same address decoding as mem_map_read with the gold map: 4 bytes inside flash or SDRAM, or the uart range
+static uint32_t glane_mem_read(Glanes* g, uint32_t lane, uint32_t addr, bool* is_not_mapped) {
+  uint32_t result = 0;
+  if (addr - MEM_START <= MEM_SIZE - 4) {
+    for (uint32_t i = 0; i < 4; i++) result |= glane_mem_byte(g, lane, addr - MEM_START + i) << 8*i;
+  }
+  else if (addr - FLASH_START <= FLASH_SIZE - 4) {
+    for (uint32_t i = 0; i < 4; i++) result |= glane_flash_byte(g, lane, addr - FLASH_START + i) << 8*i;
+  }
+  else if (addr - UART_START < UART_END - UART_START) {
+    // NOTE: g_uart_read over the own uart
+    uint8_t* uart = g->uart[lane];
+    uint32_t byte = 0;
+    switch (addr - UART_START) {
+      case 0 : byte = uart[0]; break;
+      case 1 : byte = uart[1]; break;
+      case 2 : byte = uart[2]; break;
+      case 3 : byte = uart[3]; break;
+      case 5 : byte = uart[5]; break;
+      case 6 : byte = uart[6]; break;
+      default: *is_not_mapped = true; break;
+    }
+    result = byte << 24 | byte << 16 | byte << 8 | byte << 0;
+  }
+  else {
+    *is_not_mapped = true;
+  }
+  return result;
+}
+
+static void glane_mem_write(Glanes* g, uint32_t lane, uint32_t addr, uint8_t wbmask, uint32_t wdata, bool* is_not_mapped) {
+  if (addr - MEM_START <= MEM_SIZE - 4) {
+    Glane_mem* mem = &g->mem[lane];
+    for (uint32_t i = 0; i < 4; i++) {
+      if (!(wbmask & (1 << i))) continue;
+      uint32_t offset = addr - MEM_START + i;
+      uint32_t page   = offset >> MEM_MAP_PAGE_BITS;
+      if (!mem->pages[page]) mem->pages[page] = (uint8_t*)calloc(1, MEM_MAP_PAGE_SIZE);
+      bool is_touched = false;
+      for (uint32_t t = 0; t < mem->n_touched && !is_touched; t++) is_touched = mem->touched[t] == page;
+      if (!is_touched) mem->touched[mem->n_touched++] = page;
+      mem->pages[page][offset & (MEM_MAP_PAGE_SIZE - 1)] = (wdata >> 8*i) & 0xff;
+    }
+  }
+  else if (addr - FLASH_START <= FLASH_SIZE - 4) {
+    *is_not_mapped = true;
+  }
+  else if (addr - UART_START < UART_END - UART_START) {
+    // NOTE: g_uart_write over the own uart, THR is dropped
+    uint32_t offset = addr - UART_START;
+    uint8_t  byte   = (wdata >> 8*(offset & 0b11)) & 0xff;
+    if (offset != 0 && offset != 5 && offset != 6 && offset < sizeof(g->uart[lane])) {
+      g->uart[lane][offset] = byte;
+    }
+  }
+  else {
+    *is_not_mapped = true;
+  }
+}
+
+namespace glanes_base {
+#include "glanes_step.cpp"
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace glanes_avx512 {
+#include "glanes_step.cpp"
+}
+#pragma GCC pop_options
+
+void glanes_run(Glanes* g) {
+  for (uint32_t l = g->n_lanes; l < GLANES_MAX; l++) {
+    g->is_running[l] = 0;
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    while (glanes_avx512::glanes_step(g)) {}
+  }
+  else {
+    while (glanes_base::glanes_step(g)) {}
+  }
+}
@@ -0,0 +1,201 @@
+/*
+  Vector part of the lanes golden model, included twice by glanes.cpp: once built for AVX-512 and once
+  for the baseline target. GCC lowers generic vectors per function, so the helpers and glanes_step
+  have to be built together for the same target.
+*/
+
+// NOTE: vectors are filled from and spilled to plain arrays, inserting elements one by one is slow
+static Glanes_u32 glanes_load_u32(const uint32_t* lanes) {
+  Glanes_u32 result;
+  memcpy(&result, lanes, sizeof(result));
+  return result;
+}
+
+// NOTE: bit l is set if lane l of v is not zero
+static uint32_t glanes_mask(const Glanes_u32& v) {
+  alignas(64) uint32_t lanes[GLANES_MAX];
+  memcpy(lanes, &v, sizeof(lanes));
+  uint32_t result = 0;
+  for (uint32_t l = 0; l < GLANES_MAX; l++) {
+    result |= (lanes[l] != 0) << l;
+  }
+  return result;
+}
+
+struct Glanes_dec {
+  Glanes_u32 inst_type;
+  Glanes_u32 reg_dest;
+  Glanes_u32 reg_src1;
+  Glanes_u32 reg_src2;
+  Glanes_u32 imm;
+  Glanes_u32 alu_op;
+  Glanes_u32 com_op;
+  Glanes_u32 mem_wbmask;
+  Glanes_u32 is_mem_sign;
+  Glanes_u32 ebreak;
+};
+
+// NOTE: decode() on all lanes at once
+static Glanes_dec glanes_decode(const Glanes_u32& inst) {
+  Glanes_dec out = {};
+  Glanes_i32 sinst  = (Glanes_i32)inst;
+  Glanes_u32 opcode = inst & 0x7f;
+  Glanes_u32 funct3 = (inst >> 12) & 0b111;
+  Glanes_u32 sub    = (inst >> 30) & 1;
+  out.reg_dest = (inst >>  7) & 0x1f;
+  out.reg_src1 = (inst >> 15) & 0x1f;
+  out.reg_src2 = (inst >> 20) & 0x1f;
+
+  Glanes_u32 i_imm = (Glanes_u32)(sinst >> 20);
+  Glanes_u32 u_imm = inst & 0xfffff000u;
+  Glanes_u32 s_imm = ((Glanes_u32)(sinst >> 20) & ~0x1fu) | ((inst >> 7) & 0x1f);
+  Glanes_u32 j_imm = ((Glanes_u32)(sinst >> 11) & 0xfff00000u) | (inst & 0xff000) | ((inst >> 9) & 0x800) | ((inst >> 20) & 0x7fe);
+  Glanes_u32 b_imm = ((Glanes_u32)(sinst >> 19) & 0xfffff000u) | ((inst << 4) & 0x800) | ((inst >> 20) & 0x7e0) | ((inst >> 7) & 0x1e);
+
+  Glanes_u32 is_load_funct3 = (Glanes_u32)(
+    (funct3 == FUNCT3_LB) | (funct3 == FUNCT3_LH) | (funct3 == FUNCT3_LW) | (funct3 == FUNCT3_LBU) | (funct3 == FUNCT3_LHU));
+  Glanes_u32 is_sr_add = (Glanes_u32)((funct3 == FUNCT3_SR) | (funct3 == FUNCT3_ADD)) & 1;
+
+  out.inst_type =
+    opcode == OPCODE_CALC_IMM ? (Glanes_u32){} + INST_IMM :
+    opcode == OPCODE_CALC_REG ? (Glanes_u32){} + INST_REG :
+    opcode == OPCODE_LOAD     ? (is_load_funct3 & ((0b011 << 2) | (funct3 & 0b11))) :
+    opcode == OPCODE_STORE    ? (Glanes_u32){} + INST_STORE :
+    opcode == OPCODE_LUI      ? (Glanes_u32){} + INST_UPP :
+    opcode == OPCODE_AUIPC    ? (Glanes_u32){} + INST_AUIPC :
+    opcode == OPCODE_JALR     ? (Glanes_u32){} + INST_JUMPR :
+    opcode == OPCODE_JAL      ? (Glanes_u32){} + INST_JUMP :
+    opcode == OPCODE_BRANCH   ? (Glanes_u32){} + INST_BRANCH :
+    (Glanes_u32){};
+  out.imm =
+    (opcode == OPCODE_CALC_IMM) | (opcode == OPCODE_LOAD) | (opcode == OPCODE_JALR) ? i_imm :
+    opcode == OPCODE_STORE                              ? s_imm :
+    (opcode == OPCODE_LUI) | (opcode == OPCODE_AUIPC)   ? u_imm :
+    opcode == OPCODE_JAL                                ? j_imm :
+    opcode == OPCODE_BRANCH                             ? b_imm :
+    (Glanes_u32){};
+  out.alu_op =
+    opcode == OPCODE_CALC_IMM ? ((sub & (Glanes_u32)(funct3 == FUNCT3_SR)) << 3) | funct3 :
+    opcode == OPCODE_CALC_REG ? ((sub & is_sr_add) << 3) | funct3 :
+    (Glanes_u32){} + ALU_OP_ADD;
+  out.com_op     = opcode == OPCODE_BRANCH ? funct3 : (Glanes_u32){};
+  out.mem_wbmask =
+    opcode != OPCODE_STORE ? (Glanes_u32){} :
+    funct3 == FUNCT3_SB    ? (Glanes_u32){} + 0b0001 :
+    funct3 == FUNCT3_SH    ? (Glanes_u32){} + 0b0011 :
+    funct3 == FUNCT3_SW    ? (Glanes_u32){} + 0b1111 :
+    (Glanes_u32){};
+  out.ebreak      = opcode == OPCODE_SYSTEM ? (inst >> 20) & 1 : (Glanes_u32){};
+  out.is_mem_sign = (Glanes_u32)((funct3 & 0b100) == 0) & 1;
+  return out;
+}
+
+// NOTE: one cpu_eval on every running lane; returns the number of lanes still running
+uint32_t glanes_step(Glanes* g) {
+  // NOTE: a running lane's pc is always valid (checked after every step): in the program or in SDRAM.
+  //       Lanes outside the program fetch the zero word after it and are patched from SDRAM.
+  uint32_t   code_size  = g->n_insts * 4;
+  Glanes_u32 fetch_addr = g->pc & ~3u;
+  Glanes_u32 is_code    = (Glanes_u32)(fetch_addr - FLASH_START <= code_size);
+  Glanes_u32 code_index = g->code_base + (is_code != 0 ? (fetch_addr - FLASH_START) >> 2 : (Glanes_u32){} + g->n_insts);
+  alignas(64) uint32_t lane_code_index[GLANES_MAX], lane_inst[GLANES_MAX];
+  memcpy(lane_code_index, &code_index, sizeof(lane_code_index));
+  for (uint32_t l = 0; l < GLANES_MAX; l++) {
+    lane_inst[l] = g->code[lane_code_index[l]];
+  }
+  for (uint32_t mask = glanes_mask(g->is_running & ~is_code); mask; mask &= mask - 1) {
+    uint32_t l = __builtin_ctz(mask);
+    bool is_not_mapped = false;
+    lane_inst[l] = glane_mem_read(g, l, fetch_addr[l], &is_not_mapped);
+  }
+  Glanes_dec dec = glanes_decode(glanes_load_u32(lane_inst));
+  Glanes_u32 inst_type = dec.inst_type;
+
+  // NOTE: register file read as a select over all registers, indices >= N_REGS read as zero
+  Glanes_u32 rdata1 = {}, rdata2 = {};
+  for (uint32_t r = 0; r < N_REGS; r++) {
+    rdata1 = dec.reg_src1 == r ? g->regs[r] : rdata1;
+    rdata2 = dec.reg_src2 == r ? g->regs[r] : rdata2;
+  }
+
+  Glanes_u32 pc        = g->pc;
+  Glanes_u32 is_store  = (Glanes_u32)(inst_type == INST_STORE);
+  Glanes_u32 is_load   = (Glanes_u32)((inst_type == INST_LOAD_BYTE) | (inst_type == INST_LOAD_HALF) | (inst_type == INST_LOAD_WORD));
+  Glanes_u32 alu_lhs   = (inst_type == INST_JUMP) | (inst_type == INST_AUIPC) | (inst_type == INST_BRANCH) ? pc : rdata1;
+  Glanes_u32 alu_rhs   = inst_type == INST_REG ? rdata2 : inst_type == INST_UPP ? (Glanes_u32){} : dec.imm;
+
+  Glanes_u32 alu_op  = dec.alu_op;
+  Glanes_u32 shamt   = alu_rhs & 31;
+  Glanes_u32 alu_res =
+    alu_op == ALU_OP_ADD  ? alu_lhs + alu_rhs :
+    alu_op == ALU_OP_SUB  ? alu_lhs - alu_rhs :
+    alu_op == ALU_OP_XOR  ? alu_lhs ^ alu_rhs :
+    alu_op == ALU_OP_AND  ? alu_lhs & alu_rhs :
+    alu_op == ALU_OP_OR   ? alu_lhs | alu_rhs :
+    alu_op == ALU_OP_SLL  ? alu_lhs << shamt :
+    alu_op == ALU_OP_SRL  ? alu_lhs >> shamt :
+    alu_op == ALU_OP_SRA  ? (Glanes_u32)((Glanes_i32)alu_lhs >> (Glanes_i32)shamt) :
+    alu_op == ALU_OP_SLT  ? (Glanes_u32)((Glanes_i32)alu_lhs < (Glanes_i32)alu_rhs) & 1 :
+    alu_op == ALU_OP_SLTU ? (Glanes_u32)(alu_lhs < alu_rhs) & 1 :
+    (Glanes_u32){};
+  Glanes_u32 com_op  = dec.com_op;
+  Glanes_u32 com_res =
+    com_op == COM_OP_EQ  ? (Glanes_u32)(rdata1 == rdata2) :
+    com_op == COM_OP_NE  ? (Glanes_u32)(rdata1 != rdata2) :
+    com_op == COM_OP_LT  ? (Glanes_u32)((Glanes_i32)rdata1 <  (Glanes_i32)rdata2) :
+    com_op == COM_OP_GE  ? (Glanes_u32)((Glanes_i32)rdata1 >= (Glanes_i32)rdata2) :
+    com_op == COM_OP_LTU ? (Glanes_u32)(rdata1 <  rdata2) :
+    com_op == COM_OP_GEU ? (Glanes_u32)(rdata1 >= rdata2) :
+    (Glanes_u32){};
+
+  // NOTE: memory is per lane; stores read first, as cpu_eval does
+  Glanes_u32 is_mem_op = (is_load | is_store) & g->is_running;
+  alignas(64) uint32_t lane_mem_rdata[GLANES_MAX] = {}, lane_not_mapped[GLANES_MAX] = {};
+  for (uint32_t mask = glanes_mask(is_mem_op); mask; mask &= mask - 1) {
+    uint32_t l = __builtin_ctz(mask);
+    bool is_not_mapped = false;
+    lane_mem_rdata[l] = glane_mem_read(g, l, alu_res[l], &is_not_mapped);
+    if (is_store[l]) {
+      glane_mem_write(g, l, alu_res[l], dec.mem_wbmask[l], rdata2[l], &is_not_mapped);
+    }
+    lane_not_mapped[l] = is_not_mapped ? ~0u : 0;
+  }
+  Glanes_u32 mem_rdata = glanes_load_u32(lane_mem_rdata);
+
+  Glanes_u32 byte_extend = (mem_rdata & 0x80)   && dec.is_mem_sign ? mem_rdata | ~0xffu   : mem_rdata & 0xff;
+  Glanes_u32 half_extend = (mem_rdata & 0x8000) && dec.is_mem_sign ? mem_rdata | ~0xffffu : mem_rdata & 0xffff;
+  Glanes_u32 is_link     = (Glanes_u32)((inst_type == INST_JUMP) | (inst_type == INST_JUMPR));
+  Glanes_u32 reg_wdata =
+    inst_type == INST_LOAD_BYTE ? byte_extend :
+    inst_type == INST_LOAD_HALF ? half_extend :
+    inst_type == INST_LOAD_WORD ? mem_rdata :
+    inst_type == INST_UPP       ? dec.imm :
+    is_link != 0                ? pc + 4 :
+    alu_res;
+  Glanes_u32 reg_wen = (is_load | is_link | (Glanes_u32)(
+    (inst_type == INST_UPP) | (inst_type == INST_AUIPC) | (inst_type == INST_REG) | (inst_type == INST_IMM))) & g->is_running;
+  for (uint32_t r = 1; r < N_REGS; r++) {
+    g->regs[r] = (reg_wen != 0) & (dec.reg_dest == r) ? reg_wdata : g->regs[r];
+  }
+
+  Glanes_u32 pc_jump = is_link | ((Glanes_u32)(inst_type == INST_BRANCH) & com_res);
+  g->pc       = g->is_running != 0 ? (pc_jump != 0 ? alu_res : pc + 4) : pc;
+  g->instret += g->is_running & 1;
+
+  // NOTE: stop checks of the gold only loop in test_instructions, in its order
+  Glanes_u32 is_not_mapped = (Glanes_u32)(inst_type == 0) | glanes_load_u32(lane_not_mapped);
+  Glanes_u32 is_valid_pc   = (Glanes_u32)((g->pc - FLASH_START <= code_size) | (g->pc - MEM_START <= code_size));
+  Glanes_u32 is_budget     = (Glanes_u32)(g->instret > g->n_insts);
+  Glanes_u32 is_stop       = g->is_running & (is_not_mapped | ~is_valid_pc | is_budget);
+  for (uint32_t mask = glanes_mask(is_stop); mask; mask &= mask - 1) {
+    uint32_t l = __builtin_ctz(mask);
+    // NOTE: ebreak decodes as inst_type 0, so it is also not mapped
+    g->ebreak[l] = dec.ebreak[l];
+    if      (dec.ebreak[l])    g->stop[l] = GlaneStopEbreak;
+    else if (is_not_mapped[l]) g->stop[l] = GlaneStopNotMapped;
+    else if (!is_valid_pc[l])  g->stop[l] = GlaneStopInvalidPc;
+    else                       g->stop[l] = GlaneStopBudget;
+  }
+  g->is_running &= ~is_stop;
+  return __builtin_popcount(glanes_mask(g->is_running));
+}
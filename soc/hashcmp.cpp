@@ -0,0 +1,104 @@
+/*
+  vsoc and gold step in lockstep without comparing anything: each of them keeps a rolling hash of its
+  commit records (pc, instruction, register write and store), and the hashes and the pcs are compared every
+  hashcmp_insts instructions. Both sides are checkpointed where they match. On a mismatch the run is restored
+  to the last match and the interval is bisected with replays down to the first divergent instruction,
+  which is then stepped with the detailed per-register and per-byte comparison.
+*/
+struct HashcmpState {
+  uint64_t vsoc_hash;
+  uint64_t gold_hash;
+};
+
+// NOTE: steps both until n instructions have retired, ebreak, the end of gold or max_cycles
+void hashcmp_run(TestBench* tb, HashcmpState* state, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++) {
+    if (tb->vsoc_cpu->event_counts.ebreak || tb->gcpu->ebreak) break;
+    if (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) break;
+    vsoc_fetch_exec(tb);
+    CommitRecord g = gold_commit_step(tb);
+    state->gold_hash = commit_hash(state->gold_hash, &g);
+    if (gold_is_done(tb)) break;
+  }
+}
+
+bool hashcmp_is_match(TestBench* tb, HashcmpState* state) {
+  return state->vsoc_hash == state->gold_hash &&
+         tb->vsoc_cpu->pc == tb->gcpu->pc &&
+         tb->vsoc_cpu->event_counts.ebreak == tb->gcpu->ebreak;
+}
+
+bool test_hashcmp(TestBench* tb) {
+  char path[] = "/tmp/hashcmp_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("[ERROR] could not create the hashcmp checkpoint\n");
+    return false;
+  }
+  close(fd);
+
+  HashcmpState state = {};
+  dpi_model.state_hash = &state.vsoc_hash;
+  uint64_t match_instrets = tb->instrets;
+  HashcmpState match_state = state;
+  bool is_test_success = checkpoint_save(tb, path);
+  while (is_test_success) {
+    hashcmp_run(tb, &state, tb->hashcmp_insts);
+    bool is_end = tb->vsoc_cpu->event_counts.ebreak || tb->gcpu->ebreak || gold_is_done(tb) ||
+                  (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles);
+    if (hashcmp_is_match(tb, &state)) {
+      if (is_end) break;
+      is_test_success &= checkpoint_save(tb, path);
+      match_instrets = tb->instrets;
+      match_state    = state;
+      continue;
+    }
+
+    uint64_t lo = match_instrets;
+    uint64_t hi = tb->instrets;
+    if (tb->verbose >= VerboseInfo4) {
+      printf("[INFO] hashcmp mismatch in [%lu, %lu], bisecting\n", lo, hi);
+    }
+    while (hi - lo > 1 && is_test_success) {
+      uint64_t mid = lo + (hi - lo) / 2;
+      is_test_success &= checkpoint_restore(tb, path);
+      state = match_state;
+      hashcmp_run(tb, &state, mid - lo);
+      if (tb->instrets == mid && hashcmp_is_match(tb, &state)) {
+        is_test_success &= checkpoint_save(tb, path);
+        lo          = mid;
+        match_state = state;
+      }
+      else {
+        hi = mid;
+      }
+    }
+    is_test_success &= checkpoint_restore(tb, path);
+    if (!is_test_success) break;
+    uint32_t pc   = tb->gcpu->pc;
+    uint32_t inst = g_mem_read(tb->gcpu, pc);
+    vsoc_fetch_exec(tb);
+    gold_commit_step(tb);
+    bool is_memcmp = tb->is_memcmp;
+    tb->is_memcmp = true;
+    if (compare_vsoc_gold(tb)) {
+      printf("[FAILED] hashcmp: the commit records of vsoc and gold differ at instruction %lu\n", tb->instrets);
+    }
+    tb->is_memcmp = is_memcmp;
+    printf("[%lx] pc=0x%08x inst: [0x%x] ", tb->instrets, pc, inst);
+    print_instruction(inst);
+    is_test_success = false;
+  }
+  dpi_model.state_hash = NULL;
+  unlink(path);
+  if (!is_test_success) return false;
+
+  if (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) {
+    printf("[FAILED] test is not successful: vsoc timeout %lu/%lu\n", tb->vsoc_cycles, tb->max_cycles);
+    return false;
+  }
+  is_test_success &= ebreak_check(tb, "vsoc", tb->vsoc_cpu->event_counts.ebreak, tb->vsoc_cpu->regs[10]);
+  is_test_success &= ebreak_check(tb, "gcpu", tb->gcpu->ebreak, tb->gcpu->regs[10]);
+  is_test_success &= compare_vsoc_gold(tb);
+  return is_test_success;
+}
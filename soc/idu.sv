@@ -6,6 +6,7 @@ module idu (
   output logic                   respValid,
 
   input  logic [REG_W_END:0]     inst_in,
+  output logic [REG_W_END:0]     inst_out,
 
   output logic [REG_A_END:0]     rd,
   output logic [REG_A_END:0]     rs1,
@@ -62,6 +63,7 @@ module idu (
   logic [REG_W_END:0] j_imm;
   logic [REG_W_END:0] b_imm;
 
+  assign inst_out = inst;
   assign opcode = inst[6:0];
   assign rd     = inst[11:7];
   assign funct3 = inst[14:12];
@@ -0,0 +1,107 @@
+/*
+  Random campaign on tb->jobs forked workers, each with its own copy of the models. Test i runs the program
+  of random_test_seed(seed, i), so any worker can run any test: the workers claim JOBS_CHUNK tests at a time
+  from a counter in shared memory and stop claiming past the first failed test. Every test before the first
+  failure runs, so the reported one does not depend on the scheduling; the workers print nothing and its
+  program is run again here for the report.
+*/
+#define JOBS_CHUNK (16)
+
+struct JobsShared {
+  std::atomic<uint64_t> next;
+  std::atomic<uint64_t> failed; // NOTE: index of the first failed test, max_tests if none
+  std::atomic<uint64_t> n_run;
+  std::atomic<uint64_t> passed;
+};
+
+uint64_t random_test_seed(uint64_t base, uint64_t i) {
+  return hash_uint64_t(base + (i + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+void jobs_worker(TestBench* tb, JobsShared* shared, uint64_t seed) {
+  if (!freopen("/dev/null", "w", stdout)) return;
+  while (1) {
+    uint64_t start = shared->next.fetch_add(JOBS_CHUNK);
+    if (start >= shared->failed.load()) break;
+    uint64_t end = std::min(start + JOBS_CHUNK, tb->max_tests);
+    for (uint64_t i = start; i < end && i < shared->failed.load(); i++) {
+      random_program(tb, random_test_seed(seed, i), tb->insts);
+      shared->n_run.fetch_add(1);
+      if (test_instructions(tb)) {
+        shared->passed.fetch_add(1);
+      }
+      else {
+        uint64_t failed = shared->failed.load();
+        while (i < failed && !shared->failed.compare_exchange_weak(failed, i)) {}
+        break;
+      }
+    }
+  }
+}
+
+bool test_random_jobs(TestBench* tb, uint64_t seed) {
+  JobsShared* shared = (JobsShared*)mmap(NULL, sizeof(JobsShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    printf("[ERROR] jobs: could not map the shared counters\n");
+    return false;
+  }
+  shared->next.store(0);
+  shared->failed.store(tb->max_tests);
+  shared->n_run.store(0);
+  shared->passed.store(0);
+
+  bool is_tests_success = true;
+  // NOTE: or the workers would print the buffered output again
+  fflush(stdout);
+  auto start = std::chrono::steady_clock::now();
+  pid_t* pids = new pid_t[tb->jobs];
+  uint32_t n_workers = 0;
+  for (; n_workers < tb->jobs; n_workers++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      jobs_worker(tb, shared, seed);
+      fflush(stdout);
+      _exit(0);
+    }
+    if (pid < 0) {
+      printf("[ERROR] jobs: could not start worker %u\n", n_workers);
+      is_tests_success = n_workers > 0;
+      break;
+    }
+    pids[n_workers] = pid;
+  }
+  uint32_t n_crashed = 0;
+  for (uint32_t w = 0; w < n_workers; w++) {
+    int status = 0;
+    waitpid(pids[w], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      printf("[FAILED] jobs: worker %u ended with status 0x%x, the tests it claimed are not counted\n", w, status);
+      is_tests_success = false;
+      n_crashed++;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  delete[] pids;
+
+  uint64_t failed = shared->failed.load();
+  uint64_t n_run  = shared->n_run.load();
+  uint64_t passed = shared->passed.load();
+  printf("[INFO] jobs finished: %" PRIu64 " tests on %u workers in %.3f s, %.1f tests/s\n", n_run, n_workers, seconds, n_run / seconds);
+  if (failed < tb->max_tests) {
+    is_tests_success = false;
+    uint64_t failed_seed = random_test_seed(seed, failed);
+    printf("[FAILED] SEED:%lu: test %lu\n", failed_seed, failed);
+    random_program(tb, failed_seed, tb->insts);
+    if (test_instructions(tb)) {
+      printf("[WARNING] jobs: SEED:%lu passed when run again\n", failed_seed);
+    }
+    print_all_instructions(tb);
+    if (tb->shrink_path) shrink_program(tb, failed_seed, tb->insts);
+  }
+  if (n_crashed) {
+    printf("[FAILED] jobs: %u of %u workers crashed\n", n_crashed, n_workers);
+  }
+  printf("Tests results: %" PRIu64 " / %" PRIu64 " have passed\n", passed, tb->max_tests);
+  munmap(shared, sizeof(JobsShared));
+  return is_tests_success;
+}
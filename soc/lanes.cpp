@@ -0,0 +1,53 @@
+/*
+  Gold only random campaign on the lanes model: tb->gold_lanes programs run at once. With
+  tb->is_lanes_check every lane is also run on the scalar gold and the final states are compared.
+*/
+bool test_random_lanes(TestBench* tb, uint64_t seed) {
+  Glanes* g = glanes_new(tb->gold_lanes, tb->n_insts);
+  uint64_t seeds[GLANES_MAX];
+  bool is_tests_success = true;
+  uint64_t tests_passed = 0;
+  uint64_t lanes_insts  = 0;
+  double   lanes_seconds = 0;
+  do {
+    uint64_t tests_left = tb->max_tests > tests_passed ? tb->max_tests - tests_passed : 1;
+    g->n_lanes = tests_left < tb->gold_lanes ? tests_left : tb->gold_lanes;
+    for (uint32_t l = 0; l < g->n_lanes; l++) {
+      random_program(tb, seed, tb->insts);
+      glanes_load(g, l, tb->insts);
+      seeds[l] = seed;
+      seed = hash_uint64_t(seed);
+    }
+    auto start = std::chrono::steady_clock::now();
+    glanes_run(g);
+    lanes_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (uint32_t l = 0; l < g->n_lanes && is_tests_success; l++) {
+      lanes_insts += g->instret[l];
+      memcpy(tb->insts, glanes_insts(g, l), tb->n_insts * sizeof(uint32_t));
+      if (tb->verbose >= VerboseInfo4) {
+        printf("======== SEED:%lu ===== %" PRIu64 "/%" PRIu64 " lane %u: %u instrets =========\n", seeds[l], tests_passed, tb->max_tests, l, g->instret[l]);
+      }
+      if (g->ebreak[l] && tb->is_check && g->regs[10][l] != 0) {
+        printf("[FAILED] test is not successful: lanes returned %u\n", g->regs[10][l]);
+        is_tests_success = false;
+      }
+      if (tb->is_lanes_check) {
+        is_tests_success &= test_instructions(tb);
+        is_tests_success &= compare_lanes_gold(g, l, tb->gcpu);
+      }
+      if (is_tests_success) {
+        tests_passed++;
+      }
+      else {
+        printf("[FAILED] SEED:%lu\n", seeds[l]);
+        print_all_instructions(tb);
+      }
+    }
+  } while (is_tests_success && tests_passed < tb->max_tests);
+
+  printf("[INFO] lanes finished: %lu instrets in %.3f s, %.2f MIPS\n", lanes_insts, lanes_seconds, lanes_insts / lanes_seconds / 1e6);
+  printf("Tests results: %" PRIu64 " / %" PRIu64 " have passed\n", tests_passed, tb->max_tests);
+  glanes_free(g);
+  return is_tests_success;
+}
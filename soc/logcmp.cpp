@@ -0,0 +1,128 @@
+struct ModelState {
+  const char* name;
+  uint32_t    pc;
+  uint32_t    regs[N_REGS];
+  bool        ebreak;
+};
+
+// NOTE: the state of the only model of a commitlog or logcmp run
+ModelState model_state(TestBench* tb) {
+  ModelState state = {};
+  if (tb->is_gold) {
+    state.name   = "gcpu";
+    state.pc     = tb->gcpu->pc;
+    state.ebreak = tb->gcpu->ebreak;
+    for (uint32_t i = 0; i < N_REGS; i++) state.regs[i] = tb->gcpu->regs[i];
+  }
+  else if (tb->is_vsoc) {
+    state.name   = "vsoc";
+    state.pc     = tb->vsoc_cpu->pc;
+    state.ebreak = tb->vsoc_cpu->event_counts.ebreak;
+    for (uint32_t i = 0; i < N_REGS; i++) state.regs[i] = tb->vsoc_cpu->regs[i];
+  }
+  else {
+    state.name   = "vcpu";
+    state.pc     = tb->vcpu_cpu->pc;
+    state.ebreak = tb->vcpu_cpu->event_counts.ebreak;
+    for (uint32_t i = 0; i < N_REGS; i++) state.regs[i] = tb->vcpu_cpu->regs[i];
+  }
+  return state;
+}
+
+/*
+  One model runs on its own thread like in test_threads and its records are either written to the commit
+  log at commitlog_path or compared with the one at logcmp_path, written by any model for the same bin.
+  The final state of the model is compared with the end of the log.
+*/
+bool test_commitlog(TestBench* tb) {
+  uint64_t flash_hash = checkpoint_flash_hash(tb);
+  CommitLogWriter writer = {};
+  CommitLogReader reader = {};
+  if (tb->commitlog_path && !commitlog_open_write(&writer, tb->commitlog_path, flash_hash)) return false;
+  if (tb->logcmp_path && !commitlog_open_read(&reader, tb->logcmp_path, flash_hash)) {
+    commitlog_close_read(&reader);
+    return false;
+  }
+
+  CommitRing* ring = commit_ring_new(THREADS_RING_SIZE, true);
+  std::thread thread;
+  if      (tb->is_gold) thread = std::thread(threads_gold, tb, ring);
+  else if (tb->is_vsoc) thread = std::thread(threads_vsoc, tb, ring);
+  else                  thread = std::thread(threads_vcpu, tb, ring);
+
+  bool is_test_success = true;
+  const CommitRecord* r;
+  while (is_test_success && (r = commit_ring_wait(ring))) {
+    if (tb->commitlog_path) {
+      commitlog_write(&writer, r);
+    }
+    else {
+      CommitRecord g;
+      if (!commitlog_read(&reader, &g)) {
+        if (reader.is_end) printf("[FAILED] the run retired more than the %lu instructions of the log\n", reader.state.n_records);
+        is_test_success = false;
+        break;
+      }
+      // NOTE: the log has no instructions, they come from the same bin
+      g.inst = r->inst;
+      if (!compare_commit(r, &g)) {
+        printf("[%lx] pc=0x%08x inst: [0x%x] ", reader.state.n_records, r->pc, r->inst);
+        print_instruction(r->inst);
+        is_test_success = false;
+      }
+    }
+    commit_ring_pop(ring);
+  }
+  ring->is_stop.store(true, std::memory_order_relaxed);
+  thread.join();
+  commit_ring_free(ring);
+
+  if (tb->is_vsoc && tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) {
+    printf("[FAILED] test is not successful: vsoc timeout %" PRIu64 "/%" PRIu64 "\n", tb->vsoc_cycles, tb->max_cycles);
+    is_test_success = false;
+  }
+  if (tb->is_vcpu && tb->max_cycles && tb->vcpu_cycles >= tb->max_cycles) {
+    printf("[FAILED] test is not successful: vcpu timeout %" PRIu64 "/%" PRIu64 "\n", tb->vcpu_cycles, tb->max_cycles);
+    is_test_success = false;
+  }
+  ModelState state = model_state(tb);
+  is_test_success &= ebreak_check(tb, state.name, state.ebreak, state.regs[10]);
+
+  if (tb->commitlog_path) {
+    uint64_t n_records = writer.state.n_records;
+    if (!commitlog_close_write(&writer, state.pc, state.regs, state.ebreak)) {
+      printf("[ERROR] could not write commit log %s\n", tb->commitlog_path);
+      return false;
+    }
+    if (tb->verbose >= VerboseInfo4) {
+      printf("[INFO] commit log of %lu instructions written to %s\n", n_records, tb->commitlog_path);
+    }
+    return is_test_success;
+  }
+
+  if (is_test_success) {
+    CommitRecord g;
+    if (commitlog_read(&reader, &g)) {
+      printf("[FAILED] %s stopped after %lu instructions, the log goes on\n", state.name, reader.state.n_records - 1);
+      is_test_success = false;
+    }
+    else if (reader.is_end) {
+      is_test_success &= compare_reg(reader.state.n_records, "log.ebreak", state.ebreak, reader.end_ebreak);
+      is_test_success &= compare_reg(reader.state.n_records, "log.pc    ", state.pc,     reader.end_pc);
+      for (uint32_t i = 0; i < N_REGS; i++) {
+        char digit0 = i%10 + '0';
+        char digit1 = i/10 + '0';
+        char name[] = {'x', digit1, digit0, '\0'};
+        is_test_success &= compare_reg(reader.state.n_records, name, state.regs[i], reader.end_regs[i]);
+      }
+    }
+    else {
+      is_test_success = false;
+    }
+  }
+  if (tb->verbose >= VerboseInfo4) {
+    printf("[INFO] %lu instructions compared with the commit log %s\n", reader.state.n_records, tb->logcmp_path);
+  }
+  commitlog_close_read(&reader);
+  return is_test_success;
+}
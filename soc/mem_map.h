@@ -1,3 +1,6 @@
+#ifndef MEM_MAP_H
+#define MEM_MAP_H
+
 #define MEM_START (0x80000000u)
 #define MEM_SIZE (32*1024 * 1024)
 #define MEM_END  (MEM_START + MEM_SIZE)
@@ -9,3 +12,284 @@
 #define UART_START (0x10000000u)
 #define UART_END   (0x10000fffu)
 #define UART_SIZE  (UART_END - UART_START)
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+/*
+  Page table of the 32-bit address space: every 4KB page points to host memory (read_pages, and
+  write_pages if it is writable) or is NULL. Pages that are NULL in read_pages can be covered by the
+  mmio range, which is handled by callbacks. An access is mapped if all of its 4 bytes are mapped
+  to contiguous host memory, so a word that crosses the end of a region is not mapped.
+*/
+#define MEM_MAP_PAGE_BITS (12)
+#define MEM_MAP_PAGE_SIZE (1u << MEM_MAP_PAGE_BITS)
+#define MEM_MAP_PAGES     (1u << (32 - MEM_MAP_PAGE_BITS))
+
+enum MemMapStatus {
+  MemMapOk,
+  MemMapNotMapped,
+  MemMapReadOnly,
+};
+
+typedef uint32_t (*MemMapMmioRead) (void* ctx, uint32_t offset);
+typedef void     (*MemMapMmioWrite)(void* ctx, uint32_t offset, uint8_t wbmask, uint32_t wdata);
+
+struct MemMap {
+  uint8_t** read_pages;
+  uint8_t** write_pages;
+  // NOTE: ~3 -- ram is accessed by aligned words (vcpu bus), ~0 -- ram is accessed at any address (gold)
+  uint32_t  bus_mask;
+
+  uint32_t        mmio_start;
+  uint32_t        mmio_end;
+  void*           mmio_ctx;
+  MemMapMmioRead  mmio_read;
+  MemMapMmioWrite mmio_write;
+};
+
+void mem_map_init(MemMap* map, uint32_t bus_mask) {
+  map->read_pages  = (uint8_t**)calloc(MEM_MAP_PAGES, sizeof(uint8_t*));
+  map->write_pages = (uint8_t**)calloc(MEM_MAP_PAGES, sizeof(uint8_t*));
+  map->bus_mask    = bus_mask;
+  map->mmio_start  = 0;
+  map->mmio_end    = 0;
+}
+
+void mem_map_free(MemMap* map) {
+  free(map->read_pages);
+  free(map->write_pages);
+  map->read_pages  = NULL;
+  map->write_pages = NULL;
+}
+
+// NOTE: start and size are page aligned
+void mem_map_region(MemMap* map, uint32_t start, uint32_t size, uint8_t* host, bool is_writable) {
+  for (uint32_t offset = 0; offset < size; offset += MEM_MAP_PAGE_SIZE) {
+    uint32_t page = (start + offset) >> MEM_MAP_PAGE_BITS;
+    map->read_pages[page]  = host + offset;
+    map->write_pages[page] = is_writable ? host + offset : NULL;
+  }
+}
+
+void mem_map_mmio(MemMap* map, uint32_t start, uint32_t end, void* ctx, MemMapMmioRead read, MemMapMmioWrite write) {
+  map->mmio_start = start;
+  map->mmio_end   = end;
+  map->mmio_ctx   = ctx;
+  map->mmio_read  = read;
+  map->mmio_write = write;
+}
+
+// NOTE: host pointer for the access at addr, NULL if its 4 bytes are not in one contiguous run of pages
+static inline uint8_t* mem_map_translate(uint8_t** pages, uint32_t addr, uint32_t bus_mask) {
+  uint8_t* page = pages[addr >> MEM_MAP_PAGE_BITS];
+  if (!page) return NULL;
+  uint32_t offset = addr & (MEM_MAP_PAGE_SIZE - 1);
+  if (offset > MEM_MAP_PAGE_SIZE - 4) {
+    if (addr + 3 < addr) return NULL;
+    if (pages[(addr + 3) >> MEM_MAP_PAGE_BITS] != page + MEM_MAP_PAGE_SIZE) return NULL;
+  }
+  return page + (offset & bus_mask);
+}
+
+// NOTE: words are assembled with memcpy, the host is little endian like the guest
+static inline MemMapStatus mem_map_read(MemMap* map, uint32_t addr, uint32_t* rdata) {
+  uint8_t* host = mem_map_translate(map->read_pages, addr, map->bus_mask);
+  if (host) {
+    memcpy(rdata, host, sizeof(*rdata));
+    return MemMapOk;
+  }
+  if (addr >= map->mmio_start && addr < map->mmio_end) {
+    *rdata = map->mmio_read(map->mmio_ctx, addr - map->mmio_start);
+    return MemMapOk;
+  }
+  *rdata = 0;
+  return MemMapNotMapped;
+}
+
+static inline MemMapStatus mem_map_write(MemMap* map, uint32_t addr, uint8_t wbmask, uint32_t wdata) {
+  uint8_t* host = mem_map_translate(map->write_pages, addr, map->bus_mask);
+  if (host) {
+    if (wbmask == 0b1111) {
+      memcpy(host, &wdata, sizeof(wdata));
+    }
+    else for (uint32_t i = 0; i < 4; i++) {
+      if (wbmask & (1 << i)) host[i] = (wdata >> 8*i) & 0xff;
+    }
+    return MemMapOk;
+  }
+  if (addr >= map->mmio_start && addr < map->mmio_end) {
+    map->mmio_write(map->mmio_ctx, addr - map->mmio_start, wbmask, wdata);
+    return MemMapOk;
+  }
+  if (mem_map_translate(map->read_pages, addr, map->bus_mask)) return MemMapReadOnly;
+  return MemMapNotMapped;
+}
+
+/*
+  Host memory of a guest region in a reserve-only anonymous mapping: a page costs nothing until it is
+  touched. Every writer marks the 4KB pages it changes (dirty, one byte per page, plus the touched list of
+  them), so mem_backing_clear costs the footprint of the last run instead of the size of the region.
+  size+4 bytes are mapped: a word access at the last byte stays in the host memory.
+*/
+#define MEM_BACKING_SLACK (4)
+// NOTE: more touched pages than this are given back to the kernel with one madvise instead of memset
+#define MEM_BACKING_DONTNEED_PAGES (256)
+
+struct MemBacking {
+  uint8_t*  host;
+  uint32_t  size;
+  uint32_t  n_pages;
+  uint8_t*  dirty;
+  uint32_t* touched;
+  uint32_t  n_touched;
+  bool      is_mmap;
+};
+
+void mem_backing_init(MemBacking* backing, uint32_t size, bool is_hugepages) {
+  size_t map_size = ((size_t)size + MEM_BACKING_SLACK + MEM_MAP_PAGE_SIZE - 1) & ~(size_t)(MEM_MAP_PAGE_SIZE - 1);
+  void* host = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  backing->is_mmap = host != MAP_FAILED;
+  if (!backing->is_mmap) host = calloc(map_size, 1);
+#ifdef MADV_HUGEPAGE
+  else if (is_hugepages) madvise(host, map_size, MADV_HUGEPAGE);
+#endif
+  backing->host      = (uint8_t*)host;
+  backing->size      = size;
+  backing->n_pages   = map_size >> MEM_MAP_PAGE_BITS;
+  backing->dirty     = (uint8_t*) calloc(backing->n_pages, sizeof(uint8_t));
+  backing->touched   = (uint32_t*)calloc(backing->n_pages, sizeof(uint32_t));
+  backing->n_touched = 0;
+}
+
+void mem_backing_free(MemBacking* backing) {
+  if (!backing->host) return;
+  if (backing->is_mmap) munmap(backing->host, (size_t)backing->n_pages << MEM_MAP_PAGE_BITS);
+  else free(backing->host);
+  free(backing->dirty);
+  free(backing->touched);
+  *backing = {};
+}
+
+// NOTE: offset+size may reach into the slack, it is clamped to the mapping
+static inline void mem_backing_mark(MemBacking* backing, uint32_t offset, uint32_t size) {
+  if (!size) return;
+  uint32_t first = offset >> MEM_MAP_PAGE_BITS;
+  uint32_t last  = (offset + size - 1) >> MEM_MAP_PAGE_BITS;
+  if (last >= backing->n_pages) last = backing->n_pages - 1;
+  for (uint32_t page = first; page <= last; page++) {
+    if (backing->dirty[page]) continue;
+    backing->dirty[page] = 1;
+    backing->touched[backing->n_touched++] = page;
+  }
+}
+
+// NOTE: copies size bytes into the backing at offset
+void mem_backing_write(MemBacking* backing, uint32_t offset, const uint8_t* data, uint32_t size) {
+  memcpy(backing->host + offset, data, size);
+  mem_backing_mark(backing, offset, size);
+}
+
+// NOTE: the backing holds only old_size bytes at offset 0: they are replaced by data, whatever is left of them
+// past size is zeroed and no other page is touched
+void mem_backing_rewrite(MemBacking* backing, const uint8_t* data, uint32_t size, uint32_t old_size) {
+  mem_backing_write(backing, 0, data, size);
+  if (old_size > size) memset(backing->host + size, 0, old_size - size);
+}
+
+void mem_backing_clear(MemBacking* backing) {
+  if (backing->is_mmap && backing->n_touched > MEM_BACKING_DONTNEED_PAGES) {
+    madvise(backing->host, (size_t)backing->n_pages << MEM_MAP_PAGE_BITS, MADV_DONTNEED);
+    memset(backing->dirty, 0, backing->n_pages);
+  }
+  else for (uint32_t i = 0; i < backing->n_touched; i++) {
+    uint32_t page = backing->touched[i];
+    memset(backing->host + ((size_t)page << MEM_MAP_PAGE_BITS), 0, MEM_MAP_PAGE_SIZE);
+    backing->dirty[page] = 0;
+  }
+  backing->n_touched = 0;
+}
+
+// NOTE: dst becomes a copy of src, only the pages touched in either of them are written
+void mem_backing_copy(MemBacking* dst, const MemBacking* src) {
+  mem_backing_clear(dst);
+  for (uint32_t i = 0; i < src->n_touched; i++) {
+    uint32_t page = src->touched[i];
+    if (page >= dst->n_pages) continue;
+    size_t offset = (size_t)page << MEM_MAP_PAGE_BITS;
+    memcpy(dst->host + offset, src->host + offset, MEM_MAP_PAGE_SIZE);
+    mem_backing_mark(dst, offset, MEM_MAP_PAGE_SIZE);
+  }
+}
+
+/*
+  Cache lines of a guest region written by any model since the last comparison of the models: every
+  writer marks the lines it changes (one byte per line, plus the list of them), so a comparison costs the
+  stores executed since the previous one instead of the size of the region. is_all asks for one comparison
+  of the whole region, after the memories were changed behind the writers (restore, state loads).
+*/
+#define MEM_DIRTY_LINE_BITS (6)
+#define MEM_DIRTY_LINE_SIZE (1u << MEM_DIRTY_LINE_BITS)
+
+struct MemDirty {
+  uint32_t  size;
+  uint32_t  n_lines;
+  uint8_t*  dirty;
+  uint32_t* lines;
+  uint32_t  n_dirty;
+  bool      is_all;
+};
+
+void mem_dirty_init(MemDirty* tracker, uint32_t size) {
+  tracker->size    = size;
+  tracker->n_lines = (size + MEM_DIRTY_LINE_SIZE - 1) >> MEM_DIRTY_LINE_BITS;
+  tracker->dirty   = (uint8_t*) calloc(tracker->n_lines, sizeof(uint8_t));
+  tracker->lines   = (uint32_t*)calloc(tracker->n_lines, sizeof(uint32_t));
+  tracker->n_dirty = 0;
+  tracker->is_all  = false;
+}
+
+void mem_dirty_free(MemDirty* tracker) {
+  free(tracker->dirty);
+  free(tracker->lines);
+  *tracker = {};
+}
+
+// NOTE: offset+size may reach past the region, it is clamped to it
+static inline void mem_dirty_mark(MemDirty* tracker, uint32_t offset, uint32_t size) {
+  if (!size || offset >= tracker->size) return;
+  uint32_t first = offset >> MEM_DIRTY_LINE_BITS;
+  uint32_t last  = (offset + size - 1) >> MEM_DIRTY_LINE_BITS;
+  if (last >= tracker->n_lines) last = tracker->n_lines - 1;
+  for (uint32_t line = first; line <= last; line++) {
+    if (tracker->dirty[line]) continue;
+    tracker->dirty[line] = 1;
+    tracker->lines[tracker->n_dirty++] = line;
+  }
+}
+
+void mem_dirty_all(MemDirty* tracker) {
+  tracker->is_all = true;
+}
+
+void mem_dirty_clear(MemDirty* tracker) {
+  if (tracker->is_all) memset(tracker->dirty, 0, tracker->n_lines);
+  else for (uint32_t i = 0; i < tracker->n_dirty; i++) tracker->dirty[tracker->lines[i]] = 0;
+  tracker->n_dirty = 0;
+  tracker->is_all  = false;
+}
+
+// NOTE: a and b are host copies of the region; true if they are equal in every dirty line
+bool mem_dirty_equal(const MemDirty* tracker, const uint8_t* a, const uint8_t* b) {
+  if (tracker->is_all) return memcmp(a, b, tracker->size) == 0;
+  for (uint32_t i = 0; i < tracker->n_dirty; i++) {
+    uint32_t offset = tracker->lines[i] << MEM_DIRTY_LINE_BITS;
+    uint32_t size   = tracker->size - offset < MEM_DIRTY_LINE_SIZE ? tracker->size - offset : MEM_DIRTY_LINE_SIZE;
+    if (memcmp(a + offset, b + offset, size) != 0) return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+  Diff of two memory images for failure reports. The images are scanned MEMDIFF_STRIDE bytes at a time
+  with GCC vector extensions (SSE2/AVX2/AVX-512 depending on the target); only strides that differ are
+  looked at word by word. Differing bytes closer than MEMDIFF_GAP are coalesced into one range, the first
+  MEMDIFF_MAX_RANGES ranges are kept and the rest is only counted, so a report stays a few lines long
+  however much of the memory differs.
+
+  The vsoc SDRAM is an array of uint16_t: on the little endian host its bytes are in guest order and it
+  is scanned as bytes like the gold and vcpu images.
+*/
+#define MEMDIFF_VECTOR      (64)
+#define MEMDIFF_STRIDE      (4 * MEMDIFF_VECTOR)
+#define MEMDIFF_GAP         (64)
+#define MEMDIFF_MAX_RANGES  (16)
+#define MEMDIFF_MAX_WORDS   (4)
+
+typedef uint64_t Memdiff_u64 __attribute__((vector_size(MEMDIFF_VECTOR)));
+
+struct MemdiffRange {
+  uint32_t start;
+  uint32_t end;     // NOTE: one past the last differing byte
+  uint32_t n_bytes;
+};
+
+struct Memdiff {
+  MemdiffRange ranges[MEMDIFF_MAX_RANGES];
+  uint32_t     n_ranges;
+  uint32_t     n_ranges_total;
+  uint64_t     n_bytes;
+  MemdiffRange current;
+};
+
+static inline Memdiff_u64 memdiff_xor(const uint8_t* a, const uint8_t* b) {
+  Memdiff_u64 va, vb;
+  memcpy(&va, a, sizeof(va));
+  memcpy(&vb, b, sizeof(vb));
+  return va ^ vb;
+}
+
+static inline bool memdiff_is_zero(const Memdiff_u64& v) {
+  uint64_t any = 0;
+  for (uint32_t i = 0; i < MEMDIFF_VECTOR / sizeof(uint64_t); i++) any |= v[i];
+  return any == 0;
+}
+
+// NOTE: the current range is kept once it is complete
+static void memdiff_flush(Memdiff* diff) {
+  if (diff->n_ranges_total && diff->n_ranges < MEMDIFF_MAX_RANGES) {
+    diff->ranges[diff->n_ranges++] = diff->current;
+  }
+}
+
+// NOTE: offsets come in increasing order
+static void memdiff_byte(Memdiff* diff, uint32_t offset) {
+  diff->n_bytes++;
+  if (diff->n_ranges_total && offset - diff->current.end < MEMDIFF_GAP) {
+    diff->current.end = offset + 1;
+    diff->current.n_bytes++;
+    return;
+  }
+  memdiff_flush(diff);
+  diff->current = {offset, offset + 1, 1};
+  diff->n_ranges_total++;
+}
+
+// NOTE: bytes of a differing 8 byte word, x is the xor of the two words
+static void memdiff_word(Memdiff* diff, uint32_t offset, uint64_t x) {
+  while (x) {
+    uint32_t byte = __builtin_ctzll(x) / 8;
+    memdiff_byte(diff, offset + byte);
+    x &= ~(0xffull << 8*byte);
+  }
+}
+
+void memdiff_scan(Memdiff* diff, const uint8_t* a, const uint8_t* b, uint32_t size) {
+  *diff = {};
+  uint32_t offset = 0;
+  for (; size - offset >= MEMDIFF_STRIDE; offset += MEMDIFF_STRIDE) {
+    Memdiff_u64 x0 = memdiff_xor(a + offset + 0*MEMDIFF_VECTOR, b + offset + 0*MEMDIFF_VECTOR);
+    Memdiff_u64 x1 = memdiff_xor(a + offset + 1*MEMDIFF_VECTOR, b + offset + 1*MEMDIFF_VECTOR);
+    Memdiff_u64 x2 = memdiff_xor(a + offset + 2*MEMDIFF_VECTOR, b + offset + 2*MEMDIFF_VECTOR);
+    Memdiff_u64 x3 = memdiff_xor(a + offset + 3*MEMDIFF_VECTOR, b + offset + 3*MEMDIFF_VECTOR);
+    if (memdiff_is_zero(x0 | x1 | x2 | x3)) continue;
+    for (uint32_t i = 0; i < MEMDIFF_STRIDE; i += sizeof(uint64_t)) {
+      uint64_t wa, wb;
+      memcpy(&wa, a + offset + i, sizeof(wa));
+      memcpy(&wb, b + offset + i, sizeof(wb));
+      memdiff_word(diff, offset + i, wa ^ wb);
+    }
+  }
+  for (; offset < size; offset++) {
+    if (a[offset] != b[offset]) memdiff_byte(diff, offset);
+  }
+  memdiff_flush(diff);
+}
+
+// NOTE: prints where r and g differ, base is the guest address of their first byte and size is a multiple of 4;
+// true if they are equal
+bool memdiff_report(uint64_t sim_time, uint32_t base, const uint8_t* r, const uint8_t* g, uint32_t size) {
+  Memdiff diff;
+  memdiff_scan(&diff, r, g, size);
+  if (!diff.n_bytes) return true;
+
+  printf("[FAILED] Test Failed at time %lu. memory mismatch: %lu bytes in %u ranges\n", sim_time, diff.n_bytes, diff.n_ranges_total);
+  for (uint32_t i = 0; i < diff.n_ranges; i++) {
+    MemdiffRange* range = &diff.ranges[i];
+    printf("  0x%08x..0x%08x: %u bytes differ\n", base + range->start, base + range->end - 1, range->n_bytes);
+    uint32_t n_words = 0;
+    uint32_t offset  = range->start & ~3u;
+    for (; offset < range->end && n_words < MEMDIFF_MAX_WORDS; offset += 4) {
+      uint32_t rw, gw;
+      memcpy(&rw, r + offset, sizeof(rw));
+      memcpy(&gw, g + offset, sizeof(gw));
+      if (rw == gw) continue;
+      printf("    0x%08x: r = 0x%08x vs g = 0x%08x\n", base + offset, rw, gw);
+      n_words++;
+    }
+    if (offset < range->end) printf("    ...\n");
+  }
+  if (diff.n_ranges_total > diff.n_ranges) {
+    printf("  ... %u more ranges\n", diff.n_ranges_total - diff.n_ranges);
+  }
+  return false;
+}
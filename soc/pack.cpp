@@ -0,0 +1,103 @@
+// NOTE: random_program for packed images: the init of x13..x15 is the one random_bounded_instruction expects and
+// x15 is pc relative, a program still exits to its own gap when it is moved to the front of the next image
+void random_bounded_program(TestBench* tb, uint64_t seed, uint32_t* insts) {
+  uint32_t inst_count = 0;
+  tb->random_gen->seed(seed);
+  for (uint32_t rd = 1; rd < RANDOM_BOUNDED_REG_SDRAM; rd++) {
+    uint32_t mem_start_choice[3] = {FLASH_START >> 12, MEM_START >> 12, UART_START >> 12};
+    uint32_t mem_size_choice[3]  = {FLASH_SIZE, MEM_SIZE, UART_SIZE };
+    uint8_t  mem_rand            = random_range(tb->random_gen, 0, 2);
+    uint32_t base = mem_start_choice[mem_rand] + (mem_size_choice[mem_rand] >> 12) / 2;
+    insts[inst_count++] = lui(base, rd);
+    insts[inst_count++] = addi(random_bits(tb->random_gen, 12), rd, rd);
+  }
+  insts[inst_count++] = lui((MEM_START >> 12) + (MEM_SIZE >> 12) / 2, RANDOM_BOUNDED_REG_SDRAM);
+  insts[inst_count++] = addi(random_bits(tb->random_gen, 12), RANDOM_BOUNDED_REG_SDRAM, RANDOM_BOUNDED_REG_SDRAM);
+  insts[inst_count++] = lui((FLASH_START >> 12) + (FLASH_SIZE >> 12) / 2, RANDOM_BOUNDED_REG_FLASH);
+  insts[inst_count++] = addi(random_bits(tb->random_gen, 12), RANDOM_BOUNDED_REG_FLASH, RANDOM_BOUNDED_REG_FLASH);
+  uint32_t exit_offset = 4 * (tb->n_insts - inst_count);
+  insts[inst_count++] = auipc((exit_offset + 0x800) >> 12, RANDOM_BOUNDED_REG_EXIT);
+  insts[inst_count++] = addi(exit_offset & 0xfff, RANDOM_BOUNDED_REG_EXIT, RANDOM_BOUNDED_REG_EXIT);
+  while (inst_count < tb->n_insts) {
+    insts[inst_count++] = random_bounded_instruction(tb->random_gen, tb->inst_flags);
+  }
+}
+
+// NOTE: the programs of the previous image from first on did not start, they lead the new one and only the
+// rest is generated; the gaps depend only on n_programs
+void random_pack_program(TestBench* tb, RandomPack* pack, uint32_t n_programs, uint32_t first, uint64_t* seed) {
+  uint32_t n_kept = pack->n_programs - first;
+  for (uint32_t k = 0; k < n_kept; k++) {
+    pack->seeds[k] = pack->seeds[first + k];
+    memcpy(tb->insts + k * pack->stride, tb->insts + (first + k) * pack->stride, tb->n_insts * sizeof(uint32_t));
+  }
+  for (uint32_t k = n_kept; k < n_programs; k++) {
+    pack->seeds[k] = *seed;
+    *seed = hash_uint64_t(*seed);
+    random_bounded_program(tb, pack->seeds[k], tb->insts + k * pack->stride);
+  }
+  if (n_programs != pack->n_programs) {
+    for (uint32_t k = 0; k < n_programs; k++) {
+      uint32_t start = k * pack->stride;
+      for (uint32_t offset = tb->n_insts; offset < pack->stride; offset++) {
+        tb->insts[start + offset] = jump(4 * ((k + 1) * pack->stride - (start + offset)));
+      }
+    }
+    tb->insts[n_programs * pack->stride] = ebreak();
+    tb->flash_size = 4 * (n_programs * pack->stride + 1);
+  }
+  pack->n_programs = n_programs;
+}
+
+bool test_random_pack(TestBench* tb, uint64_t seed) {
+  RandomPack pack = {};
+  pack.stride = tb->n_insts + PACK_GAP;
+  // NOTE: the image stays below the middle of the flash, where the random base registers point
+  uint32_t max_programs = ((FLASH_SIZE/2 - 4096) / 4 - 1) / pack.stride;
+  uint32_t n_pack = tb->pack;
+  if (n_pack > max_programs) {
+    printf("[WARNING] pack: at most %u programs of %u instructions fit in the flash image: packing %u\n", max_programs, tb->n_insts, max_programs);
+    n_pack = max_programs;
+  }
+  pack.seeds = new uint64_t[n_pack];
+  delete[] tb->insts;
+  tb->insts = new uint32_t[n_pack * pack.stride + 1];
+  tb->random_pack = &pack;
+
+  bool is_tests_success = true;
+  uint64_t tests_passed = 0;
+  uint64_t n_images     = 0;
+  uint32_t first        = 0;
+  do {
+    uint64_t tests_left = tb->max_tests > tests_passed ? tb->max_tests - tests_passed : 1;
+    uint32_t n_programs = tests_left < n_pack ? tests_left : n_pack;
+    random_pack_program(tb, &pack, n_programs, first, &seed);
+    pack.current          = 0;
+    pack.current_instrets = 0;
+    if (tb->verbose >= VerboseInfo4) {
+      printf("======== SEED:%" PRIu64 " ===== %" PRIu64 "/%" PRIu64 " pack of %u =========\n", pack.seeds[0], tests_passed, tb->max_tests, pack.n_programs);
+    }
+
+    is_tests_success &= test_instructions(tb);
+    n_images++;
+    if (is_tests_success) {
+      tests_passed += pack.current + 1;
+      first = pack.current + 1;
+    }
+    else {
+      // NOTE: an image is the chain of seeds from its first one, seed and pack rebuild it
+      printf("[FAILED] SEED:%" PRIu64 ": program %u of the pack of SEED:%" PRIu64 "\n", pack.seeds[pack.current], pack.current, pack.seeds[0]);
+      uint32_t start = pack.current * pack.stride;
+      for (uint32_t i = 0; i < tb->n_insts; i++) {
+        printf("[0x%08x] 0x%08x ", 4*(start + i), tb->insts[start + i]);
+        print_instruction(tb->insts[start + i]);
+      }
+    }
+  } while (is_tests_success && tests_passed < tb->max_tests);
+
+  printf("[INFO] pack finished: %" PRIu64 " programs in %" PRIu64 " images, %.1f programs per image\n", tests_passed, n_images, n_images ? (double)tests_passed / n_images : 0.0);
+  printf("Tests results: %" PRIu64 " / %" PRIu64 " have passed\n", tests_passed, tb->max_tests);
+  tb->random_pack = NULL;
+  delete[] pack.seeds;
+  return is_tests_success;
+}
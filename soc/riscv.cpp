@@ -89,6 +89,89 @@ uint32_t take_bits_range(uint32_t bits, uint32_t from, uint32_t to) {
   return (bits & mask) >> from;
 }
 
+/*
+  Branchless field and immediate kernels. The sign of an immediate comes from an arithmetic shift of
+  bit 31, the other bits are shifted and masked into place. IMM_FORMATS is built at compile time and
+  maps the opcode to the only immediate it uses, so inst_info() and the Golden Model's decode() build
+  just that one.
+*/
+enum ImmFormat : uint8_t {
+  ImmNone,
+  ImmI,
+  ImmU,
+  ImmS,
+  ImmJ,
+  ImmB,
+};
+
+static constexpr uint32_t inst_opcode(uint32_t inst)   { return inst & 0x7f; }
+static constexpr uint32_t inst_rd(uint32_t inst)       { return (inst >> 7) & 0x1f; }
+static constexpr uint32_t inst_funct3(uint32_t inst)   { return (inst >> 12) & 0x7; }
+static constexpr uint32_t inst_rs1(uint32_t inst)      { return (inst >> 15) & 0x1f; }
+static constexpr uint32_t inst_rs2(uint32_t inst)      { return (inst >> 20) & 0x1f; }
+static constexpr uint32_t inst_funct7(uint32_t inst)   { return inst >> 25; }
+// NOTE: inst[31] copied to bit 31-shift and above
+static constexpr uint32_t inst_sign_shr(uint32_t inst, uint32_t shift) { return (uint32_t)((int32_t)inst >> shift); }
+
+static constexpr uint32_t imm_i(uint32_t inst) { return inst_sign_shr(inst, 20); }
+static constexpr uint32_t imm_u(uint32_t inst) { return inst & 0xfffff000u; }
+static constexpr uint32_t imm_s(uint32_t inst) {
+  return (inst_sign_shr(inst, 20) & ~0x1fu) | ((inst >> 7) & 0x1f);
+}
+static constexpr uint32_t imm_j(uint32_t inst) {
+  return (inst_sign_shr(inst, 11) & ~0xfffffu) | (inst & 0xff000u) | ((inst >> 9) & 0x800u) | ((inst >> 20) & 0x7feu);
+}
+// NOTE: inverse of imm_j, the immediate bits in their instruction positions
+static constexpr uint32_t imm_j_encode(uint32_t imm) {
+  return ((imm & 0x100000u) << 11) | ((imm & 0x7feu) << 20) | ((imm & 0x800u) << 9) | (imm & 0xff000u);
+}
+static constexpr uint32_t imm_b_encode(uint32_t imm) {
+  return ((imm & 0x1000u) << 19) | ((imm & 0x7e0u) << 20) | ((imm & 0x1eu) << 7) | ((imm & 0x800u) >> 4);
+}
+static constexpr uint32_t imm_b(uint32_t inst) {
+  return (inst_sign_shr(inst, 19) & ~0xfffu) | ((inst << 4) & 0x800u) | ((inst >> 20) & 0x7e0u) | ((inst >> 7) & 0x1eu);
+}
+
+static inline uint32_t imm_decode(ImmFormat format, uint32_t inst) {
+  switch (format) {
+    case ImmI:    return imm_i(inst);
+    case ImmU:    return imm_u(inst);
+    case ImmS:    return imm_s(inst);
+    case ImmJ:    return imm_j(inst);
+    case ImmB:    return imm_b(inst);
+    case ImmNone: return 0;
+  }
+  return 0;
+}
+
+struct ImmFormats {
+  ImmFormat format[128];
+};
+
+static constexpr ImmFormats imm_formats_build() {
+  ImmFormats table = {};
+  table.format[OPCODE_LUI]      = ImmU;
+  table.format[OPCODE_AUIPC]    = ImmU;
+  table.format[OPCODE_JAL]      = ImmJ;
+  table.format[OPCODE_JALR]     = ImmI;
+  table.format[OPCODE_BRANCH]   = ImmB;
+  table.format[OPCODE_LOAD]     = ImmI;
+  table.format[OPCODE_STORE]    = ImmS;
+  table.format[OPCODE_CALC_IMM] = ImmI;
+  return table;
+}
+
+static constexpr ImmFormats IMM_FORMATS = imm_formats_build();
+
+static_assert(imm_i(0xfff00093u) == 0xffffffffu, "addi x1, x0, -1");
+static_assert(imm_s(0xfe112e23u) == 0xfffffffcu, "sw x1, -4(x2)");
+static_assert(imm_b(0xfe000ee3u) == 0xfffffffcu, "beq x0, x0, -4");
+static_assert(imm_j(0x8000006fu) == 0xfff00000u, "jal x0, -1048576");
+static_assert(imm_j(imm_j_encode(0xfffffffcu) | 0x6fu) == 0xfffffffcu, "jal x0, -4");
+static_assert(imm_j(imm_j_encode(0x000ffffeu) | 0x6fu) == 0x000ffffeu, "jal x0, 1048574");
+static_assert(imm_b(imm_b_encode(0xfffffffcu) | 0x63u) == 0xfffffffcu, "beq x0, x0, -4");
+static_assert(imm_b(imm_b_encode(0x00000ffeu) | 0x63u) == 0x00000ffeu, "beq x0, x0, 4094");
+
 uint32_t r_type(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode) {
   uint32_t inst = (funct7 << 24) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
   return inst;
@@ -304,6 +387,15 @@ uint32_t li(uint32_t imm, uint32_t reg_dest) {
   return addi(imm, 0, reg_dest);
 }
 
+uint32_t nop() {
+  return addi(0, 0, 0);
+}
+
+// NOTE: jal x0 to pc + offset
+uint32_t jump(uint32_t offset) {
+  return jal(imm_j_encode(offset) >> 12, 0);
+}
+
 
 struct InstInfo {
   uint8_t reg_dest;
@@ -313,38 +405,18 @@ struct InstInfo {
   uint8_t opcode;
   uint8_t funct3;
   uint8_t funct7;
-  uint32_t i_imm;
-  uint32_t u_imm;
-  uint32_t s_imm;
-  uint32_t j_imm;
-  uint32_t b_imm;
   uint8_t reg_write_enable;
 };
 
 InstInfo inst_info(uint32_t inst) {
   InstInfo out = {};
-  out.opcode = take_bits_range(inst, 0, 6);
-  out.reg_dest = take_bits_range(inst, 7, 11);
-  out.funct3 = take_bits_range(inst, 12, 14);
-  out.funct7 = take_bits_range(inst, 25, 31);
-  out.reg_src1 = take_bits_range(inst, 15, 19);
-  out.reg_src2 = take_bits_range(inst, 20, 24);
-  uint8_t sign = take_bit(inst, 31);
-
-  if (sign) out.i_imm = (~0u << 12) | take_bits_range(inst, 20, 31);
-  else      out.i_imm = ( 0u << 12) | take_bits_range(inst, 20, 31);
-
-  out.u_imm = take_bits_range(inst, 12, 31) << 12;
-
-  if (sign) out.s_imm = (~0u << 12) | take_bits_range(inst, 25, 31) << 5 | take_bits_range(inst, 7, 11);
-  else      out.s_imm = ( 0u << 12) | take_bits_range(inst, 25, 31) << 5 | take_bits_range(inst, 7, 11);
-
-  if (sign) out.j_imm = (~0u << 20) | take_bits_range(inst, 12, 19) << 12 | take_bit(inst, 20) << 11 | take_bits_range(inst, 21, 30) << 1 | 0b0;
-  else      out.j_imm = ( 0u << 20) | take_bits_range(inst, 12, 19) << 12 | take_bit(inst, 20) << 11 | take_bits_range(inst, 21, 30) << 1 | 0b0;
-
-  if (sign) out.b_imm = (~0u << 12) | take_bit(inst, 7) << 11 | take_bits_range(inst, 25, 30) << 5 | take_bits_range(inst, 8, 11) << 1 | 0b0;
-  else      out.b_imm = ( 0u << 12) | take_bit(inst, 7) << 11 | take_bits_range(inst, 25, 30) << 5 | take_bits_range(inst, 8, 11) << 1 | 0b0;
-
+  out.opcode   = inst_opcode(inst);
+  out.reg_dest = inst_rd(inst);
+  out.funct3   = inst_funct3(inst);
+  out.funct7   = inst_funct7(inst);
+  out.reg_src1 = inst_rs1(inst);
+  out.reg_src2 = inst_rs2(inst);
+  out.imm      = imm_decode(IMM_FORMATS.format[out.opcode], inst);
   return out;
 }
 
@@ -352,17 +424,17 @@ void print_instruction(uint32_t inst) {
   InstInfo info = inst_info(inst);
   switch (info.opcode) {
     case OPCODE_LUI: {
-      uint32_t imm = info.u_imm >> 12;
+      uint32_t imm = info.imm >> 12;
       printf("lui   imm=0x%x rd=%2u\n", imm, info.reg_dest);
     } break;
     case OPCODE_AUIPC: {
-      printf("auipc imm=0x%x rd=%2u\n", info.u_imm, info.reg_dest);
+      printf("auipc imm=0x%x rd=%2u\n", info.imm, info.reg_dest);
     } break;
     case OPCODE_JAL: {
-      printf("jal   imm=0x%x rd=%2u\n", info.j_imm, info.reg_src1, info.reg_dest);
+      printf("jal   imm=0x%x rd=%2u\n", info.imm, info.reg_dest);
     } break;
     case OPCODE_JALR: {
-      printf("jalr  imm=0x%x rs1=%2u rd=%2u\n", info.i_imm, info.reg_src1, info.reg_dest);
+      printf("jalr  imm=0x%x rs1=%2u rd=%2u\n", info.imm, info.reg_src1, info.reg_dest);
     } break;
     case OPCODE_BRANCH: {
       switch (info.funct3) {
@@ -373,7 +445,7 @@ void print_instruction(uint32_t inst) {
         case FUNCT3_BLTU:  printf("bltu");  break;
         case FUNCT3_BGEU:  printf("bgeu");  break;
       }
-      printf("  imm=%5i rs2=%2u rs1=%2u\n", info.b_imm, info.reg_src2, info.reg_src1);
+      printf("  imm=%5i rs2=%2u rs1=%2u\n", info.imm, info.reg_src2, info.reg_src1);
     } break;
     case OPCODE_LOAD: {
       switch (info.funct3) {
@@ -383,7 +455,7 @@ void print_instruction(uint32_t inst) {
         case FUNCT3_LBU:  printf("lbu");  break;
         case FUNCT3_LHU:  printf("lhu");  break;
       }
-      printf("   imm=%5i rs1=%2u rd=%2u\n", info.i_imm, info.reg_src1, info.reg_dest);
+      printf("   imm=%5i rs1=%2u rd=%2u\n", info.imm, info.reg_src1, info.reg_dest);
     } break;
     case OPCODE_STORE: {
       switch (info.funct3) {
@@ -391,7 +463,7 @@ void print_instruction(uint32_t inst) {
         case FUNCT3_SH:   printf("sh");  break;
         case FUNCT3_SW:   printf("sw");  break;
       }
-      printf("    imm=%5i rs2=%2u rs1=%2u\n", info.s_imm, info.reg_src2, info.reg_src1);
+      printf("    imm=%5i rs2=%2u rs1=%2u\n", info.imm, info.reg_src2, info.reg_src1);
     } break;
     case OPCODE_CALC_IMM: {
       switch (info.funct3) {
@@ -408,7 +480,7 @@ void print_instruction(uint32_t inst) {
           else            printf("srai ");
         } break;
       }
-      printf(" imm=%5i rs1=%2u rd=%2u\n", info.i_imm, info.reg_src1, info.reg_dest);
+      printf(" imm=%5i rs1=%2u rd=%2u\n", info.imm, info.reg_src1, info.reg_dest);
     } break;
     case OPCODE_CALC_REG: {
       switch (info.funct3) {
@@ -550,3 +622,54 @@ uint32_t random_instruction(std::mt19937* gen, uint32_t flags) {
   }
   return inst;
 }
+
+/*
+  Random instructions that can not fault, for programs packed back to back where a fault would end the whole
+  image. They write x0..x12 only: x13 and x14 keep the SDRAM and flash bases that loads and stores go through
+  (stores only to SDRAM) and x15 keeps the address right after the program. Jumps and branches go forward by
+  at most 2^RANDOM_BOUNDED_FORWARD_BITS words and jalr goes forward from x15, so the program either runs to its
+  end or leaves it forward. System instructions are not generated.
+*/
+#define RANDOM_BOUNDED_REG_SDRAM     (13)
+#define RANDOM_BOUNDED_REG_FLASH     (14)
+#define RANDOM_BOUNDED_REG_EXIT      (15)
+#define RANDOM_BOUNDED_FORWARD_BITS  (9)
+
+// NOTE: 1 to 2^RANDOM_BOUNDED_FORWARD_BITS words, short jumps are as likely as long ones
+static uint32_t random_forward_words(std::mt19937* gen) {
+  return 1 + random_bits(gen, random_range(gen, 0, RANDOM_BOUNDED_FORWARD_BITS + 1));
+}
+
+uint32_t random_bounded_instruction(std::mt19937* gen, uint32_t flags) {
+  if (!(flags & ~InstFlag_System)) return nop();
+  uint32_t inst = random_instruction(gen, flags & ~InstFlag_System);
+  uint32_t rd   = random_range(gen, 0, RANDOM_BOUNDED_REG_SDRAM);
+  uint32_t rs1  = random_bits(gen, 4);
+  uint32_t rs2  = random_bits(gen, 4);
+  uint32_t funct3 = take_bits_range(inst, 12, 14);
+  switch (inst & 0x7f) {
+    case OPCODE_LUI:
+    case OPCODE_AUIPC:
+    case OPCODE_CALC_IMM:
+    case OPCODE_CALC_REG: {
+      inst = (inst & ~(0x1fu << 7)) | (rd << 7);
+    } break;
+    case OPCODE_JAL: {
+      inst = jal(imm_j_encode(4 * random_forward_words(gen)) >> 12, rd);
+    } break;
+    case OPCODE_JALR: {
+      inst = jalr(4 * (random_forward_words(gen) - 1), RANDOM_BOUNDED_REG_EXIT, rd);
+    } break;
+    case OPCODE_BRANCH: {
+      inst = imm_b_encode(4 * random_forward_words(gen)) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | OPCODE_BRANCH;
+    } break;
+    case OPCODE_LOAD: {
+      uint32_t base = random_bits(gen, 1) ? RANDOM_BOUNDED_REG_SDRAM : RANDOM_BOUNDED_REG_FLASH;
+      inst = i_type(random_bits(gen, 12), base, funct3, rd, OPCODE_LOAD);
+    } break;
+    case OPCODE_STORE: {
+      inst = s_type(random_bits(gen, 12), rs2, RANDOM_BOUNDED_REG_SDRAM, funct3, OPCODE_STORE);
+    } break;
+  }
+  return inst;
+}
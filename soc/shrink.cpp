@@ -0,0 +1,155 @@
+/*
+  Shrinking of a failed random program (ddmin): chunks of its instructions are replaced by nops as long as
+  the program still fails, down to a program where no single instruction can be dropped. Nops keep the
+  addresses of the rest, so its jumps and branches land where they did. Every candidate starts from the
+  post-reset snapshot of the models (vsoc_reset restores it and clears only the SDRAM pages the last one
+  wrote) with the random generator state that generating the program left, so the memory delays are
+  drawn as in the failed run. The candidates of a round run on max(jobs, 1) forked workers and
+  the first failing one in the round order is taken, whatever the scheduling.
+*/
+struct ShrinkShared {
+  std::atomic<uint32_t> next;
+  std::atomic<uint32_t> failed; // NOTE: index of the first failed candidate, n_candidates if none
+};
+
+// NOTE: candidates are n_candidates programs of n_insts instructions, returns the index of the first failing one
+uint32_t shrink_round(TestBench* tb, const std::mt19937& gen, const uint32_t* candidates, uint32_t n_candidates) {
+  ShrinkShared* shared = (ShrinkShared*)mmap(NULL, sizeof(ShrinkShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) return n_candidates;
+  shared->next.store(0);
+  shared->failed.store(n_candidates);
+
+  fflush(stdout);
+  uint32_t n_workers = tb->jobs > 1 ? tb->jobs : 1;
+  if (n_workers > n_candidates) n_workers = n_candidates;
+  pid_t* pids = new pid_t[n_workers];
+  uint32_t n_started = 0;
+  for (; n_started < n_workers; n_started++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      if (!freopen("/dev/null", "w", stdout)) _exit(1);
+      uint32_t c;
+      while ((c = shared->next.fetch_add(1)) < shared->failed.load()) {
+        memcpy(tb->insts, candidates + (size_t)c * tb->n_insts, tb->n_insts * sizeof(uint32_t));
+        *tb->random_gen = gen;
+        if (!test_instructions(tb)) {
+          uint32_t failed = shared->failed.load();
+          while (c < failed && !shared->failed.compare_exchange_weak(failed, c)) {}
+        }
+      }
+      fflush(stdout);
+      _exit(0);
+    }
+    if (pid < 0) break;
+    pids[n_started] = pid;
+  }
+  // NOTE: a crashed worker loses its candidate, it is taken as passed
+  for (uint32_t w = 0; w < n_started; w++) {
+    waitpid(pids[w], NULL, 0);
+  }
+  delete[] pids;
+  uint32_t failed = n_started ? shared->failed.load() : n_candidates;
+  munmap(shared, sizeof(ShrinkShared));
+  return failed;
+}
+
+// NOTE: the command line of this run for one test of seed, that runs the program at shrink_path
+std::string shrink_command(TestBench* tb, uint64_t seed) {
+  std::ostringstream command;
+  command << tb->argv[0];
+  for (int i = 1; i < tb->argc; i++) {
+    const char* arg = tb->argv[i];
+    if (!strcmp(arg, "shrink") || !strcmp(arg, "replay") || !strcmp(arg, "jobs") || !strcmp(arg, "seed") || !strcmp(arg, "pack")) {
+      i++;
+      continue;
+    }
+    if (!strcmp(arg, "random")) {
+      command << " random 1";
+      i++;
+      continue;
+    }
+    command << " " << arg;
+  }
+  command << " seed " << seed << " replay " << tb->shrink_path;
+  return command.str();
+}
+
+bool shrink_program(TestBench* tb, uint64_t seed, const uint32_t* failed_insts) {
+  uint32_t n_insts = tb->n_insts;
+  std::vector<uint32_t> program(failed_insts, failed_insts + n_insts);
+  random_program(tb, seed, tb->insts);
+  std::mt19937 gen = *tb->random_gen;
+
+  if (shrink_round(tb, gen, program.data(), 1) != 0) {
+    printf("[WARNING] shrink: SEED:%lu does not fail again: not shrinking it\n", seed);
+    return false;
+  }
+
+  std::vector<uint32_t> items;
+  for (uint32_t i = 0; i < n_insts; i++) {
+    if (program[i] != nop()) items.push_back(i);
+  }
+  std::vector<uint32_t> candidates;
+  uint32_t n_chunks = 2;
+  uint32_t n_rounds = 0;
+  uint64_t n_runs   = 1;
+  auto chunk_begin = [&](uint32_t s) { return (uint32_t)((uint64_t)s * items.size() / n_chunks); };
+  while (items.size() >= 2) {
+    if (n_chunks > items.size()) n_chunks = items.size();
+    // NOTE: the subsets first, then the complements; for 2 chunks they are the same programs
+    uint32_t n_candidates = n_chunks == 2 ? 2 : 2 * n_chunks;
+    candidates.resize((size_t)n_candidates * n_insts);
+    for (uint32_t c = 0; c < n_candidates; c++) {
+      uint32_t* candidate = candidates.data() + (size_t)c * n_insts;
+      memcpy(candidate, program.data(), n_insts * sizeof(uint32_t));
+      uint32_t s = c % n_chunks;
+      for (uint32_t k = 0; k < items.size(); k++) {
+        bool is_in_chunk = chunk_begin(s) <= k && k < chunk_begin(s + 1);
+        if (is_in_chunk == (c >= n_chunks)) candidate[items[k]] = nop();
+      }
+    }
+    uint32_t failed = shrink_round(tb, gen, candidates.data(), n_candidates);
+    n_rounds++;
+    n_runs += failed < n_candidates ? failed + 1 : n_candidates;
+
+    if (failed < n_candidates) {
+      uint32_t s = failed % n_chunks;
+      std::vector<uint32_t> kept;
+      for (uint32_t k = 0; k < items.size(); k++) {
+        bool is_in_chunk = chunk_begin(s) <= k && k < chunk_begin(s + 1);
+        if (is_in_chunk == (failed < n_chunks)) kept.push_back(items[k]);
+      }
+      memcpy(program.data(), candidates.data() + (size_t)failed * n_insts, n_insts * sizeof(uint32_t));
+      items = kept;
+      n_chunks = failed < n_chunks ? 2 : std::max(n_chunks - 1, 2u);
+    }
+    else if (n_chunks == items.size()) {
+      break;
+    }
+    else {
+      n_chunks = std::min<uint32_t>(2 * n_chunks, items.size());
+    }
+  }
+
+  printf("[INFO] shrink: %lu of %u instructions left after %u rounds and %lu runs\n", items.size(), n_insts, n_rounds, n_runs);
+  for (uint32_t i : items) {
+    printf("[0x%08x] 0x%08x ", 4*i, program[i]);
+    print_instruction(program[i]);
+  }
+  FILE* file = fopen(tb->shrink_path, "wb");
+  if (!file || fwrite(program.data(), sizeof(uint32_t), n_insts, file) != n_insts) {
+    printf("[ERROR] shrink: could not write %s\n", tb->shrink_path);
+    if (file) fclose(file);
+    return false;
+  }
+  fclose(file);
+  std::string command = shrink_command(tb, seed);
+  std::string command_path = std::string(tb->shrink_path) + ".cmd";
+  file = fopen(command_path.c_str(), "w");
+  if (file) {
+    fprintf(file, "%s\n", command.c_str());
+    fclose(file);
+  }
+  printf("[INFO] shrink: program written to %s, reproduce with (also in %s):\n%s\n", tb->shrink_path, command_path.c_str(), command.c_str());
+  return true;
+}
@@ -0,0 +1,283 @@
+/*
+  SimPoint style sampling: gold splits the run into intervals of tb->simpoint_interval instructions and
+  collects a basic block vector for each, randomly projected to SIMPOINT_DIMS dimensions. k-means picks
+  one representative interval per cluster, weighted by the instructions of its cluster. Only the
+  representatives run on vsoc (after tb->simpoint_warmup instructions of warmup), and the counters are
+  extrapolated to the whole run.
+*/
+#define SIMPOINT_DIMS     (15)
+#define SIMPOINT_ITERS    (100)
+#define SIMPOINT_COUNTERS (12)
+
+static const char* simpoint_counter_names[SIMPOINT_COUNTERS] = {
+  "cycles", "instrets", "ifu wait", "lsu wait", "load seen", "store seen",
+  "system seen", "calc seen", "jump seen", "branch seen", "branch taken", "icache hits",
+};
+
+struct SimpointInterval {
+  float    bbv[SIMPOINT_DIMS];
+  uint64_t start;
+  uint64_t n_insts;
+  uint32_t cluster;
+};
+
+static void simpoint_counters(VEventCounts* counts, uint64_t out[SIMPOINT_COUNTERS]) {
+  out[0]  = counts->mcycle;
+  out[1]  = counts->minstret;
+  out[2]  = counts->mifu_wait;
+  out[3]  = counts->mlsu_wait;
+  out[4]  = counts->mload_seen;
+  out[5]  = counts->mstore_seen;
+  out[6]  = counts->msystem_seen;
+  out[7]  = counts->mcalc_seen;
+  out[8]  = counts->mjump_seen;
+  out[9]  = counts->mbranch_seen;
+  out[10] = counts->mbranch_taken;
+  out[11] = counts->micache_hits;
+}
+
+// NOTE: coordinate of basic block at pc on the random axis dim, in [-1, 1)
+static float simpoint_project(uint32_t pc, uint32_t dim) {
+  uint64_t h = hash_uint64_t(((uint64_t)pc << 8 | dim) + 1);
+  return (float)(h >> 40) / (float)(1 << 23) - 1.0f;
+}
+
+static float simpoint_distance(const float* a, const float* b) {
+  float result = 0;
+  for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) {
+    result += (a[d] - b[d]) * (a[d] - b[d]);
+  }
+  return result;
+}
+
+// NOTE: returns the number of intervals, stores them to *out; 0 if gold did not reach ebreak
+uint64_t simpoint_collect(TestBench* tb, SimpointInterval** out) {
+  Gcpu* gcpu = tb->gcpu;
+  g_reset(gcpu);
+  g_flash_init(gcpu, (uint8_t*)tb->insts, tb->flash_size);
+  gcpu->vuart = g_own_uart(gcpu);
+
+  uint64_t capacity  = 1024;
+  uint64_t n_intervals = 0;
+  SimpointInterval* intervals = (SimpointInterval*)malloc(capacity * sizeof(SimpointInterval));
+  SimpointInterval  curr      = {};
+  uint32_t block_pc  = gcpu->pc;
+  uint32_t block_len = 0;
+  while (1) {
+    uint32_t pc = gcpu->pc;
+    g_exec(gcpu, 1);
+    block_len++;
+    curr.n_insts++;
+    bool is_stop = gcpu->ebreak || gcpu->is_not_mapped;
+    bool is_interval_end = is_stop || curr.n_insts == tb->simpoint_interval;
+    if (gcpu->pc != pc + 4 || is_interval_end) {
+      for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) {
+        curr.bbv[d] += block_len * simpoint_project(block_pc, d);
+      }
+      block_pc  = gcpu->pc;
+      block_len = 0;
+    }
+    if (is_interval_end) {
+      for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) {
+        curr.bbv[d] /= curr.n_insts;
+      }
+      if (n_intervals == capacity) {
+        capacity *= 2;
+        intervals = (SimpointInterval*)realloc(intervals, capacity * sizeof(SimpointInterval));
+      }
+      intervals[n_intervals++] = curr;
+      curr = SimpointInterval{.start = gcpu->instret};
+    }
+    if (is_stop) break;
+  }
+  if (!gcpu->ebreak) {
+    printf("[FAILED] gcpu stopped without ebreak after %lu instrets at pc=0x%08x\n", gcpu->instret, gcpu->pc);
+    free(intervals);
+    return 0;
+  }
+  *out = intervals;
+  return n_intervals;
+}
+
+// NOTE: k-means++ seeding, then Lloyd iterations; returns the number of clusters
+uint32_t simpoint_cluster(TestBench* tb, SimpointInterval* intervals, uint64_t n_intervals, float (*centers)[SIMPOINT_DIMS]) {
+  uint32_t k = tb->simpoint_k < n_intervals ? tb->simpoint_k : n_intervals;
+  std::mt19937 gen(tb->seed);
+  float* min_distance = (float*)malloc(n_intervals * sizeof(float));
+  memcpy(centers[0], intervals[gen() % n_intervals].bbv, sizeof(centers[0]));
+  for (uint64_t i = 0; i < n_intervals; i++) {
+    min_distance[i] = simpoint_distance(intervals[i].bbv, centers[0]);
+  }
+  for (uint32_t c = 1; c < k; c++) {
+    double total = 0;
+    for (uint64_t i = 0; i < n_intervals; i++) total += min_distance[i];
+    // NOTE: all intervals are already centers, the extra clusters stay empty
+    if (total == 0) {
+      k = c;
+      break;
+    }
+    double pick = std::uniform_real_distribution<double>(0, total)(gen);
+    uint64_t chosen = 0;
+    for (; chosen + 1 < n_intervals; chosen++) {
+      pick -= min_distance[chosen];
+      if (pick <= 0) break;
+    }
+    memcpy(centers[c], intervals[chosen].bbv, sizeof(centers[c]));
+    for (uint64_t i = 0; i < n_intervals; i++) {
+      float distance = simpoint_distance(intervals[i].bbv, centers[c]);
+      if (distance < min_distance[i]) min_distance[i] = distance;
+    }
+  }
+  free(min_distance);
+
+  for (uint32_t iter = 0; iter < SIMPOINT_ITERS; iter++) {
+    bool is_changed = false;
+    for (uint64_t i = 0; i < n_intervals; i++) {
+      uint32_t best = 0;
+      for (uint32_t c = 1; c < k; c++) {
+        if (simpoint_distance(intervals[i].bbv, centers[c]) < simpoint_distance(intervals[i].bbv, centers[best])) best = c;
+      }
+      is_changed |= iter == 0 || intervals[i].cluster != best;
+      intervals[i].cluster = best;
+    }
+    if (!is_changed) break;
+    for (uint32_t c = 0; c < k; c++) {
+      float    sum[SIMPOINT_DIMS] = {};
+      uint64_t count = 0;
+      for (uint64_t i = 0; i < n_intervals; i++) {
+        if (intervals[i].cluster != c) continue;
+        for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) sum[d] += intervals[i].bbv[d];
+        count++;
+      }
+      if (!count) continue;
+      for (uint32_t d = 0; d < SIMPOINT_DIMS; d++) centers[c][d] = sum[d] / count;
+    }
+  }
+  return k;
+}
+
+// NOTE: runs vsoc until n more instructions retire or ebreak
+void vsoc_run_insts(TestBench* tb, uint64_t n) {
+  uint64_t start = tb->vsoc_cpu->event_counts.minstret;
+  while (tb->vsoc_cpu->event_counts.minstret - start < n && !tb->vsoc_cpu->event_counts.ebreak) {
+    vsoc_fetch_exec(tb);
+    if (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) break;
+  }
+}
+
+bool test_simpoint(TestBench* tb) {
+  if (!tb->is_vsoc) {
+    printf("[ERROR] simpoint requires vsoc\n");
+    return false;
+  }
+  SimpointInterval* intervals = NULL;
+  uint64_t n_intervals = simpoint_collect(tb, &intervals);
+  if (!n_intervals) return false;
+  uint64_t total_insts = tb->gcpu->instret;
+
+  float (*centers)[SIMPOINT_DIMS] = (float (*)[SIMPOINT_DIMS])malloc(tb->simpoint_k * sizeof(*centers));
+  uint32_t k = simpoint_cluster(tb, intervals, n_intervals, centers);
+
+  // NOTE: representative of a cluster is its interval closest to the center
+  uint64_t* points  = (uint64_t*)malloc(k * sizeof(uint64_t));
+  double*   weights = (double*)  calloc(k, sizeof(double));
+  for (uint32_t c = 0; c < k; c++) points[c] = UINT64_MAX;
+  for (uint64_t i = 0; i < n_intervals; i++) {
+    uint32_t c = intervals[i].cluster;
+    weights[c] += (double)intervals[i].n_insts / total_insts;
+    if (points[c] == UINT64_MAX ||
+        simpoint_distance(intervals[i].bbv, centers[c]) < simpoint_distance(intervals[points[c]].bbv, centers[c])) {
+      points[c] = i;
+    }
+  }
+  printf("[INFO] simpoint: %lu instrets, %lu intervals of %lu, %u clusters\n", total_insts, n_intervals, tb->simpoint_interval, k);
+
+  // NOTE: one forward gold pass, the representatives are visited in program order
+  uint32_t* order = (uint32_t*)malloc(k * sizeof(uint32_t));
+  uint32_t  n_points = 0;
+  for (uint32_t c = 0; c < k; c++) {
+    if (points[c] != UINT64_MAX) order[n_points++] = c;
+  }
+  std::sort(order, order + n_points, [&](uint32_t a, uint32_t b) { return points[a] < points[b]; });
+
+  g_reset(tb->gcpu);
+  g_flash_init(tb->gcpu, (uint8_t*)tb->insts, tb->flash_size);
+  vsoc_flash_init((uint8_t*)tb->insts, tb->flash_size);
+  double estimate[SIMPOINT_COUNTERS] = {};
+  bool is_success = true;
+  for (uint32_t i = 0; i < n_points; i++) {
+    uint32_t c = order[i];
+    SimpointInterval* interval = &intervals[points[c]];
+    uint64_t warmup = interval->start < tb->simpoint_warmup ? interval->start : tb->simpoint_warmup;
+    g_run(tb->gcpu, interval->start - warmup - tb->gcpu->instret);
+
+    vsoc_reset(tb);
+    vsoc_load_gold_state(tb);
+    tb->vsoc_cycles = 0;
+    vsoc_run_insts(tb, warmup);
+    uint64_t before[SIMPOINT_COUNTERS];
+    uint64_t after [SIMPOINT_COUNTERS];
+    simpoint_counters(&tb->vsoc_cpu->event_counts, before);
+    vsoc_run_insts(tb, interval->n_insts);
+    simpoint_counters(&tb->vsoc_cpu->event_counts, after);
+
+    uint64_t retired = after[1] - before[1];
+    if (retired != interval->n_insts) {
+      printf("[FAILED] vsoc retired %lu/%lu instructions of interval %lu\n", retired, interval->n_insts, points[c]);
+      is_success = false;
+      break;
+    }
+    for (uint32_t j = 0; j < SIMPOINT_COUNTERS; j++) {
+      estimate[j] += weights[c] * (after[j] - before[j]) / retired * total_insts;
+    }
+    printf("  interval %6lu weight %.4f cycles %lu ipc %.4f\n", points[c], weights[c], after[0] - before[0], (double)retired / (after[0] - before[0]));
+  }
+
+  if (is_success) {
+    uint64_t counters[SIMPOINT_COUNTERS];
+    for (uint32_t j = 0; j < SIMPOINT_COUNTERS; j++) counters[j] = (uint64_t)(estimate[j] + 0.5);
+    uint64_t estimated_cycles = counters[0];
+    VEventCounts estimated = {
+      .mcycle        = estimated_cycles,
+      .ebreak        = 1,
+      .minstret      = counters[1],
+      .mifu_wait     = counters[2],
+      .mlsu_wait     = counters[3],
+      .mload_seen    = counters[4],
+      .mstore_seen   = counters[5],
+      .msystem_seen  = counters[6],
+      .mcalc_seen    = counters[7],
+      .mjump_seen    = counters[8],
+      .mbranch_seen  = counters[9],
+      .mbranch_taken = counters[10],
+      .micache_hits  = counters[11],
+    };
+    print_finished_stat(tb, "vsoc simpoint", estimated);
+
+    if (tb->is_simpoint_cmp) {
+      vsoc_reset(tb);
+      tb->vsoc_cycles = 0;
+      vsoc_run_insts(tb, UINT64_MAX);
+      uint64_t full[SIMPOINT_COUNTERS];
+      simpoint_counters(&tb->vsoc_cpu->event_counts, full);
+      printf("[INFO] simpoint error against the full run:\n");
+      for (uint32_t j = 0; j < SIMPOINT_COUNTERS; j++) {
+        double error = full[j] ? 100.0 * ((double)counters[j] - (double)full[j]) / full[j] : 0.0;
+        printf("  %-13s full %12lu estimate %12lu error %+7.3f%%\n", simpoint_counter_names[j], full[j], counters[j], error);
+      }
+    }
+    else {
+      printf("[INFO] simpoint estimate:\n");
+      for (uint32_t j = 0; j < SIMPOINT_COUNTERS; j++) {
+        printf("  %-13s %12lu\n", simpoint_counter_names[j], counters[j]);
+      }
+    }
+  }
+
+  free(order);
+  free(points);
+  free(weights);
+  free(centers);
+  free(intervals);
+  return is_success;
+}
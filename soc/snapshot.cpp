@@ -0,0 +1,154 @@
+/*
+  Snapshot of a verilated model right after its first reset, kept in memory in the --savable format and
+  restored through it by the following resets instead of clocking reset_cycles through the model again.
+  A memory of the model that is zero in the snapshot can be left out of the stream as a hole (the 32 MiB
+  vsoc SDRAM): on restore its bytes come from a read only zero mapping, so it is neither stored nor copied
+  into the buffer. The hole is found once by serializing the model again with the first and the last byte
+  of the memory changed; if the bytes in between are not the zero memory, the snapshot keeps the whole
+  stream. The restore reads the stream in place: the buffer of VerilatedDeserialize is used only across
+  the ends of the hole and of the stream.
+*/
+struct ModelSnapshot {
+  std::vector<uint8_t> data;        // NOTE: the stream without the hole
+  size_t               hole_offset; // NOTE: offset of the hole in the stream
+  size_t               hole_size;   // NOTE: 0 -- no hole
+  const uint8_t*       zero;        // NOTE: hole_size bytes of zero pages
+};
+
+class SnapshotSave : public VerilatedSerialize {
+  std::vector<uint8_t>* m_data;
+public:
+  explicit SnapshotSave(std::vector<uint8_t>* data) : m_data(data) {
+    m_isOpen = true;
+    header();
+  }
+  ~SnapshotSave() override { close(); }
+  void close() override {
+    if (!m_isOpen) return;
+    flush();
+    m_isOpen = false;
+  }
+  void flush() override {
+    m_data->insert(m_data->end(), m_bufp, m_cp);
+    m_cp = m_bufp;
+  }
+};
+
+class SnapshotRestore : public VerilatedDeserialize {
+  const ModelSnapshot* m_snapshot;
+  size_t               m_pos = 0; // NOTE: offset in the stream of m_endp
+public:
+  explicit SnapshotRestore(const ModelSnapshot* snapshot) : m_snapshot(snapshot) {
+    m_isOpen = true;
+    m_cp = m_endp = m_bufp;
+    fill();
+    header();
+  }
+  // NOTE: the part of the stream from pos to the end of its piece (data before the hole, hole, data after it)
+  const uint8_t* piece(size_t pos, size_t* size) {
+    const ModelSnapshot* s = m_snapshot;
+    size_t hole_end    = s->hole_offset + s->hole_size;
+    size_t stream_size = s->data.size() + s->hole_size;
+    if (pos >= stream_size) {
+      *size = 0;
+      return NULL;
+    }
+    if (pos < s->hole_offset) {
+      *size = s->hole_offset - pos;
+      return s->data.data() + pos;
+    }
+    if (pos < hole_end) {
+      *size = hole_end - pos;
+      return s->zero + (pos - s->hole_offset);
+    }
+    *size = stream_size - pos;
+    return s->data.data() + (pos - s->hole_size);
+  }
+  // NOTE: a read takes at most bufferInsertSize bytes from m_cp: a piece with that many left is read in place,
+  // otherwise its rest and what follows is copied into the buffer like CheckpointRestore::fill does
+  void fill() override {
+    size_t pos = m_pos - (m_endp - m_cp);
+    size_t size = 0;
+    const uint8_t* src = piece(pos, &size);
+    if (size >= bufferInsertSize()) {
+      m_cp   = (uint8_t*)src;
+      m_endp = m_cp + size;
+      m_pos  = pos + size;
+      return;
+    }
+    uint8_t* rp = m_bufp;
+    for (uint8_t* sp = m_cp; sp < m_endp; *rp++ = *sp++) {}
+    m_endp = rp;
+    m_cp   = m_bufp;
+    m_pos  = pos + (m_endp - m_cp);
+    size_t stream_size = m_snapshot->data.size() + m_snapshot->hole_size;
+    while (m_endp < m_bufp + bufferSize()) {
+      size_t left = m_bufp + bufferSize() - m_endp;
+      if (m_pos >= stream_size) {
+        // NOTE: zero fill at the end like CheckpointRestore::fill, m_pos counts it
+        memset(m_endp, 0, left);
+        m_endp += left;
+        m_pos  += left;
+        break;
+      }
+      src = piece(m_pos, &size);
+      if (size > left) size = left;
+      memcpy(m_endp, src, size);
+      m_endp += size;
+      m_pos  += size;
+    }
+  }
+};
+
+template <typename T>
+ModelSnapshot* model_snapshot_new(T* model, uint8_t* hole, size_t hole_size) {
+  ModelSnapshot* snapshot = new ModelSnapshot{};
+  {
+    SnapshotSave os(&snapshot->data);
+    os << *model;
+  }
+  snapshot->hole_offset = snapshot->data.size();
+  if (!hole || !hole_size) return snapshot;
+
+  std::vector<uint8_t> changed;
+  hole[0]             ^= 0xff;
+  hole[hole_size - 1] ^= 0xff;
+  {
+    SnapshotSave os(&changed);
+    os << *model;
+  }
+  hole[0]             ^= 0xff;
+  hole[hole_size - 1] ^= 0xff;
+
+  std::vector<uint8_t>& data = snapshot->data;
+  if (changed.size() != data.size()) return snapshot;
+  size_t first = 0;
+  while (first < data.size() && data[first] == changed[first]) first++;
+  size_t last = data.size();
+  while (last > first && data[last - 1] == changed[last - 1]) last--;
+  if (last - first != hole_size) return snapshot;
+  for (size_t i = first; i < last; i++) {
+    if (data[i]) return snapshot;
+  }
+  void* zero = mmap(NULL, hole_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (zero == MAP_FAILED) return snapshot;
+
+  data.erase(data.begin() + first, data.begin() + last);
+  data.shrink_to_fit();
+  snapshot->hole_offset = first;
+  snapshot->hole_size   = hole_size;
+  snapshot->zero        = (const uint8_t*)zero;
+  return snapshot;
+}
+
+template <typename T>
+void model_snapshot_restore(T* model, const ModelSnapshot* snapshot) {
+  SnapshotRestore is(snapshot);
+  is >> *model;
+}
+
+void model_snapshot_free(ModelSnapshot* snapshot) {
+  if (!snapshot) return;
+  if (snapshot->zero) munmap((void*)snapshot->zero, snapshot->hole_size);
+  delete snapshot;
+}
@@ -1,15 +1,28 @@
 #include <stdio.h>   // fopen, fseek, ftell, fread, fclose, fprintf
 #include <stdlib.h>  // malloc, free
 #include <stdint.h>  // uint8_t
+#include <inttypes.h>  // PRIu64, PRIx64
 #include <stddef.h>  // size_t
 #include <limits.h>  // SIZE_MAX
 #include <cstdarg>
 #include <random>
 #include <bitset>
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <array>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <zlib.h>
+#include <unistd.h>    // fork, _exit
+#include <sys/wait.h>  // waitpid
+#include <dirent.h>    // opendir, readdir
 
 #include "svdpi.h"
 #include <verilated.h>
 #include <verilated_vcd_c.h>
+#include <verilated_save.h>
 #include "VysyxSoCTop.h"
 #include "VysyxSoCTop___024root.h"
 #include "Vcpu.h"
@@ -17,6 +30,10 @@
 
 #include "riscv.cpp"
 #include "gcpu.cpp"
+#include "glanes.cpp"
+#include "commitlog.cpp"
+#include "memdiff.cpp"
+#include "snapshot.cpp"
 
 typedef VysyxSoCTop VSoC;
 
@@ -24,15 +41,17 @@ struct Vcpucpu {
   uint32_t& pc;
   VlUnpacked<uint32_t, 16>&  regs;
 
-  uint8_t mem[MEM_SIZE];
-  uint8_t flash[FLASH_SIZE];
-  uint8_t uart[UART_SIZE];
+  MemBacking mem;
+  MemBacking flash;
+  uint8_t    uart[UART_SIZE];
+  MemMap     mem_map;
 
   uint8_t  clock_now;
   uint8_t  clock_pre;
 
   uint8_t  is_mem_write;
   uint32_t written_address;
+  MemDirty* mem_dirty;
 
   VEventCounts event_counts;
   uint64_t minstret_start;
@@ -52,6 +71,133 @@ struct Vcpucpu {
   uint64_t io_lsu_waitRespValid;
 };
 
+enum BreakCode {
+  NoBreak,
+  Timeout,
+  Ebreak,
+  InstRet,
+};
+
+struct TestBench;
+
+// NOTE: instances of the tick loops for the configuration of the run, picked by sim_loops_select
+struct SimLoops {
+  void      (*vsoc_cycles)    (TestBench* tb, uint64_t cycles);
+  void      (*vsoc_fetch_exec)(TestBench* tb);
+  void      (*vcpu_ticks)     (TestBench* tb, uint64_t ticks);
+  BreakCode (*vcpu_fetch_exec)(TestBench* tb);
+  void      (*vsoc_batch)     (TestBench* tb, uint64_t cycles);
+};
+
+/*
+  Commit records: exu calls exu_commit for every retired instruction with its pc, instruction, the written
+  register and the store. With batch <cycles> vsoc runs that many cycles per call collecting the records in
+  a preallocated ring, then test_batch replays the whole batch on gold in one pass, record by record.
+  With threads every model runs on its own thread and produces its records into its own ring (gold makes
+  them with gold_commit_step), the ring is single-producer/single-consumer and test_threads consumes all
+  of them. A full ring blocks its producer, a stopped ring drops the records.
+*/
+struct CommitRing {
+  CommitRecord* records;
+  uint64_t      mask;
+  bool          is_blocking;
+  bool          is_overflow;
+  // NOTE: producer and consumer indices on their own cache lines, each side caches the index of the other
+  alignas(64) std::atomic<uint64_t> head;
+  uint64_t                          tail_cached;
+  alignas(64) std::atomic<uint64_t> tail;
+  uint64_t                          head_cached;
+  alignas(64) std::atomic<bool>     is_done;
+  std::atomic<bool>                 is_stop;
+};
+
+// NOTE: size is rounded up to a power of two
+CommitRing* commit_ring_new(uint64_t size, bool is_blocking) {
+  uint64_t size2 = 1;
+  while (size2 < size) size2 <<= 1;
+  CommitRing* ring  = new CommitRing;
+  ring->records     = (CommitRecord*)malloc(size2 * sizeof(CommitRecord));
+  ring->mask        = size2 - 1;
+  ring->is_blocking = is_blocking;
+  ring->is_overflow = false;
+  ring->head        = 0;
+  ring->tail_cached = 0;
+  ring->tail        = 0;
+  ring->head_cached = 0;
+  ring->is_done     = false;
+  ring->is_stop     = false;
+  return ring;
+}
+
+void commit_ring_free(CommitRing* ring) {
+  if (!ring) return;
+  free(ring->records);
+  delete ring;
+}
+
+// NOTE: false if the record is dropped: the ring is stopped, or full and not blocking
+static inline bool commit_ring_push(CommitRing* ring, const CommitRecord* record) {
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  while (head - ring->tail_cached > ring->mask) {
+    ring->tail_cached = ring->tail.load(std::memory_order_acquire);
+    if (head - ring->tail_cached <= ring->mask) break;
+    if (!ring->is_blocking) {
+      ring->is_overflow = true;
+      return false;
+    }
+    if (ring->is_stop.load(std::memory_order_relaxed)) return false;
+    std::this_thread::yield();
+  }
+  ring->records[head & ring->mask] = *record;
+  ring->head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+// NOTE: the oldest record or NULL if the ring is empty, it stays in the ring until commit_ring_pop
+static inline const CommitRecord* commit_ring_peek(CommitRing* ring) {
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail == ring->head_cached) {
+    ring->head_cached = ring->head.load(std::memory_order_acquire);
+    if (tail == ring->head_cached) return NULL;
+  }
+  return &ring->records[tail & ring->mask];
+}
+
+static inline void commit_ring_pop(CommitRing* ring) {
+  ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// NOTE: waits for the producer, NULL once it is done and the ring is empty
+const CommitRecord* commit_ring_wait(CommitRing* ring) {
+  while (1) {
+    const CommitRecord* record = commit_ring_peek(ring);
+    if (record) return record;
+    if (ring->is_done.load(std::memory_order_acquire)) return commit_ring_peek(ring);
+    std::this_thread::yield();
+  }
+}
+
+/*
+  Packed random tests: up to tb->pack programs share one flash image and run back to back after one reset.
+  Program k starts at word k*stride with its register init, and is followed by a gap of PACK_GAP jumps to
+  program k+1 (to an ebreak after the last one). The programs are made of random_bounded_instruction, which
+  can not fault and leaves the program forward by at most PACK_GAP words (jumps and branches from its last
+  word, jalr from x15 right after it), so every program ends by running into its gap and the next one
+  starts. SDRAM keeps what the programs before stored.
+  Gold tells which program runs: the next one starts when the pc reaches its first word, the image ends when
+  the pc goes anywhere else outside the running program, on the usual ends of a random test or after n_insts
+  instructions of one program. The programs that did not start lead the next image.
+*/
+#define PACK_GAP (1 << RANDOM_BOUNDED_FORWARD_BITS)
+
+struct RandomPack {
+  uint64_t* seeds;
+  uint32_t  n_programs;
+  uint32_t  stride;           // NOTE: words from the start of a program to the next one
+  uint32_t  current;
+  uint64_t  current_instrets; // NOTE: tb->instrets when current started
+};
+
 struct TestBenchConfig {
   bool is_trace       = false;
   char* trace_path    = NULL;
@@ -73,6 +219,37 @@ struct TestBenchConfig {
   uint64_t mem_delay_max = 0;
   VerboseLevel verbose = VerboseFailed;
   char* measure_path   = NULL;
+  GcpuEngine gold_engine = GcpuEngineInterp;
+  uint64_t fastforward = 0;
+  uint64_t simpoint_interval = 0;
+  uint32_t simpoint_k        = 0;
+  uint64_t simpoint_warmup   = 0;
+  bool is_simpoint_cmp       = false;
+  char* checkpoint_path      = NULL;
+  uint64_t checkpoint_every  = 0;
+  char* restore_path         = NULL;
+  uint32_t gold_lanes        = 0;
+  bool is_lanes_check        = false;
+  bool is_decodebench        = false;
+  char* timing_path          = NULL;
+  char* calibrate_csv        = NULL;
+  char* calibrate_rows       = NULL;
+  char* calibrate_out        = NULL;
+  char* profile_path         = NULL;
+  char* symbols_path         = NULL;
+  bool is_hugepages          = false;
+  uint64_t batch_cycles      = 0;
+  bool is_threads            = false;
+  char* commitlog_path       = NULL;
+  char* logcmp_path          = NULL;
+  uint64_t hashcmp_insts     = 0;
+  uint32_t pack              = 0;
+  uint32_t jobs              = 0;
+  char* shrink_path          = NULL;
+  char* replay_path          = NULL;
+  char* suite_path           = NULL;
+  int    argc                = 0;
+  char** argv                = NULL;
 };
 
 struct TestBench {
@@ -91,8 +268,11 @@ struct TestBench {
   bool is_check;
   uint64_t seed;
   uint64_t max_tests;
+  // NOTE: SDRAM lines written by any model since the last memcmp, NULL without memcmp
+  MemDirty* mem_dirty;
 
   VerilatedContext* contextp;
+  VerilatedContext* vcpu_contextp;
   VSoC* vsoc;
   VerilatedVcdC* trace;
   std::mt19937* random_gen;
@@ -103,6 +283,47 @@ struct TestBench {
   uint64_t  mem_delay_max;
   VerboseLevel verbose;
   char* measure_path;
+  GcpuEngine gold_engine;
+  uint64_t fastforward;
+  uint64_t simpoint_interval;
+  uint32_t simpoint_k;
+  uint64_t simpoint_warmup;
+  bool is_simpoint_cmp;
+  char* checkpoint_path;
+  uint64_t checkpoint_every;
+  char* restore_path;
+  uint32_t gold_lanes;
+  bool is_lanes_check;
+  char* timing_path;
+  char* calibrate_csv;
+  char* calibrate_rows;
+  char* calibrate_out;
+  Gtiming* gtiming;
+  char* profile_path;
+  char* symbols_path;
+  Gprofile* gprofile;
+  bool is_hugepages;
+  uint64_t batch_cycles;
+  bool is_threads;
+  CommitRing* commits;
+  char* commitlog_path;
+  char* logcmp_path;
+  uint64_t hashcmp_insts;
+  uint32_t pack;
+  uint32_t jobs;
+  char* shrink_path;
+  char* replay_path;
+  char* suite_path;
+  // NOTE: the command line, shrink prints it back for the reduced program
+  int    argc;
+  char** argv;
+  // NOTE: the running packed image, NULL otherwise
+  RandomPack* random_pack;
+  // NOTE: the models right after their first reset, NULL before it and with trace
+  ModelSnapshot* vsoc_snapshot;
+  ModelSnapshot* vcpu_snapshot;
+  // NOTE: bytes of the program in the flashes of the models, 0 -- unknown; set by test_instructions
+  uint32_t flash_loaded;
   FILE* measure_file;
   uint32_t* insts;
 
@@ -118,9 +339,48 @@ struct TestBench {
   Vcpucpu* vcpu_cpu;
   Vcpu* vcpu;
   Gcpu* gcpu;
+  SimLoops loops;
 };
 
 
+uint32_t v_uart_read(void* ctx, uint32_t offset) {
+  Vcpucpu* cpu = (Vcpucpu*)ctx;
+  uint8_t byte = cpu->uart[offset];
+  return
+    byte << 24 | byte << 16 |
+    byte <<  8 | byte <<  0 ;
+}
+
+void v_uart_write(void* ctx, uint32_t offset, uint8_t wbmask, uint32_t wdata) {
+  Vcpucpu* cpu = (Vcpucpu*)ctx;
+  uint8_t byte = 0;
+  switch (offset & 0b11) {
+    case 0b00 : byte = (wdata >>  0) & 0xff; break;
+    case 0b01 : byte = (wdata >>  8) & 0xff; break;
+    case 0b10 : byte = (wdata >> 16) & 0xff; break;
+    case 0b11 : byte = (wdata >> 24) & 0xff; break;
+  }
+  if (offset == 0) {
+    fputc(byte, stderr);
+  }
+  else if (offset != 5 && offset != 6) {
+    cpu->uart[offset] = byte;
+  }
+}
+
+// NOTE: flash of the verilated SoC, read through the flash_read DPI
+MemBacking vsoc_flash;
+
+void v_mem_map_init(Vcpucpu* cpu, bool is_hugepages) {
+  mem_backing_init(&cpu->mem,   MEM_SIZE,   is_hugepages);
+  mem_backing_init(&cpu->flash, FLASH_SIZE, is_hugepages);
+  // NOTE: the vcpu bus reads and writes aligned words
+  mem_map_init(&cpu->mem_map, ~3u);
+  mem_map_region(&cpu->mem_map, FLASH_START, FLASH_SIZE, cpu->flash.host, false);
+  mem_map_region(&cpu->mem_map, MEM_START,   MEM_SIZE,   cpu->mem.host,   true);
+  mem_map_mmio(&cpu->mem_map, UART_START, UART_END-3, cpu, v_uart_read, v_uart_write);
+}
+
 TestBench new_testbench(TestBenchConfig config) {
   TestBench tb = {
     .is_trace   = config.is_trace,
@@ -144,6 +404,36 @@ TestBench new_testbench(TestBenchConfig config) {
     .mem_delay_max = config.mem_delay_max,
     .verbose       = config.verbose,
     .measure_path  = config.measure_path,
+    .gold_engine   = config.gold_engine,
+    .fastforward   = config.fastforward,
+    .simpoint_interval = config.simpoint_interval,
+    .simpoint_k        = config.simpoint_k,
+    .simpoint_warmup   = config.simpoint_warmup,
+    .is_simpoint_cmp   = config.is_simpoint_cmp,
+    .checkpoint_path   = config.checkpoint_path,
+    .checkpoint_every  = config.checkpoint_every,
+    .restore_path      = config.restore_path,
+    .gold_lanes        = config.gold_lanes,
+    .is_lanes_check    = config.is_lanes_check,
+    .timing_path       = config.timing_path,
+    .calibrate_csv     = config.calibrate_csv,
+    .calibrate_rows    = config.calibrate_rows,
+    .calibrate_out     = config.calibrate_out,
+    .profile_path      = config.profile_path,
+    .symbols_path      = config.symbols_path,
+    .is_hugepages      = config.is_hugepages,
+    .batch_cycles      = config.batch_cycles,
+    .is_threads        = config.is_threads,
+    .commitlog_path    = config.commitlog_path,
+    .logcmp_path       = config.logcmp_path,
+    .hashcmp_insts     = config.hashcmp_insts,
+    .pack              = config.pack,
+    .jobs              = config.jobs,
+    .shrink_path       = config.shrink_path,
+    .replay_path       = config.replay_path,
+    .suite_path        = config.suite_path,
+    .argc              = config.argc,
+    .argv              = config.argv,
     .trace_dumps  = 0,
     .reset_cycles = 10,
   };
@@ -151,7 +441,15 @@ TestBench new_testbench(TestBenchConfig config) {
     Verilated::traceEverOn(true);
   }
 
-  tb.vsoc = new VSoC;
+  // NOTE: a context per model, so that they can be evaluated on different threads
+  tb.contextp      = new VerilatedContext;
+  tb.vcpu_contextp = new VerilatedContext;
+  if (tb.is_trace) {
+    tb.contextp->traceEverOn(true);
+    tb.vcpu_contextp->traceEverOn(true);
+  }
+
+  tb.vsoc = new VSoC(tb.contextp);
   tb.vsoc_cpu = new VSoCcpu{
     .pc            = tb.vsoc->rootp->ysyxSoCTop__DOT__dut__DOT__asic__DOT__cpu__DOT__u_cpu__DOT__pc,
     .regs          = tb.vsoc->rootp->ysyxSoCTop__DOT__dut__DOT__asic__DOT__cpu__DOT__u_cpu__DOT__u_rf__DOT__regs,
@@ -190,8 +488,15 @@ TestBench new_testbench(TestBenchConfig config) {
       .mbranch_taken = 0,
     },
   };
+  tb.vsoc_cpu->mem_written = MemBacking{
+    .host    = (uint8_t*)&tb.vsoc_cpu->mem.m_storage[0],
+    .size    = MEM_SIZE,
+    .n_pages = MEM_SIZE >> MEM_MAP_PAGE_BITS,
+    .dirty   = (uint8_t*) calloc(MEM_SIZE >> MEM_MAP_PAGE_BITS, sizeof(uint8_t)),
+    .touched = (uint32_t*)calloc(MEM_SIZE >> MEM_MAP_PAGE_BITS, sizeof(uint32_t)),
+  };
 
-  tb.vcpu = new Vcpu;
+  tb.vcpu = new Vcpu(tb.vcpu_contextp);
   tb.vcpu_cpu = new Vcpucpu {
     .pc            = tb.vcpu->rootp->cpu__DOT__pc,
     .regs          = tb.vcpu->rootp->cpu__DOT__u_rf__DOT__regs,
@@ -212,8 +517,16 @@ TestBench new_testbench(TestBenchConfig config) {
       .mbranch_taken   = 0,
     },
   };
+  v_mem_map_init(tb.vcpu_cpu, tb.is_hugepages);
+  mem_backing_init(&vsoc_flash, FLASH_SIZE, tb.is_hugepages);
 
-  tb.gcpu = new Gcpu{.verbose = tb.verbose};
+  tb.gcpu = new Gcpu{.is_hugepages = tb.is_hugepages, .engine = tb.gold_engine, .verbose = tb.verbose};
+  if (tb.is_memcmp) {
+    tb.mem_dirty = new MemDirty;
+    mem_dirty_init(tb.mem_dirty, MEM_SIZE);
+    tb.gcpu->mem_dirty     = tb.mem_dirty;
+    tb.vcpu_cpu->mem_dirty = tb.mem_dirty;
+  }
   if (tb.is_vsoc) {
     tb.gcpu->vuart = &tb.vsoc_cpu->uart;
   }
@@ -238,8 +551,9 @@ TestBench new_testbench(TestBenchConfig config) {
       .lsr_packed = true,
     };
   }
-
-  tb.contextp = new VerilatedContext;
+  else {
+    tb.gcpu->vuart = g_own_uart(tb.gcpu);
+  }
 
   std::random_device rand_device;
   std::mt19937* gen = new std::mt19937(rand_device());
@@ -270,10 +584,31 @@ void delete_testbench(TestBench tb) {
     tb.trace->close();
     delete tb.trace;
   }
+  // NOTE: the host of mem_written is the verilated SDRAM
+  free(tb.vsoc_cpu->mem_written.dirty);
+  free(tb.vsoc_cpu->mem_written.touched);
   delete tb.vsoc_cpu;
+  model_snapshot_free(tb.vsoc_snapshot);
+  model_snapshot_free(tb.vcpu_snapshot);
+  if (tb.mem_dirty) {
+    mem_dirty_free(tb.mem_dirty);
+    delete tb.mem_dirty;
+  }
+  mem_map_free(&tb.vcpu_cpu->mem_map);
+  mem_backing_free(&tb.vcpu_cpu->mem);
+  mem_backing_free(&tb.vcpu_cpu->flash);
+  mem_map_free(&tb.gcpu->mem_map);
+  mem_backing_free(&tb.gcpu->mem);
+  mem_backing_free(&tb.gcpu->flash);
+  mem_backing_free(&vsoc_flash);
   delete tb.gcpu;
+  if (tb.gtiming) g_timing_free(tb.gtiming);
+  if (tb.gprofile) g_profile_free(tb.gprofile);
+  commit_ring_free(tb.commits);
   delete tb.vsoc;
+  delete tb.vcpu;
   delete tb.contextp;
+  delete tb.vcpu_contextp;
 }
 
 static void append_to_file(FILE* f, const char* fmt, ...) {
@@ -375,35 +710,52 @@ void print_all_instructions(TestBench* tb) {
 }
 
 
-uint8_t vsoc_flash[FLASH_SIZE];
-
 extern "C" void flash_read(int32_t addr, int32_t* data) {
  *data = 
-      vsoc_flash[addr + 3] << 24 | vsoc_flash[addr + 2] << 16 |
-      vsoc_flash[addr + 1] <<  8 | vsoc_flash[addr + 0] <<  0 ;
+      vsoc_flash.host[addr + 3] << 24 | vsoc_flash.host[addr + 2] << 16 |
+      vsoc_flash.host[addr + 1] <<  8 | vsoc_flash.host[addr + 0] <<  0 ;
 }
 
 static TestBench* dpi_testbench;
+
+// NOTE: where the DPI calls of the model simulated by the calling thread go; every thread of test_threads sets its own
+struct DpiModel {
+  VEventCounts*   counts;
+  CommitRing*     commits;
+  const uint64_t* cycles;
+  uint64_t*       state_hash;
+  MemDirty*       mem_dirty;
+  MemBacking*     mem_written;
+};
+static thread_local DpiModel dpi_model;
+
 void dpi_init(TestBench* tb) {
   dpi_testbench = tb;
+  dpi_model     = DpiModel{&tb->vsoc_cpu->event_counts, NULL, &tb->vsoc_cycles, NULL, tb->mem_dirty, &tb->vsoc_cpu->mem_written};
 }
 void dpi_clear() {
   dpi_testbench = NULL;
+  dpi_model     = DpiModel{};
+}
+
+// NOTE: all but mcycle, which is the csr of the model
+void event_counts_clear(VEventCounts* counts) {
+  counts->ebreak        = 0;
+  counts->minstret      = 0;
+  counts->mifu_wait     = 0;
+  counts->mlsu_wait     = 0;
+  counts->mload_seen    = 0;
+  counts->mstore_seen   = 0;
+  counts->msystem_seen  = 0;
+  counts->mcalc_seen    = 0;
+  counts->mjump_seen    = 0;
+  counts->mbranch_seen  = 0;
+  counts->mbranch_taken = 0;
 }
 
 extern "C" void exu_perf_reset() {
-  dpi_testbench->vsoc_cpu->event_counts.ebreak        = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mcycle        = 0;
-  dpi_testbench->vsoc_cpu->event_counts.minstret      = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mifu_wait     = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mlsu_wait     = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mload_seen    = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mstore_seen   = 0;
-  dpi_testbench->vsoc_cpu->event_counts.msystem_seen  = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mcalc_seen    = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mjump_seen    = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mbranch_seen  = 0;
-  dpi_testbench->vsoc_cpu->event_counts.mbranch_taken = 0;
+  dpi_model.counts->mcycle = 0;
+  event_counts_clear(dpi_model.counts);
 }
 
 extern "C" void exu_perf_measure(svBit is_ebreak,
@@ -417,75 +769,210 @@ extern "C" void exu_perf_measure(svBit is_ebreak,
                                  svBit is_jump_seen,
                                  svBit is_branch_seen,
                                  svBit is_branch_taken) {
-  if (is_ebreak)       dpi_testbench->vsoc_cpu->event_counts.ebreak        = 1;
-  if (is_instret)      dpi_testbench->vsoc_cpu->event_counts.minstret      += 1;
-  if (is_ifu_wait)     dpi_testbench->vsoc_cpu->event_counts.mifu_wait     += 1;
-  if (is_lsu_wait)     dpi_testbench->vsoc_cpu->event_counts.mlsu_wait     += 1;
-  if (is_load_seen)    dpi_testbench->vsoc_cpu->event_counts.mload_seen    += 1;
-  if (is_store_seen)   dpi_testbench->vsoc_cpu->event_counts.mstore_seen   += 1;
-  if (is_system_seen)  dpi_testbench->vsoc_cpu->event_counts.msystem_seen  += 1;
-  if (is_calc_seen)    dpi_testbench->vsoc_cpu->event_counts.mcalc_seen    += 1;
-  if (is_jump_seen)    dpi_testbench->vsoc_cpu->event_counts.mjump_seen    += 1;
-  if (is_branch_seen)  dpi_testbench->vsoc_cpu->event_counts.mbranch_seen  += 1;
-  if (is_branch_taken) dpi_testbench->vsoc_cpu->event_counts.mbranch_taken += 1;
+  if (is_ebreak)       dpi_model.counts->ebreak        = 1;
+  if (is_instret)      dpi_model.counts->minstret      += 1;
+  if (is_ifu_wait)     dpi_model.counts->mifu_wait     += 1;
+  if (is_lsu_wait)     dpi_model.counts->mlsu_wait     += 1;
+  if (is_load_seen)    dpi_model.counts->mload_seen    += 1;
+  if (is_store_seen)   dpi_model.counts->mstore_seen   += 1;
+  if (is_system_seen)  dpi_model.counts->msystem_seen  += 1;
+  if (is_calc_seen)    dpi_model.counts->mcalc_seen    += 1;
+  if (is_jump_seen)    dpi_model.counts->mjump_seen    += 1;
+  if (is_branch_seen)  dpi_model.counts->mbranch_seen  += 1;
+  if (is_branch_taken) dpi_model.counts->mbranch_taken += 1;
+}
+
+// NOTE: records are kept only by test_batch and test_threads
+// NOTE: rolling hash of the fields compare_commit compares, so streams of records that compare equal hash equal
+uint64_t commit_hash(uint64_t hash, const CommitRecord* r) {
+  uint32_t rd_wdata = r->rd && r->rd < N_REGS ? r->rd_wdata : 0;
+  hash = hash_uint64_t(hash ^ ((uint64_t)r->pc << 32 | r->inst));
+  hash = hash_uint64_t(hash ^ ((uint64_t)r->rd << 32 | rd_wdata));
+  if (r->mem_wmask) {
+    uint32_t mem_wdata = r->mem_addr >= MEM_START && r->mem_addr <= MEM_END-4 ? r->mem_wdata & commit_mem_mask(r->mem_wmask) : 0;
+    hash = hash_uint64_t(hash ^ ((uint64_t)r->mem_wmask << 32 | r->mem_addr));
+    hash = hash_uint64_t(hash ^ mem_wdata);
+  }
+  return hash;
+}
+
+extern "C" void exu_commit(int pc, int inst, int rd, int rd_wdata, int mem_addr, int mem_wdata, int mem_wmask) {
+  if (!dpi_model.commits && !dpi_model.state_hash) return;
+  CommitRecord record = {
+    .cycle     = *dpi_model.cycles,
+    .pc        = (uint32_t)pc,
+    .inst      = (uint32_t)inst,
+    .rd_wdata  = (uint32_t)rd_wdata,
+    .mem_addr  = (uint32_t)mem_addr,
+    .mem_wdata = (uint32_t)mem_wdata,
+    .rd        = (uint8_t)rd,
+    .mem_wmask = (uint8_t)mem_wmask,
+  };
+  if (dpi_model.state_hash) *dpi_model.state_hash = commit_hash(*dpi_model.state_hash, &record);
+  if (dpi_model.commits)    commit_ring_push(dpi_model.commits, &record);
+}
+
+extern "C" void lsu_mem_write(int addr) {
+  uint32_t offset = ((uint32_t)addr & ~3u) - MEM_START;
+  if (offset >= MEM_SIZE) return;
+  if (dpi_model.mem_dirty)   mem_dirty_mark(dpi_model.mem_dirty, offset, 4);
+  if (dpi_model.mem_written) mem_backing_mark(dpi_model.mem_written, offset, 4);
 }
 
 extern "C" void icache_perf_reset() {
-  dpi_testbench->vsoc_cpu->event_counts.micache_hits   = 0;
+  dpi_model.counts->micache_hits   = 0;
 }
 
 extern "C" void icache_perf_measure(svBit is_hit) {
-  if (is_hit) dpi_testbench->vsoc_cpu->event_counts.micache_hits += 1;
+  if (is_hit) dpi_model.counts->micache_hits += 1;
 }
 
+// NOTE: vsoc_reset keeps the flash (simpoint runs the same program from several states), so it is cleared here
 void vsoc_flash_init(uint8_t* data, uint32_t size) {
-  for (uint32_t i = 0; i < size; i++) {
-    vsoc_flash[i] = data[i];
+  mem_backing_clear(&vsoc_flash);
+  mem_backing_write(&vsoc_flash, 0, data, size);
+}
+
+// NOTE: flash holds only the previous program of old_size bytes, only the bytes of both are written
+void vsoc_flash_rewrite(uint8_t* data, uint32_t size, uint32_t old_size) {
+  mem_backing_rewrite(&vsoc_flash, data, size, old_size);
+}
+
+/*
+  Tick loops are templates on the configuration that is fixed for the whole run: tracing and the verbosity
+  class (SimQuiet -- no prints inside the loops, SimFetch -- VerboseInfo5 prints of the memory handshakes,
+  SimTick -- VerboseInfo6 prints of every tick). sim_loops_select picks the instances once in main.
+  The loops run in budgets that end at the next progress print or at max_cycles, so a cycle does not
+  check them.
+*/
+enum SimVerbose {
+  SimQuiet,
+  SimFetch,
+  SimTick,
+};
+
+// NOTE: progress is printed every that many cycles, 0 -- never
+uint64_t sim_progress_every(TestBench* tb, uint64_t info4_every) {
+  if (tb->verbose >= VerboseInfo6) return info4_every / 100;
+  if (tb->verbose >= VerboseInfo5) return info4_every / 10;
+  if (tb->verbose >= VerboseInfo4) return info4_every;
+  return 0;
+}
+
+// NOTE: end of the budget that starts at cycles, at least one cycle
+uint64_t sim_budget_end(TestBench* tb, uint64_t cycles, uint64_t progress_every) {
+  uint64_t end = UINT64_MAX;
+  if (progress_every) end = (cycles / progress_every + 1) * progress_every;
+  if (tb->max_cycles && tb->max_cycles < end) end = tb->max_cycles;
+  if (end <= cycles) end = cycles + 1;
+  return end;
+}
+
+void sim_progress(const char* name, uint64_t cycles, uint64_t progress_every) {
+  if (progress_every && cycles % progress_every == 0) {
+    printf("[INFO] %s cycles: %lu\n", name, cycles);
   }
 }
 
-void vsoc_tick(TestBench* tb) {
-  tb->vsoc->eval();
-  if (tb->is_trace) {
-    if (tb->trace_dumps > 100'000'000) {
-      printf("[WARNING] vsoc too much trace dumps: %llu \n", tb->trace_dumps);
-    }
-    else {
-      tb->trace->dump(tb->trace_dumps++);
-    }
+void sim_trace_dump(TestBench* tb, const char* name) {
+  if (tb->trace_dumps > 100'000'000) {
+    printf("[WARNING] %s too much trace dumps: %" PRIu64 " \n", name, tb->trace_dumps);
   }
+  else {
+    tb->trace->dump(tb->trace_dumps++);
+  }
+}
+
+template <bool IS_TRACE, SimVerbose VERBOSE>
+static inline void vsoc_tick(TestBench* tb) {
+  tb->vsoc->eval();
+  if constexpr (IS_TRACE) sim_trace_dump(tb, "vsoc");
   tb->vsoc_ticks++;
   tb->vsoc->clock ^= 1;
-  if (tb->verbose >= VerboseInfo6) {
+  if constexpr (VERBOSE == SimTick) {
     printf("vsoc tick: %lu, %lu\n", tb->vsoc_ticks, tb->trace_dumps);
   }
 }
 
-void vsoc_cycle(TestBench* tb) {
-  vsoc_tick(tb);
-  vsoc_tick(tb);
+template <bool IS_TRACE, SimVerbose VERBOSE>
+static inline void vsoc_cycle(TestBench* tb) {
+  vsoc_tick<IS_TRACE, VERBOSE>(tb);
+  vsoc_tick<IS_TRACE, VERBOSE>(tb);
   tb->vsoc_cycles++;
-  if (tb->verbose >= VerboseInfo6 && tb->vsoc_cycles % 10'000'000 == 0) {
-    printf("[INFO] vsoc cycles: %lu\n", tb->vsoc_cycles);
+}
+
+template <bool IS_TRACE, SimVerbose VERBOSE>
+void vsoc_cycles_run(TestBench* tb, uint64_t cycles) {
+  for (uint64_t i = 0; i < cycles; i++) {
+    vsoc_cycle<IS_TRACE, VERBOSE>(tb);
   }
-  if (tb->verbose >= VerboseInfo5 && tb->vsoc_cycles % 100'000'000 == 0) {
-    printf("[INFO] vsoc cycles: %lu\n", tb->vsoc_cycles);
+}
+
+// NOTE: cycles until the instruction retires, ebreak or max_cycles
+template <bool IS_TRACE, SimVerbose VERBOSE>
+void vsoc_fetch_exec_run(TestBench* tb) {
+  const uint64_t  progress_every = sim_progress_every(tb, 1'000'000'000);
+  const uint64_t  minstret_start = tb->vsoc_cpu->minstret_start;
+  VEventCounts*   counts         = &tb->vsoc_cpu->event_counts;
+  bool is_break = false;
+  while (!is_break) {
+    uint64_t end = sim_budget_end(tb, tb->vsoc_cycles, progress_every);
+    while (tb->vsoc_cycles < end && !is_break) {
+      vsoc_cycle<IS_TRACE, VERBOSE>(tb);
+      is_break = counts->ebreak || counts->minstret != minstret_start;
+    }
+    sim_progress("vsoc", tb->vsoc_cycles, progress_every);
+    is_break |= tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles;
   }
-  if (tb->verbose >= VerboseInfo4 && tb->vsoc_cycles % 1'000'000'000 == 0) {
-    printf("[INFO] vsoc cycles: %lu\n", tb->vsoc_cycles);
+}
+
+// NOTE: cycles until <cycles> are spent and then the next instruction retires, ebreak or max_cycles
+template <bool IS_TRACE, SimVerbose VERBOSE>
+void vsoc_batch_run(TestBench* tb, uint64_t cycles) {
+  const uint64_t progress_every = sim_progress_every(tb, 1'000'000'000);
+  const uint64_t batch_end      = tb->vsoc_cycles + cycles;
+  VEventCounts*  counts         = &tb->vsoc_cpu->event_counts;
+  bool is_break = false;
+  while (!is_break) {
+    uint64_t end = sim_budget_end(tb, tb->vsoc_cycles, progress_every);
+    while (tb->vsoc_cycles < end && !is_break) {
+      uint64_t minstret = counts->minstret;
+      vsoc_cycle<IS_TRACE, VERBOSE>(tb);
+      is_break = counts->ebreak || (tb->vsoc_cycles >= batch_end && counts->minstret != minstret);
+    }
+    sim_progress("vsoc", tb->vsoc_cycles, progress_every);
+    is_break |= tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles;
   }
 }
 
+// NOTE: the SDRAM belongs to the verilated model, only the pages its lsu wrote (or the testbench loaded) are cleared
+void vsoc_sdram_clear(TestBench* tb) {
+  mem_backing_clear(&tb->vsoc_cpu->mem_written);
+}
+
+// NOTE: the first reset is clocked and leaves the snapshot that the following ones restore, the SDRAM is its hole;
+// the DPI calls of the reset cycles are made again, dpi_model is vsoc's on the main thread
 void vsoc_reset(TestBench* tb) {
   if (tb->verbose >= VerboseInfo4) {
     printf("[INFO] vsoc reset\n");
   }
+  vsoc_sdram_clear(tb);
+  if (tb->vsoc_snapshot) {
+    model_snapshot_restore(tb->vsoc, tb->vsoc_snapshot);
+    exu_perf_reset();
+    icache_perf_reset();
+    tb->vsoc_ticks  += 2 * tb->reset_cycles;
+    tb->vsoc_cycles += tb->reset_cycles;
+    return;
+  }
   tb->vsoc->reset = 1;
   tb->vsoc->clock = 0;
-  for (uint64_t i = 0; i < tb->reset_cycles; i++) {
-    vsoc_cycle(tb);
-  }
+  tb->loops.vsoc_cycles(tb, tb->reset_cycles);
   tb->vsoc->reset = 0;
+  // NOTE: a trace shows the reset of every program
+  if (!tb->is_trace) {
+    tb->vsoc_snapshot = model_snapshot_new(tb->vsoc, (uint8_t*)&tb->vsoc_cpu->mem.m_storage[0], MEM_SIZE);
+  }
 }
 
 void vsoc_fetch_exec(TestBench* tb) {
@@ -493,43 +980,25 @@ void vsoc_fetch_exec(TestBench* tb) {
   if (tb->verbose >= VerboseInfo5) {
     printf("========== vsoc fetch#%u start %u tick, %u dump =================\n", tb->vsoc_cpu->minstret_start, tb->vsoc_ticks, tb->trace_dumps);
   }
-  while (1) {
-    vsoc_cycle(tb);
-    if (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) break;
-    if (tb->vsoc_cpu->event_counts.ebreak) break;
-    if (tb->vsoc_cpu->event_counts.minstret != tb->vsoc_cpu->minstret_start) break;
-  }
+  tb->loops.vsoc_fetch_exec(tb);
   if (tb->verbose >= VerboseInfo5) {
     printf("========== vsoc fetch#%u end   %u tick, %u dump =================\n", tb->vsoc_cpu->minstret_start, tb->vsoc_ticks, tb->trace_dumps);
   }
 }
 
+void vsoc_batch(TestBench* tb, uint64_t cycles) {
+  if (tb->verbose >= VerboseInfo5) {
+    printf("========== vsoc batch#%lu start %" PRIu64 " tick, %" PRIu64 " dump =================\n", tb->vsoc_cpu->event_counts.minstret, tb->vsoc_ticks, tb->trace_dumps);
+  }
+  tb->loops.vsoc_batch(tb, cycles);
+  if (tb->verbose >= VerboseInfo5) {
+    printf("========== vsoc batch#%lu end   %" PRIu64 " tick, %" PRIu64 " dump =================\n", tb->vsoc_cpu->event_counts.minstret, tb->vsoc_ticks, tb->trace_dumps);
+  }
+}
 
 uint32_t v_mem_read(TestBench* tb, uint32_t addr) {
   uint32_t result = 0;
-  if (addr >= FLASH_START && addr < FLASH_END-3) {
-    addr -= FLASH_START;
-    addr &= ~3;
-    result = 
-      tb->vcpu_cpu->flash[addr+3] << 24 | tb->vcpu_cpu->flash[addr+2] << 16 |
-      tb->vcpu_cpu->flash[addr+1] <<  8 | tb->vcpu_cpu->flash[addr+0] <<  0 ;
-  }
-  else if (addr >= UART_START && addr < UART_END-3) {
-    addr -= UART_START;
-    uint8_t byte = 0;
-    byte = tb->vcpu_cpu->uart[addr];
-    result = 
-      byte << 24 | byte << 16 |
-      byte <<  8 | byte <<  0 ;
-  }
-  else if (addr >= MEM_START && addr < MEM_END-3) {
-    addr -= MEM_START;
-    addr &= ~3;
-    result = 
-      tb->vcpu_cpu->mem[addr+3] << 24 | tb->vcpu_cpu->mem[addr+2] << 16 |
-      tb->vcpu_cpu->mem[addr+1] <<  8 | tb->vcpu_cpu->mem[addr+0] <<  0 ;
-  }
-  else {
+  if (mem_map_read(&tb->vcpu_cpu->mem_map, addr, &result) != MemMapOk) {
     if (tb->verbose >= VerboseWarning) {
       printf("[WARNING]: vcpu mem read  memory is not mapped 0x%x\n", addr);
     }
@@ -541,75 +1010,54 @@ void v_mem_write(TestBench* tb, uint8_t wen, uint8_t wbmask, uint32_t addr, uint
   tb->vcpu_cpu->is_mem_write = wen;
   if (wen) {
     tb->vcpu_cpu->written_address = addr;
-    if (addr >= FLASH_START && addr < FLASH_END-3) {
-      // NOTE: flash is read only
-      if (tb->verbose >= VerboseWarning) {
-        printf("[WARNING]: vcpu attempt at writing flash, which is read only\n");
-      }
-    }
-    else if (addr >= UART_START && addr < UART_END-3) {
-      addr -= UART_START;
-      uint8_t byte = 0;
-      switch (addr & 0b11) {
-        case 0b00 : byte = (wdata >>  0) & 0xff; break;
-        case 0b01 : byte = (wdata >>  8) & 0xff; break;
-        case 0b10 : byte = (wdata >> 16) & 0xff; break;
-        case 0b11 : byte = (wdata >> 24) & 0xff; break;
-      }
-      if (addr == 0) {
-        fputc(byte, stderr);
-      }
-      else if (addr != 5 && addr != 6) {
-        tb->vcpu_cpu->uart[addr] = byte;
-      }
-    }
-    else if (addr >= MEM_START && addr < MEM_END-3) {
-      addr -= MEM_START;
-      addr &= ~3;
-      if (wbmask & 0b0001) tb->vcpu_cpu->mem[addr + 0] = (wdata >>  0) & 0xff;
-      if (wbmask & 0b0010) tb->vcpu_cpu->mem[addr + 1] = (wdata >>  8) & 0xff;
-      if (wbmask & 0b0100) tb->vcpu_cpu->mem[addr + 2] = (wdata >> 16) & 0xff;
-      if (wbmask & 0b1000) tb->vcpu_cpu->mem[addr + 3] = (wdata >> 24) & 0xff;
-    }
-    else {
-      if (tb->verbose >= VerboseWarning) {
-        printf("[WARNING]: vcpu mem write memory is not mapped 0x%x\n", addr);
-      }
+    switch (mem_map_write(&tb->vcpu_cpu->mem_map, addr, wbmask, wdata)) {
+      case MemMapOk: {
+        if (addr - MEM_START < MEM_SIZE) {
+          mem_backing_mark(&tb->vcpu_cpu->mem, addr - MEM_START, 4);
+          if (tb->vcpu_cpu->mem_dirty) mem_dirty_mark(tb->vcpu_cpu->mem_dirty, addr - MEM_START, 4);
+        }
+      } break;
+      case MemMapReadOnly: {
+        // NOTE: flash is read only
+        if (tb->verbose >= VerboseWarning) {
+          printf("[WARNING]: vcpu attempt at writing flash, which is read only\n");
+        }
+      } break;
+      case MemMapNotMapped: {
+        if (tb->verbose >= VerboseWarning) {
+          printf("[WARNING]: vcpu mem write memory is not mapped 0x%x\n", addr);
+        }
+      } break;
     }
   }
 }
 
 void vcpu_flash_init(TestBench* tb, uint8_t* data, uint32_t size) {
-  for (uint32_t i = 0; i < size; i++) {
-    tb->vcpu_cpu->flash[i] = data[i];
+  mem_backing_write(&tb->vcpu_cpu->flash, 0, data, size);
+  if (tb->verbose >= VerboseInfo4) {
+    printf("[INFO] vcpu flash written: %u bytes\n", size);
   }
+}
+
+// NOTE: flash holds only the previous program of old_size bytes, only the bytes of both are written
+void vcpu_flash_rewrite(TestBench* tb, uint8_t* data, uint32_t size, uint32_t old_size) {
+  mem_backing_rewrite(&tb->vcpu_cpu->flash, data, size, old_size);
   if (tb->verbose >= VerboseInfo4) {
     printf("[INFO] vcpu flash written: %u bytes\n", size);
   }
 }
 
-void vcpu_tick(TestBench* tb) {
-  tb->vcpu->eval();
-  if (tb->is_trace) {
-    if (tb->trace_dumps > 100'000'000) {
-      printf("[WARNING] vcpu too much trace dumps: %llu \n", tb->trace_dumps);
-    }
-    else {
-      tb->trace->dump(tb->trace_dumps++);
-    }
+// NOTE: the eval before the edge only settles the inputs set by vcpu_subtick for the trace dump; without a
+// trace the eval after the edge does it, the input combinational logic is evaluated before the clocked one
+template <bool IS_TRACE, SimVerbose VERBOSE>
+static inline void vcpu_tick(TestBench* tb) {
+  if constexpr (IS_TRACE) {
+    tb->vcpu->eval();
+    sim_trace_dump(tb, "vcpu");
   }
   tb->vcpu_ticks++;
   tb->vcpu_cycles = tb->vcpu_ticks / 2;
-  if (tb->verbose >= VerboseInfo6 && tb->vcpu_ticks % 2'000'000 == 0) {
-    printf("[INFO] vcpu cycles: %lu\n", tb->vcpu_cycles);
-  }
-  if (tb->verbose >= VerboseInfo5 && tb->vcpu_ticks % 20'000'000 == 0) {
-    printf("[INFO] vcpu cycles: %lu\n", tb->vcpu_cycles);
-  }
-  if (tb->verbose >= VerboseInfo4 && tb->vcpu_ticks % 200'000'000 == 0) {
-    printf("[INFO] vcpu cycles: %lu\n", tb->vcpu_cycles);
-  }
-  if (tb->verbose >= VerboseInfo6) {
+  if constexpr (VERBOSE == SimTick) {
     printf("vcpu tick: %lu, %lu\n", tb->vcpu_ticks, tb->trace_dumps);
   }
 
@@ -618,37 +1066,45 @@ void vcpu_tick(TestBench* tb) {
   tb->vcpu_cpu->clock_pre = tb->vcpu_cpu->clock_now;
   tb->vcpu_cpu->clock_now = tb->vcpu->clock;
 
-  if (tb->is_trace) {
-    if (tb->trace_dumps > 100'000'000) {
-      printf("[WARNING] vcpu too much trace dumps: %llu \n", tb->trace_dumps);
-    }
-    else {
-      tb->trace->dump(tb->trace_dumps++);
-    }
-  }
+  if constexpr (IS_TRACE) sim_trace_dump(tb, "vcpu");
 }
 
-void vcpu_cycle(TestBench* tb) {
-  vcpu_tick(tb);
-  vcpu_tick(tb);
+template <bool IS_TRACE, SimVerbose VERBOSE>
+void vcpu_ticks_run(TestBench* tb, uint64_t ticks) {
+  for (uint64_t i = 0; i < ticks; i++) {
+    vcpu_tick<IS_TRACE, VERBOSE>(tb);
+  }
 }
 
-void vcpu_reset(TestBench* tb) {
+// NOTE: vcpu_reset for the next program of a campaign, vcpu_flash_rewrite replaces the previous program in flash
+void vcpu_reset_keep_flash(TestBench* tb) {
   if (tb->verbose >= VerboseInfo4) {
     printf("[INFO] vcpu reset\n");
   }
   tb->vcpu->reset = 1;
   tb->vcpu->clock = 0;
+  mem_backing_clear(&tb->vcpu_cpu->mem);
   memset(tb->vcpu_cpu->uart, 0, UART_SIZE);
   tb->vcpu_cpu->uart[1] = 0b0000'0000;
   tb->vcpu_cpu->uart[2] = 0b1100'0000;
   tb->vcpu_cpu->uart[3] = 0b0000'0011;
   tb->vcpu_cpu->uart[4] = 0b0000'0000;
   tb->vcpu_cpu->uart[5] = 0b0010'0000;
-  for (uint64_t i = 0; i < tb->reset_cycles; i++) {
-    vcpu_cycle(tb);
+  if (tb->vcpu_snapshot) {
+    model_snapshot_restore(tb->vcpu, tb->vcpu_snapshot);
+    exu_perf_reset();
+    icache_perf_reset();
+    tb->vcpu_ticks += 2 * tb->reset_cycles;
+    tb->vcpu_cycles = tb->vcpu_ticks / 2;
+    // NOTE: vcpu_tick toggles the clock on every tick
+    tb->vcpu_cpu->clock_now = tb->vcpu->clock;
+    tb->vcpu_cpu->clock_pre = !tb->vcpu->clock;
+  }
+  else {
+    tb->loops.vcpu_ticks(tb, 2 * tb->reset_cycles);
+    tb->vcpu->reset = 0;
+    if (!tb->is_trace) tb->vcpu_snapshot = model_snapshot_new(tb->vcpu, NULL, 0);
   }
-  tb->vcpu->reset = 0;
 
   tb->vcpu_cpu->minstret_start         = 0;
   tb->vcpu_cpu->io_ifu_reqValid        = 0;
@@ -669,18 +1125,14 @@ void vcpu_reset(TestBench* tb) {
   tb->vcpu_cpu->written_address = false;
 }
 
-void vcpu_wait_ticks(TestBench* tb, uint64_t ticks) {
-  for (uint64_t i = 0; i < ticks; i++) {
-    vcpu_tick(tb);
-  }
+void vcpu_reset(TestBench* tb) {
+  mem_backing_clear(&tb->vcpu_cpu->flash);
+  vcpu_reset_keep_flash(tb);
 }
 
-enum BreakCode {
-  NoBreak,
-  Timeout,
-  Ebreak,
-  InstRet,
-};
+void vcpu_wait_ticks(TestBench* tb, uint64_t ticks) {
+  tb->loops.vcpu_ticks(tb, ticks);
+}
 
 BreakCode vcpu_break_code(TestBench* tb) {
   BreakCode break_code = NoBreak;
@@ -690,10 +1142,11 @@ BreakCode vcpu_break_code(TestBench* tb) {
   return break_code;
 }
 
-void vcpu_subtick(TestBench* tb) {
+template <SimVerbose VERBOSE>
+static inline void vcpu_subtick(TestBench* tb) {
   if (tb->vcpu_cpu->io_ifu_respValid_ticks > 0) {
     tb->vcpu_cpu->io_ifu_respValid_ticks--;
-    if (tb->verbose >= VerboseInfo5) {
+    if constexpr (VERBOSE >= SimFetch) {
       printf("ifu respValid ticks: %lu, address: 0x%x\n", tb->vcpu_cpu->io_ifu_respValid_ticks, tb->vcpu_cpu->io_ifu_addr);
     }
   }
@@ -705,7 +1158,7 @@ void vcpu_subtick(TestBench* tb) {
     tb->vcpu_cpu->io_ifu_addr     = tb->vcpu->io_ifu_addr;
     uint64_t delay_ticks          = 2 * random_range(tb->random_gen, tb->mem_delay_min, tb->mem_delay_max);
     tb->vcpu_cpu->io_ifu_waitRespValid = delay_ticks;
-    if (tb->verbose >= VerboseInfo5) {
+    if constexpr (VERBOSE >= SimFetch) {
       printf("ifu delay_ticks: %lu, address: 0x%x\n", delay_ticks, tb->vcpu_cpu->io_ifu_addr);
     }
   }
@@ -717,7 +1170,7 @@ void vcpu_subtick(TestBench* tb) {
     tb->vcpu_cpu->io_ifu_reqValid = 0;
     tb->vcpu_cpu->io_ifu_respValid_ticks = 2;
     tb->vcpu->io_ifu_rdata = v_mem_read(tb, tb->vcpu_cpu->io_ifu_addr);
-    if (tb->verbose >= VerboseInfo5) {
+    if constexpr (VERBOSE >= SimFetch) {
       printf("ifu read: 0x%x\n", tb->vcpu->io_ifu_rdata);
     }
   }
@@ -726,7 +1179,7 @@ void vcpu_subtick(TestBench* tb) {
 
   if (tb->vcpu_cpu->io_lsu_respValid_ticks > 0) {
     tb->vcpu_cpu->io_lsu_respValid_ticks--;
-    if (tb->verbose >= VerboseInfo5) {
+    if constexpr (VERBOSE >= SimFetch) {
       printf("lsu respValid ticks: %lu, address: 0x%x\n", tb->vcpu_cpu->io_lsu_respValid_ticks, tb->vcpu_cpu->io_lsu_addr);
     }
   }
@@ -741,7 +1194,7 @@ void vcpu_subtick(TestBench* tb) {
     tb->vcpu_cpu->io_lsu_wen      = tb->vcpu->io_lsu_wen;
     uint64_t delay_ticks          = 2 * random_range(tb->random_gen, tb->mem_delay_min, tb->mem_delay_max);
     tb->vcpu_cpu->io_lsu_waitRespValid = delay_ticks;
-    if (tb->verbose >= VerboseInfo5) {
+    if constexpr (VERBOSE >= SimFetch) {
       printf("lsu delay_ticks: %lu, address: 0x%x\n", delay_ticks, tb->vcpu_cpu->io_lsu_addr);
     }
   }
@@ -754,7 +1207,7 @@ void vcpu_subtick(TestBench* tb) {
     tb->vcpu_cpu->io_lsu_respValid_ticks = 2;
     v_mem_write(tb, tb->vcpu_cpu->io_lsu_wen, tb->vcpu_cpu->io_lsu_wmask, tb->vcpu_cpu->io_lsu_addr, tb->vcpu_cpu->io_lsu_wdata);
     tb->vcpu->io_lsu_rdata = v_mem_read(tb, tb->vcpu_cpu->io_lsu_addr);
-    if (tb->verbose >= VerboseInfo5) {
+    if constexpr (VERBOSE >= SimFetch) {
       if (tb->vcpu_cpu->io_lsu_wen) {
         printf("lsu write:0x%x to   0x%x\n", tb->vcpu->io_lsu_wdata, tb->vcpu_cpu->io_lsu_addr);
       }
@@ -763,19 +1216,51 @@ void vcpu_subtick(TestBench* tb) {
   }
 }
 
+// NOTE: ticks until the instruction retires, ebreak or max_cycles
+template <bool IS_TRACE, SimVerbose VERBOSE>
+BreakCode vcpu_fetch_exec_run(TestBench* tb) {
+  const uint64_t progress_every = sim_progress_every(tb, 100'000'000);
+  BreakCode break_code = NoBreak;
+  while (break_code == NoBreak) {
+    uint64_t end = sim_budget_end(tb, tb->vcpu_cycles, progress_every);
+    while (tb->vcpu_cycles < end && break_code == NoBreak) {
+      // BUG: the order of vcpu_tick/vcpu_subtick matters and breaks with this:
+      //  ./build_run.sh fast vcpu gold random 10000 100 all verbose 4 seed 17272793 delay 0 10
+      vcpu_subtick<VERBOSE>(tb);
+      vcpu_tick<IS_TRACE, VERBOSE>(tb);
+      break_code = vcpu_break_code(tb);
+    }
+    sim_progress("vcpu", tb->vcpu_cycles, progress_every);
+  }
+  return break_code;
+}
+
+template <bool IS_TRACE, SimVerbose VERBOSE>
+SimLoops sim_loops() {
+  return SimLoops {
+    .vsoc_cycles     = vsoc_cycles_run<IS_TRACE, VERBOSE>,
+    .vsoc_fetch_exec = vsoc_fetch_exec_run<IS_TRACE, VERBOSE>,
+    .vcpu_ticks      = vcpu_ticks_run<IS_TRACE, VERBOSE>,
+    .vcpu_fetch_exec = vcpu_fetch_exec_run<IS_TRACE, VERBOSE>,
+    .vsoc_batch      = vsoc_batch_run<IS_TRACE, VERBOSE>,
+  };
+}
+
+void sim_loops_select(TestBench* tb) {
+  SimVerbose verbose = tb->verbose >= VerboseInfo6 ? SimTick : tb->verbose >= VerboseInfo5 ? SimFetch : SimQuiet;
+  switch (verbose) {
+    case SimQuiet: tb->loops = tb->is_trace ? sim_loops<true, SimQuiet>() : sim_loops<false, SimQuiet>(); break;
+    case SimFetch: tb->loops = tb->is_trace ? sim_loops<true, SimFetch>() : sim_loops<false, SimFetch>(); break;
+    case SimTick:  tb->loops = tb->is_trace ? sim_loops<true, SimTick>()  : sim_loops<false, SimTick>();  break;
+  }
+}
+
 BreakCode vcpu_fetch_exec(TestBench* tb) {
   tb->vcpu_cpu->minstret_start = tb->vcpu_cpu->event_counts.minstret;
   if (tb->verbose >= VerboseInfo5) {
     printf("========== vcpu fetch#%u start %u tick, %u dump =================\n", tb->vcpu_cpu->minstret_start, tb->vcpu_ticks, tb->trace_dumps);
   }
-  BreakCode break_code = NoBreak;
-  while (break_code == NoBreak) {
-    // BUG: the order of vcpu_tick/vcpu_subtick matters and breaks with this:
-    //  ./build_run.sh fast vcpu gold random 10000 100 all verbose 4 seed 17272793 delay 0 10
-    vcpu_subtick(tb);
-    vcpu_tick(tb);
-    break_code = vcpu_break_code(tb);
-  }
+  BreakCode break_code = tb->loops.vcpu_fetch_exec(tb);
   if (tb->verbose >= VerboseInfo5) {
     printf("========== vcpu fetch#%u end   %u tick, %u dump =================\n", tb->vcpu_cpu->minstret_start, tb->vcpu_ticks, tb->trace_dumps);
   }
@@ -809,7 +1294,7 @@ bool compare_vsoc_gold(TestBench* tb) {
     result &= compare_reg(tb->vsoc_cycles, name, tb->vsoc_cpu->regs[i], tb->gcpu->regs[i]);
   }
   if (tb->is_memcmp) {
-    result &= memcmp(tb->gcpu->mem, &tb->vsoc_cpu->mem.m_storage[0], MEM_SIZE) == 0;
+    result &= mem_dirty_equal(tb->mem_dirty, tb->gcpu->mem.host, (uint8_t*)&tb->vsoc_cpu->mem.m_storage[0]);
   }
   // TODO: mem check
   // else if (tb->gcpu->is_mem_write) {
@@ -823,11 +1308,7 @@ bool compare_vsoc_gold(TestBench* tb) {
   //   result &= compare_mem(tb->vsoc_cycles, address4, v, g);
   // }
   if (!result) {
-    for (uint32_t i = 0; i < MEM_SIZE; i++) {
-      uint32_t v = ((uint8_t*)tb->vsoc_cpu->mem.m_storage)[i];
-      uint32_t g = tb->gcpu->mem[i];
-      result &= compare_mem(tb->vsoc_cycles, i + MEM_START, v, g);
-    }
+    memdiff_report(tb->vsoc_cycles, MEM_START, (uint8_t*)&tb->vsoc_cpu->mem.m_storage[0], tb->gcpu->mem.host, MEM_SIZE);
   }
   return result;
 }
@@ -843,7 +1324,7 @@ bool compare_vcpu_gold(TestBench* tb) {
     result &= compare_reg(tb->vcpu_cycles, name, tb->vcpu_cpu->regs[i], tb->gcpu->regs[i]);
   }
   if (tb->is_memcmp) {
-    result &= memcmp(tb->gcpu->mem, tb->vcpu_cpu->mem, MEM_SIZE) == 0;
+    result &= mem_dirty_equal(tb->mem_dirty, tb->gcpu->mem.host, tb->vcpu_cpu->mem.host);
   }
   else {
     if (tb->gcpu->is_mem_write && tb->gcpu->written_address >= MEM_START && tb->gcpu->written_address <= MEM_END-3) {
@@ -868,10 +1349,36 @@ bool compare_vcpu_gold(TestBench* tb) {
     }
   }
   if (!result) {
-    for (uint32_t i = 0; i < MEM_SIZE; i++) {
-      uint32_t v = tb->vcpu_cpu->mem[i];
-      uint32_t g = tb->gcpu->mem[i];
-      result &= compare_mem(tb->vcpu_cycles, i + MEM_START, v, g);
+    memdiff_report(tb->vcpu_cycles, MEM_START, tb->vcpu_cpu->mem.host, tb->gcpu->mem.host, MEM_SIZE);
+  }
+  return result;
+}
+
+// NOTE: final state of a lane against the gold that ran the same program from zero SDRAM
+bool compare_lanes_gold(Glanes* g, uint32_t lane, Gcpu* cpu) {
+  static const uint8_t zero_page[MEM_MAP_PAGE_SIZE] = {};
+  bool result = true;
+  result &= compare_reg(lane, "lanes.instret", g->instret[lane], cpu->instret);
+  result &= compare_reg(lane, "lanes.ebreak ", g->ebreak[lane],  cpu->ebreak);
+  result &= compare_reg(lane, "lanes.pc     ", g->pc[lane],      cpu->pc);
+  for (uint32_t i = 0; i < N_REGS; i++) {
+    char digit0 = i%10 + '0';
+    char digit1 = i/10 + '0';
+    char name[] = {'x', digit1, digit0, '\0'};
+    result &= compare_reg(lane, name, g->regs[i][lane], cpu->regs[i]);
+  }
+  for (uint32_t i = 0; i < sizeof(g->uart[lane]); i++) {
+    result &= compare_reg(lane, "lanes.uart   ", g->uart[lane][i], cpu->uart[i]);
+  }
+  for (uint32_t page = 0; page < (MEM_SIZE >> MEM_MAP_PAGE_BITS); page++) {
+    uint8_t* lane_page = g->mem[lane].pages[page] ? g->mem[lane].pages[page] : (uint8_t*)zero_page;
+    uint8_t* gold_page = cpu->mem.host + page * MEM_MAP_PAGE_SIZE;
+    if (memcmp(lane_page, gold_page, MEM_MAP_PAGE_SIZE) == 0) continue;
+    for (uint32_t i = 0; i < MEM_MAP_PAGE_SIZE; i += 4) {
+      uint32_t r = 0, c = 0;
+      memcpy(&r, lane_page + i, sizeof(r));
+      memcpy(&c, gold_page + i, sizeof(c));
+      result &= compare_mem(lane, MEM_START + page * MEM_MAP_PAGE_SIZE + i, r, c);
     }
   }
   return result;
@@ -888,14 +1395,10 @@ bool compare_vcpu_vsoc(TestBench* tb) {
     result &= compare_reg(tb->vsoc_cycles, name, tb->vcpu_cpu->regs[i], tb->vsoc_cpu->regs[i]);
   }
   if (tb->is_memcmp) {
-    result &= memcmp(tb->vcpu_cpu->mem, &tb->vsoc_cpu->mem.m_storage[0], MEM_SIZE) == 0;
+    result &= mem_dirty_equal(tb->mem_dirty, tb->vcpu_cpu->mem.host, (uint8_t*)&tb->vsoc_cpu->mem.m_storage[0]);
   }
   if (!result) {
-    for (uint32_t i = 0; i < MEM_SIZE; i++) {
-      uint32_t v = tb->vcpu_cpu->mem[i];
-      uint32_t g = tb->gcpu->mem[i];
-      result &= compare_mem(tb->vsoc_cycles, i + MEM_START, v, g);
-    }
+    memdiff_report(tb->vsoc_cycles, MEM_START, tb->vcpu_cpu->mem.host, (uint8_t*)&tb->vsoc_cpu->mem.m_storage[0], MEM_SIZE);
   }
   return result;
 }
@@ -947,26 +1450,197 @@ void print_finished_stat(TestBench* tb, const char* cpu_name, VEventCounts event
     );
   }
 }
+void vuart_copy_config(Vuart* dst, Vuart* src) {
+  dst->dl  = src->dl;
+  dst->ier = src->ier;
+  dst->lcr = src->lcr;
+  dst->mcr = src->mcr;
+}
+
+// NOTE: gold has to run with its own uart (g_own_uart), its configuration is copied to the model
+void vcpu_load_gold_state(TestBench* tb) {
+  mem_backing_copy(&tb->vcpu_cpu->mem, &tb->gcpu->mem);
+  tb->vcpu_cpu->pc = tb->gcpu->pc;
+  for (uint32_t i = 0; i < N_REGS; i++) {
+    tb->vcpu_cpu->regs[i] = tb->gcpu->regs[i];
+  }
+  // NOTE: dl, ier, iir/fcr, lcr, mcr; vcpu uart has the same layout as the gold one
+  memcpy(tb->vcpu_cpu->uart, tb->gcpu->uart, 5);
+  tb->vcpu->eval();
+  if (tb->mem_dirty) mem_dirty_all(tb->mem_dirty);
+}
+
+void vsoc_load_gold_state(TestBench* tb) {
+  memcpy(&tb->vsoc_cpu->mem.m_storage[0], tb->gcpu->mem.host, MEM_SIZE);
+  for (uint32_t i = 0; i < tb->gcpu->mem.n_touched; i++) {
+    mem_backing_mark(&tb->vsoc_cpu->mem_written, tb->gcpu->mem.touched[i] << MEM_MAP_PAGE_BITS, MEM_MAP_PAGE_SIZE);
+  }
+  tb->vsoc_cpu->pc = tb->gcpu->pc;
+  for (uint32_t i = 0; i < N_REGS; i++) {
+    tb->vsoc_cpu->regs[i] = tb->gcpu->regs[i];
+  }
+  vuart_copy_config(&tb->vsoc_cpu->uart, g_own_uart(tb->gcpu));
+  tb->vsoc->eval();
+  if (tb->mem_dirty) mem_dirty_all(tb->mem_dirty);
+}
+
+// NOTE: runs gold for tb->fastforward instructions, then loads its pc, regs and SDRAM into the verilated models
+bool fastforward(TestBench* tb) {
+  if (!tb->is_gold) {
+    g_reset(tb->gcpu);
+    g_flash_init(tb->gcpu, (uint8_t*)tb->insts, tb->flash_size);
+  }
+  // NOTE: the loaded states are compared in full, the stores of the fastforward are not tracked
+  Vuart* model_vuart = tb->gcpu->vuart;
+  tb->gcpu->vuart     = g_own_uart(tb->gcpu);
+  tb->gcpu->mem_dirty = NULL;
+  GcpuStop stop = g_run(tb->gcpu, tb->fastforward);
+  tb->gcpu->vuart     = model_vuart;
+  tb->gcpu->mem_dirty = tb->mem_dirty;
+  if (stop != GcpuStopBudget) {
+    printf("[FAILED] gcpu stopped during fastforward after %lu instrets at pc=0x%08x\n", tb->gcpu->instret, tb->gcpu->pc);
+    return false;
+  }
+
+  if (tb->is_vcpu) vcpu_load_gold_state(tb);
+  if (tb->is_vsoc) vsoc_load_gold_state(tb);
+  if (tb->verbose >= VerboseInfo4) {
+    printf("[INFO] fastforward: %lu instrets, pc=0x%08x\n", tb->gcpu->instret, tb->gcpu->pc);
+  }
+  return true;
+}
+
+#include "checkpoint.cpp"
+
+// NOTE: one gold instruction as the exu_commit record of it; the store data is read back from the memory
+CommitRecord gold_commit_step(TestBench* tb) {
+  Gcpu* g = tb->gcpu;
+  CommitRecord record = {};
+  record.cycle = tb->instrets;
+  record.pc    = g->pc;
+  record.inst  = g_mem_read(g, g->pc);
+  Dec_out dec  = decode(record.inst);
+  g_exec(g, 1);
+  tb->instrets++;
+  if (dec.inst_type != INST_STORE && dec.inst_type != INST_BRANCH && dec.inst_type != INST_EBREAK && dec.inst_type != INST_UNDEFINED) {
+    record.rd       = dec.reg_dest;
+    record.rd_wdata = dec.reg_dest < N_REGS ? g->regs[dec.reg_dest] : 0;
+  }
+  if (g->is_mem_write) {
+    record.mem_addr  = g->written_address;
+    record.mem_wmask = dec.mem_wbmask;
+    if (record.mem_addr >= MEM_START && record.mem_addr <= MEM_END-4) record.mem_wdata = g_mem_read(g, record.mem_addr);
+  }
+  return record;
+}
+
+// NOTE: true if gold stops after its last instruction: ebreak, unmapped access or end of a random program
+bool gold_is_done(TestBench* tb) {
+  Gcpu* g = tb->gcpu;
+  if (g->ebreak) return true;
+  if (tb->is_random && (g->is_not_mapped || tb->instrets > tb->n_insts)) return true;
+  if (!is_valid_pc_address(g->pc, tb->n_insts)) {
+    if (tb->verbose >= VerboseWarning) {
+      printf("[WARNING] gcpu not valid address: 0x%x\n", g->pc);
+    }
+    return true;
+  }
+  return false;
+}
+
+// NOTE: r is the record of the model, g the one of the reference for the same instruction
+bool compare_commit(const CommitRecord* r, const CommitRecord* g) {
+  bool result = true;
+  result &= compare_reg(r->cycle, "commit.pc       ", r->pc,   g->pc);
+  result &= compare_reg(r->cycle, "commit.inst     ", r->inst, g->inst);
+  result &= compare_reg(r->cycle, "commit.rd       ", r->rd,   g->rd);
+  if (r->rd && r->rd < N_REGS) {
+    result &= compare_reg(r->cycle, "commit.rd_wdata ", r->rd_wdata, g->rd_wdata);
+  }
+  result &= compare_reg(r->cycle, "commit.mem_wmask", r->mem_wmask, g->mem_wmask);
+  if (r->mem_wmask) {
+    result &= compare_reg(r->cycle, "commit.mem_addr ", r->mem_addr, g->mem_addr);
+    if (r->mem_addr >= MEM_START && r->mem_addr <= MEM_END-4) {
+      uint32_t mask = commit_mem_mask(r->mem_wmask);
+      result &= compare_reg(r->cycle, "commit.mem_wdata", r->mem_wdata & mask, g->mem_wdata & mask);
+    }
+  }
+  return result;
+}
+
+bool ebreak_check(TestBench* tb, const char* name, bool is_ebreak, uint32_t a0) {
+  if (!is_ebreak) return true;
+  if (tb->verbose >= VerboseInfo4) {
+    printf("[INFO] %s ebreak\n", name);
+  }
+  if (tb->is_check && a0 != 0) {
+    printf("[FAILED] test is not successful: %s returned %u\n", name, a0);
+    return false;
+  }
+  return true;
+}
+
+#include "batch.cpp"
+#include "threads.cpp"
+#include "logcmp.cpp"
+#include "hashcmp.cpp"
+
+// NOTE: called after every gold instruction of a packed image, false ends the image
+bool random_pack_step(TestBench* tb) {
+  RandomPack* pack = tb->random_pack;
+  uint32_t pc = tb->gcpu->pc;
+  if (pc < FLASH_START || pc - FLASH_START >= tb->flash_size || (pc & 3)) return false;
+  uint32_t program = (pc - FLASH_START) / 4 / pack->stride;
+  uint32_t offset  = (pc - FLASH_START) / 4 % pack->stride;
+  if (program == pack->current + 1 && offset == 0 && program < pack->n_programs) {
+    pack->current          = program;
+    pack->current_instrets = tb->instrets;
+    if (tb->verbose >= VerboseInfo4) {
+      printf("[INFO] pack: program %u SEED:%lu\n", program, pack->seeds[program]);
+    }
+    return true;
+  }
+  // NOTE: a jump of the gaps or the final ebreak
+  if (offset >= tb->n_insts || program == pack->n_programs) return true;
+  return program == pack->current && tb->instrets - pack->current_instrets <= tb->n_insts;
+}
+
 bool test_instructions(TestBench* tb) {
   if (tb->verbose >= VerboseInfo5) {
     print_all_instructions(tb);
   }
+  // NOTE: the flashes still hold the previous program of a campaign, it is overwritten in place
+  uint32_t flash_loaded = tb->flash_loaded;
   if (tb->is_vsoc)  {
     vsoc_reset(tb);
-    vsoc_flash_init((uint8_t*)tb->insts, tb->flash_size);
+    if (flash_loaded) vsoc_flash_rewrite((uint8_t*)tb->insts, tb->flash_size, flash_loaded);
+    else              vsoc_flash_init((uint8_t*)tb->insts, tb->flash_size);
     if (tb->verbose >= VerboseInfo4) {
       printf("[INFO] vsoc flash written: %u bytes\n", tb->flash_size);
     }
   }
   if (tb->is_vcpu) {
-    vcpu_reset(tb);
-    vcpu_flash_init(tb, (uint8_t*)tb->insts, tb->flash_size);
+    if (flash_loaded) {
+      vcpu_reset_keep_flash(tb);
+      vcpu_flash_rewrite(tb, (uint8_t*)tb->insts, tb->flash_size, flash_loaded);
+    }
+    else {
+      vcpu_reset(tb);
+      vcpu_flash_init(tb, (uint8_t*)tb->insts, tb->flash_size);
+    }
   }
 
   if (tb->is_gold) {
-    g_reset(tb->gcpu);
-    g_flash_init(tb->gcpu, (uint8_t*)tb->insts, tb->flash_size);
+    if (flash_loaded) {
+      g_reset_keep_flash(tb->gcpu);
+      g_flash_rewrite(tb->gcpu, (uint8_t*)tb->insts, tb->flash_size, flash_loaded);
+    }
+    else {
+      g_reset(tb->gcpu);
+      g_flash_init(tb->gcpu, (uint8_t*)tb->insts, tb->flash_size);
+    }
   }
+  tb->flash_loaded = tb->flash_size;
 
   tb->vsoc_cycles = 0;
   tb->vcpu_cycles = 0;
@@ -975,7 +1649,28 @@ bool test_instructions(TestBench* tb) {
   tb->vcpu_ticks  = 1;
 
   bool is_test_success = true;
-  while (1) {
+  if (tb->restore_path) {
+    if (!checkpoint_restore(tb, tb->restore_path)) return false;
+  }
+  else if (tb->fastforward && !fastforward(tb)) {
+    return false;
+  }
+  uint64_t next_checkpoint = tb->checkpoint_every ? (checkpoint_cycles(tb) / tb->checkpoint_every + 1) * tb->checkpoint_every : 0;
+  if (tb->commitlog_path || tb->logcmp_path) {
+    is_test_success = test_commitlog(tb);
+  }
+  else if (tb->hashcmp_insts) {
+    is_test_success = test_hashcmp(tb);
+  }
+  else if (tb->is_threads) {
+    is_test_success = test_threads(tb);
+  }
+  else if (tb->batch_cycles) {
+    is_test_success = test_batch(tb);
+  }
+  else while (1) {
+    // NOTE: a packed image is checked by random_pack_step
+    uint32_t n_valid = tb->random_pack ? tb->flash_size / 4 : tb->n_insts;
     uint32_t pc = 0;
     uint32_t inst = 0;
     if (tb->is_gold) {
@@ -1024,8 +1719,8 @@ bool test_instructions(TestBench* tb) {
     }
 
     if (tb->is_gold) {
-      uint8_t ebreak = cpu_eval(tb->gcpu);
-      if (ebreak) {
+      g_exec(tb->gcpu, 1);
+      if (tb->gcpu->ebreak) {
         if (tb->verbose >= VerboseInfo4) {
           printf("[INFO] gcpu ebreak\n");
         }
@@ -1065,6 +1760,7 @@ bool test_instructions(TestBench* tb) {
         break;
       }
     }
+    if (tb->mem_dirty) mem_dirty_clear(tb->mem_dirty);
 
     if (tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) {
       printf("[%x] pc=0x%08x inst: [0x%x] \n", tb->vsoc_cycles, tb->vsoc_cpu->pc);
@@ -1089,27 +1785,35 @@ bool test_instructions(TestBench* tb) {
     if (!is_test_success) {
       break;
     }
-    if (tb->is_gold && !is_valid_pc_address(tb->gcpu->pc, tb->n_insts)) {
+    if (tb->is_gold && !is_valid_pc_address(tb->gcpu->pc, n_valid)) {
       if (tb->verbose >= VerboseWarning) {
         printf("[WARNING] gcpu not valid address: 0x%x\n", tb->gcpu->pc);
       }
       break;
     }
-    if (tb->is_vsoc && !is_valid_pc_address(tb->vsoc_cpu->pc, tb->n_insts)) {
+    if (tb->is_vsoc && !is_valid_pc_address(tb->vsoc_cpu->pc, n_valid)) {
       if (tb->verbose >= VerboseWarning) {
         printf("[WARNING] vsoc not valid address: 0x%x\n", tb->vsoc_cpu->pc);
       }
       break;
     }
-    if (tb->is_vcpu && !is_valid_pc_address(tb->vcpu_cpu->pc, tb->n_insts)) {
+    if (tb->is_vcpu && !is_valid_pc_address(tb->vcpu_cpu->pc, n_valid)) {
       if (tb->verbose >= VerboseWarning) {
         printf("[WARNING] vcpu not valid address: 0x%x\n", tb->vcpu_cpu->pc);
       }
       break;
     }
-    if (tb->is_random && tb->instrets > tb->n_insts) {
+    if (tb->random_pack && !random_pack_step(tb)) {
       break;
     }
+    if (tb->is_random && !tb->random_pack && tb->instrets > tb->n_insts) {
+      break;
+    }
+    // NOTE: saved between instructions, a restored run continues from the top of this loop
+    if (tb->checkpoint_every && checkpoint_cycles(tb) >= next_checkpoint) {
+      checkpoint_save(tb, tb->checkpoint_path);
+      next_checkpoint = (checkpoint_cycles(tb) / tb->checkpoint_every + 1) * tb->checkpoint_every;
+    }
   }
   if (tb->is_vsoc) {
     print_finished_stat(tb, "vsoc", tb->vsoc_cpu->event_counts);
@@ -1120,6 +1824,65 @@ bool test_instructions(TestBench* tb) {
   return is_test_success;
 }
 
+#define GOLD_RUN_CHUNK ((uint64_t)1 << 26)
+
+// NOTE: gold only run without the lockstep checks: stops on ebreak, unmapped access or after max instructions
+bool test_gold_run(TestBench* tb) {
+  g_reset(tb->gcpu);
+  g_flash_init(tb->gcpu, (uint8_t*)tb->insts, tb->flash_size);
+  if (tb->gtiming) {
+    g_timing_reset(tb->gtiming);
+    tb->gcpu->timing = tb->gtiming;
+  }
+
+  bool is_test_success = true;
+  uint64_t max_insts = tb->max_cycles ? tb->max_cycles : UINT64_MAX;
+  GcpuStop stop = GcpuStopBudget;
+  auto start = std::chrono::steady_clock::now();
+  while (tb->gcpu->instret < max_insts) {
+    uint64_t chunk = std::min(GOLD_RUN_CHUNK, max_insts - tb->gcpu->instret);
+    stop = g_run(tb->gcpu, chunk);
+    if (stop != GcpuStopBudget) break;
+    if (tb->verbose >= VerboseInfo4) {
+      printf("[INFO] gcpu instrets: %lu pc=0x%08x\n", tb->gcpu->instret, tb->gcpu->pc);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  switch (stop) {
+    case GcpuStopEbreak: {
+      if (tb->verbose >= VerboseInfo4) {
+        printf("[INFO] gcpu ebreak\n");
+      }
+      if (tb->is_check && tb->gcpu->regs[10] != 0) {
+        printf("[FAILED] test is not successful: gcpu returned %u\n", tb->gcpu->regs[10]);
+        is_test_success = false;
+      }
+    } break;
+    case GcpuStopNotMapped: {
+      printf("[FAILED] test is not successful: gcpu unmapped access at pc=0x%08x\n", tb->gcpu->pc);
+      is_test_success = false;
+    } break;
+    case GcpuStopBudget: {
+      printf("[FAILED] test is not successful: gcpu timeout %lu/%lu\n", tb->gcpu->instret, max_insts);
+      is_test_success = false;
+    } break;
+  }
+  printf("[INFO] gcpu finished: %lu instrets in %.3f s, %.2f MIPS\n",
+    tb->gcpu->instret, seconds, seconds > 0 ? tb->gcpu->instret / seconds / 1e6 : 0.0);
+  if (tb->gtiming) {
+    tb->gcpu->timing = NULL;
+    VEventCounts counts = g_timing_event_counts(tb->gtiming);
+    print_finished_stat(tb, "gold timing", counts);
+    printf("[INFO] gold timing estimate: %lu cycles, %lu ifu wait, %lu lsu wait, CPI %.3f\n",
+      counts.mcycle, counts.mifu_wait, counts.mlsu_wait, counts.minstret ? (double)counts.mcycle / counts.minstret : 0.0);
+  }
+  return is_test_success;
+}
+
+#include "calibrate.cpp"
+#include "simpoint.cpp"
+
 bool test_bin(TestBench* tb) {
   uint8_t* data = NULL; size_t size = 0;
   if (tb->verbose >= VerboseInfo4) {
@@ -1132,13 +1895,57 @@ bool test_bin(TestBench* tb) {
   tb->n_insts = size/4;
   tb->insts = (uint32_t*)data;
 
-  bool is_success = test_instructions(tb);
+  bool is_success = false;
+  tb->gcpu->profile = tb->gprofile;
+  if (tb->simpoint_interval) {
+    is_success = test_simpoint(tb);
+  }
+  else if (tb->is_gold && !tb->is_vcpu && !tb->is_vsoc && !tb->commitlog_path && !tb->logcmp_path) {
+    // NOTE: a suite calibrates once on the samples of all its bins
+    is_success = tb->calibrate_csv && !tb->suite_path ? test_calibrate(tb) : test_gold_run(tb);
+  }
+  else {
+    is_success = test_instructions(tb);
+  }
   // if (!is_success) {
     // print_all_instructions(tb);
   // }
+  if (tb->gprofile) {
+    tb->gcpu->profile = NULL;
+    is_success &= g_profile_write(tb->gprofile, tb->profile_path);
+    printf("[INFO] profile of %lu instructions written to %s\n", tb->gprofile->n_insts, tb->profile_path);
+  }
   return is_success;
 }
 
+#include "suite.cpp"
+
+void random_program(TestBench* tb, uint64_t seed, uint32_t* insts) {
+  uint32_t inst_count = 0;
+  tb->random_gen->seed(seed);
+  for (uint32_t rd = 1; rd < N_REGS; rd++) {
+    // NOTE: uart mem is not ever generated since uart is not fully implemented in the golden model
+    uint32_t mem_start_choice[3] = {FLASH_START >> 12, MEM_START >> 12, UART_START >> 12};
+    uint32_t mem_size_choice[3]  = {FLASH_SIZE, MEM_SIZE, UART_SIZE };
+    uint8_t  mem_rand            = random_range(tb->random_gen, 0, 2);
+    uint32_t start = mem_start_choice[mem_rand];
+    uint32_t size  = mem_size_choice[mem_rand];
+    uint32_t base  = start + (size >> 12) / 2;
+    insts[inst_count++] = lui(base, rd);
+    uint32_t offset = random_range(tb->random_gen, size/2, size);
+    insts[inst_count++] = addi(random_bits(tb->random_gen, 12), rd, rd);
+  }
+  for (uint32_t i = 0; i < tb->n_insts - 2*(N_REGS-1); i++) {
+    insts[inst_count++] = random_instruction(tb->random_gen, tb->inst_flags);
+  }
+}
+
+#include "pack.cpp"
+#include "lanes.cpp"
+#include "shrink.cpp"
+#include "jobs.cpp"
+#include "decodebench.cpp"
+
 bool test_random(TestBench* tb) {
   tb->flash_size = tb->n_insts*4;
   tb->insts = new uint32_t[tb->n_insts];
@@ -1151,27 +1958,33 @@ bool test_random(TestBench* tb) {
   else {
     seed = hash_uint64_t(std::time(0));
   }
+  if (tb->gold_lanes && tb->is_gold && !tb->is_vcpu && !tb->is_vsoc) {
+    return test_random_lanes(tb, seed);
+  }
+  if (tb->pack) {
+    return test_random_pack(tb, seed);
+  }
+  if (tb->jobs) {
+    return test_random_jobs(tb, seed);
+  }
+  // NOTE: the program of the first seed is still generated, it leaves the random generator as in the run that is replayed
+  uint8_t* replay = NULL; size_t replay_size = 0;
+  if (tb->replay_path) {
+    if (!read_bin_path(tb->replay_path, &replay, &replay_size)) return false;
+    if (replay_size != tb->flash_size) {
+      printf("[ERROR] replay: %s holds %lu bytes, random tests of this size need %lu\n", tb->replay_path, replay_size, tb->flash_size);
+      free(replay);
+      return false;
+    }
+  }
   uint64_t i_test = 0;
   do {
-    uint32_t inst_count = 0;
     if (tb->verbose >= VerboseInfo4) {
       printf("======== SEED:%lu ===== %u/%u =========\n", seed, i_test, tb->max_tests);
     }
-    tb->random_gen->seed(seed);
-    for (uint32_t rd = 1; rd < N_REGS; rd++) {
-      // NOTE: uart mem is not ever generated since uart is not fully implemented in the golden model
-      uint32_t mem_start_choice[3] = {FLASH_START >> 12, MEM_START >> 12, UART_START >> 12};
-      uint32_t mem_size_choice[3]  = {FLASH_SIZE, MEM_SIZE, UART_SIZE };
-      uint8_t  mem_rand            = random_range(tb->random_gen, 0, 2);
-      uint32_t start = mem_start_choice[mem_rand];
-      uint32_t size  = mem_size_choice[mem_rand];
-      uint32_t base  = start + (size >> 12) / 2;
-      tb->insts[inst_count++] = lui(base, rd);
-      uint32_t offset = random_range(tb->random_gen, size/2, size);
-      tb->insts[inst_count++] = addi(random_bits(tb->random_gen, 12), rd, rd);
-    }
-    for (uint32_t i = 0; i < tb->n_insts - 2*(N_REGS-1); i++) {
-      tb->insts[inst_count++] = random_instruction(tb->random_gen, tb->inst_flags);
+    random_program(tb, seed, tb->insts);
+    if (replay && i_test == 0) {
+      memcpy(tb->insts, replay, tb->flash_size);
     }
 
     // print_all_instructions(tb);
@@ -1181,22 +1994,113 @@ bool test_random(TestBench* tb) {
     }
     else {
       print_all_instructions(tb);
+      if (tb->shrink_path) shrink_program(tb, seed, tb->insts);
     }
     seed = hash_uint64_t(seed);
     i_test++;
   } while (is_tests_success && tests_passed < tb->max_tests);
 
   printf("Tests results: %u / %u have passed\n", tests_passed, tb->max_tests);
+  free(replay);
   return is_tests_success;
 }
 
+// NOTE: options that do not work together are dropped with a warning, before anything is set up for them
+static void options_check(TestBench* tb) {
+  if (tb->is_bin && tb->is_random) {
+    printf("[WARNING] bin test and random test together are not supported: doing only bin test\n");
+    tb->is_random = 0;
+  }
+
+  if (tb->suite_path && (tb->is_bin || tb->is_random)) {
+    printf("[WARNING] suite test together with bin or random test is not supported: doing only suite test\n");
+    tb->is_bin    = false;
+    tb->is_random = false;
+  }
+
+  if (tb->fastforward && !tb->is_bin) {
+    printf("[WARNING] fastforward is supported only for bin test: ignoring it\n");
+    tb->fastforward = 0;
+  }
+
+  if (tb->simpoint_interval && !tb->is_bin) {
+    printf("[WARNING] simpoint is supported only for bin test: ignoring it\n");
+    tb->simpoint_interval = 0;
+  }
+
+  if ((tb->checkpoint_every || tb->restore_path) && (!tb->is_bin || (!tb->is_vsoc && !tb->is_vcpu) || tb->simpoint_interval)) {
+    printf("[WARNING] checkpoint and restore are supported only for bin test with vsoc or vcpu: ignoring them\n");
+    tb->checkpoint_every = 0;
+    tb->restore_path     = NULL;
+  }
+
+  if (tb->batch_cycles && (!tb->is_vsoc || !tb->is_gold || tb->is_vcpu || tb->checkpoint_every || tb->simpoint_interval)) {
+    printf("[WARNING] batch is supported only for vsoc with gold, without vcpu, checkpoint and simpoint: ignoring it\n");
+    tb->batch_cycles = 0;
+  }
+
+  if (tb->is_threads && (tb->is_vsoc + tb->is_vcpu + tb->is_gold < 2 || tb->is_trace || tb->checkpoint_every || tb->restore_path || tb->fastforward || tb->simpoint_interval || tb->batch_cycles)) {
+    printf("[WARNING] threads is supported only for two or more of vsoc, vcpu and gold, without trace, checkpoint, restore, fastforward, simpoint and batch: ignoring it\n");
+    tb->is_threads = false;
+  }
+
+  if ((tb->commitlog_path || tb->logcmp_path) && (!tb->is_bin || tb->is_vsoc + tb->is_vcpu + tb->is_gold != 1 || (tb->commitlog_path && tb->logcmp_path) ||
+                                                tb->checkpoint_every || tb->restore_path || tb->fastforward || tb->simpoint_interval || tb->calibrate_csv)) {
+    printf("[WARNING] commitlog and logcmp are supported only one at a time for bin test with exactly one of vsoc, vcpu and gold, without checkpoint, restore, fastforward, simpoint and calibrate: ignoring them\n");
+    tb->commitlog_path = NULL;
+    tb->logcmp_path    = NULL;
+  }
+
+  if (tb->hashcmp_insts && (!tb->is_bin || !tb->is_vsoc || !tb->is_gold || tb->is_vcpu || tb->is_threads || tb->batch_cycles || tb->commitlog_path || tb->logcmp_path ||
+                           tb->checkpoint_every || tb->restore_path || tb->simpoint_interval)) {
+    printf("[WARNING] hashcmp is supported only for bin test with vsoc and gold, without vcpu, threads, batch, commitlog, logcmp, checkpoint, restore and simpoint: ignoring it\n");
+    tb->hashcmp_insts = 0;
+  }
+
+  if (tb->pack && (!tb->is_random || !tb->is_gold || tb->is_threads || tb->batch_cycles || (tb->gold_lanes && !tb->is_vcpu && !tb->is_vsoc))) {
+    printf("[WARNING] pack is supported only for random test with gold, without threads, batch and lanes: ignoring it\n");
+    tb->pack = 0;
+  }
+
+  if (tb->jobs && ((!tb->is_random && !tb->suite_path) || tb->is_trace || tb->measure_path || tb->pack || (tb->gold_lanes && !tb->is_vcpu && !tb->is_vsoc))) {
+    printf("[WARNING] jobs is supported only for random and suite tests without trace, measure, pack and lanes: ignoring it\n");
+    tb->jobs = 0;
+  }
+
+  if (tb->shrink_path && (!tb->is_random || tb->pack || (tb->gold_lanes && !tb->is_vcpu && !tb->is_vsoc))) {
+    printf("[WARNING] shrink is supported only for random test without pack and lanes: ignoring it\n");
+    tb->shrink_path = NULL;
+  }
+
+  if (tb->replay_path && (!tb->is_random || tb->pack || tb->jobs || (tb->gold_lanes && !tb->is_vcpu && !tb->is_vsoc))) {
+    printf("[WARNING] replay is supported only for random test without pack, jobs and lanes: ignoring it\n");
+    tb->replay_path = NULL;
+  }
+
+  if ((tb->timing_path || tb->calibrate_csv) && ((!tb->is_bin && !tb->suite_path) || !tb->is_gold || tb->is_vcpu || tb->is_vsoc || tb->simpoint_interval)) {
+    printf("[WARNING] timing and calibrate are supported only for gold only bin or suite test: ignoring them\n");
+    tb->timing_path   = NULL;
+    tb->calibrate_csv = NULL;
+  }
+
+  if (tb->profile_path && (!tb->is_bin || !tb->is_gold || tb->simpoint_interval)) {
+    printf("[WARNING] profile is supported only for bin test with gold: ignoring it\n");
+    tb->profile_path = NULL;
+  }
+
+  if (tb->symbols_path && !tb->profile_path) {
+    printf("[WARNING] symbols are used only by profile: ignoring them\n");
+    tb->symbols_path = NULL;
+  }
+}
+
 static void usage(const char* prog) {
   fprintf(stderr,
     "Usage:\n"
-    "  %s vsoc|vcpu|gold [trace <path>] [cycles] [memcmp] [verbose] [measure <path>] [delay <cycles> <cycles>] [check] [timeout <cycles>] [seed <number>] bin|random\n"
+    "  %s vsoc|vcpu|gold [trace <path>] [cycles] [memcmp] [verbose] [measure <path>] [delay <cycles> <cycles>] [check] [timeout <cycles>] [seed <number>] [engine <interp|threaded|jit>] [fastforward <n_insts>] [simpoint <interval> <k> <warmup>] [simpointcmp] [checkpoint <path> every <cycles>] [restore <path>] [lanes <n>] [lanescheck] [timing <params>] [calibrate <measure.csv> <rows> <params>] [profile <path>] [symbols <path>] [hugepages] [batch <cycles>] [threads] [commitlog <path>] [logcmp <path>] [hashcmp <n_insts>] [pack <n>] [jobs <n>] [shrink <path>] [replay <path>] bin|random|suite\n"
     "    vsoc|vcpu|gold     : select at least one to run: vsoc -- verilated SoC, vcpu -- verilated CPU, gold -- Golden Model\n"
     "    [trace <path>]     : saves the trace of the run at <path> (only for vcpu and vsoc)\n"
-    "    [memcmp]           : compare full memory\n"
+    "    [memcmp]           : compare full memory; every check reads only the SDRAM lines written since the previous one\n"
     "    [verbose]          : verbosity level\n"
     "      0 -- None, 1 -- Error, 2 -- Failed (default), 3 -- Warning, 4 -- Info\n"
     "    [measure <path>]   : stores measurements to output file path\n"
@@ -1204,9 +2108,35 @@ static void usage(const char* prog) {
     "    [check]            : on ebreak check a0 == 0, otherwise test failed\n"
     "    [timeout <cycles>] : timeout after <cycles> cycles\n"
     "    [seed <number>]    : set initial seed to <number>\n"
+    "    [engine <interp|threaded|jit>] : Golden Model execution engine: interp -- cpu_eval (default), threaded -- superblocks with threaded dispatch, jit -- x86-64 translation\n"
+    "    [fastforward <n_insts>] : runs the Golden Model for <n_insts> instructions, then copies pc, regs and SDRAM to vcpu/vsoc and continues in lockstep\n"
+    "    [simpoint <interval> <k> <warmup>] : sampled vsoc run: the Golden Model clusters basic block vectors of <interval> instructions into <k> phases, vsoc runs one interval per phase after <warmup> instructions and the counters are extrapolated (only bin, requires vsoc)\n"
+    "    [simpointcmp]      : also runs the full vsoc simulation and prints the error of the simpoint estimate\n"
+    "    [checkpoint <path> every <cycles>] : saves the full testbench state to <path> every <cycles> cycles (only bin with vsoc or vcpu)\n"
+    "    [restore <path>]   : continues the run from the checkpoint at <path>, needs the same bin and vsoc|vcpu|gold selection\n"
+    "    [lanes <n>]        : gold only random tests run <n> (up to 16) programs at once on the SIMD lanes Golden Model; every program starts from zero SDRAM\n"
+    "    [lanescheck]       : also runs every lanes program on the scalar Golden Model and compares the final states\n"
+    "    [timing <params>]  : gold only bin and suite runs estimate the vsoc counters with the timing model; <params> is a file written by calibrate or 'default' (uses the interp engine)\n"
+    "    [calibrate <measure.csv> <rows> <params>] : runs the bin or the suite on gold with the timing model, fits the ifu miss and the lsu latencies of every region (flash, sdram, uart) by least squares to ifu wait and lsu wait of <rows> (from 1, separated by commas) of <measure.csv>, and writes them to <params>; a suite takes a row per bin in its order, a bin takes every row as its own; ifu hit is kept, the regions are separated only by rows of bins that use them in different proportions\n"
+    "    [profile <path>]   : the Golden Model collects the workload profile of the bin and writes it as CSV to <path> (uses the interp engine)\n"
+    "    [symbols <path>]   : `nm` output of the bin's elf, calls to its multiply/divide helpers are counted by the profile\n"
+    "    [hugepages]        : backs the memories of the models with transparent huge pages; they are reserved on demand either way\n"
+    "    [batch <cycles>]   : vsoc with gold runs <cycles> cycles per call and checks the commit records of the retired instructions against gold in one pass, instead of returning after every instruction\n"
+    "    [threads]          : runs every model on its own thread and checks their commit records on another one; gold uses its own UART registers\n"
+    "    [commitlog <path>] : writes the commit log of the only model of the bin run to <path>: pcs, register writes and stores\n"
+    "    [logcmp <path>]    : compares the only model of the bin run with the commit log at <path> instead of running gold next to it\n"
+    "    [hashcmp <n_insts>] : vsoc with gold compare rolling hashes of their commit records every <n_insts> instructions; a mismatch is bisected from the last match to the first divergent instruction, which gets the full register and memory report\n"
+    "    [pack <n>]         : random tests with gold lay out <n> programs in one flash image and run them back to back after one reset; the programs only jump forward and their loads and stores stay in SDRAM (loads also in flash) so that a program can not end the image; system instructions are not generated\n"
+    "    [jobs <n>]         : random tests run on <n> worker processes; test i uses a seed derived from the initial seed and i, and the first failed test is reported whatever the scheduling\n"
+    "    [shrink <path>]    : a failed random program is reduced by replacing instructions with nops while it still fails (candidates run on the jobs workers); the result is written to <path> and the command that reproduces it to <path>.cmd\n"
+    "    [replay <path>]    : the first random test runs the program at <path> in place of the one of its seed, the memory delays stay those of the seed\n"
     "    random <tests> <n_insts> <JBLSCE | all>: <tests> times random tests with <n_insts> <JBLSCE | all> instructions; conflicts with bin \n"
     "      J -- jumps, B -- branches, L -- loads, S -- store, C -- calc, E -- system\n"
-    "    bin <path>               : loads the bin file to flash and runs it; conflicts with random \n",
+    "    bin <path>               : loads the bin file to flash and runs it; conflicts with random \n"
+    "      gold only bin runs skip the lockstep checks, print UART output and report MIPS\n"
+    "    suite <list-file|dir>    : runs every bin of the list file (a path per line) or the *.bin files of the directory on the models built once, a reset between them, and prints a table of the results; with jobs the bins are spread over <n> workers\n"
+    "  %s decodebench\n"
+    "    decodebench        : decodes every 32-bit encoding with the reference decoder and the decode tables, prints both throughputs and checks that they agree\n",
     prog, prog
   );
 }
@@ -1224,6 +2154,8 @@ int main(int argc, char** argv, char** env) {
   }
   else {
     TestBenchConfig config = {};
+    config.argc = argc;
+    config.argv = argv;
     int curr_arg = 1;
     while (curr_arg < argc) {
       char* mode = argv[curr_arg++];
@@ -1236,6 +2168,54 @@ int main(int argc, char** argv, char** env) {
       else if (streq(mode, "vcpu")) {
         config.is_vcpu = true;
       }
+      else if (streq(mode, "timing")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'timing' requires a <params> path or 'default'\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.timing_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "calibrate")) {
+        if (curr_arg+2 >= argc) {
+          fprintf(stderr, "[ERROR]: 'calibrate' requires a <measure.csv> <rows> <params>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.calibrate_csv = argv[curr_arg++];
+        config.calibrate_rows = argv[curr_arg++];
+        config.calibrate_out  = argv[curr_arg++];
+        std::vector<uint32_t> rows;
+        if (!calibrate_rows_parse(config.calibrate_rows, &rows)) {
+          fprintf(stderr, "[ERROR]: 'calibrate' rows are numbers from 1 separated by commas\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+      }
+      else if (streq(mode, "profile")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'profile' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.profile_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "symbols")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'symbols' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.symbols_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "decodebench")) {
+        config.is_decodebench = true;
+      }
       else if (streq(mode, "memcmp")) {
         config.is_memcmp = true;
       }
@@ -1313,6 +2293,178 @@ int main(int argc, char** argv, char** env) {
         }
         config.verbose = (VerboseLevel)std::stoul(argv[curr_arg++]);
       }
+      else if (streq(mode, "engine")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'engine' requires interp|threaded|jit\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        const char* engine = argv[curr_arg++];
+        if      (streq(engine, "interp"))   config.gold_engine = GcpuEngineInterp;
+        else if (streq(engine, "threaded")) config.gold_engine = GcpuEngineThreaded;
+        else if (streq(engine, "jit"))      config.gold_engine = GcpuEngineJit;
+        else {
+          fprintf(stderr, "[ERROR]: unknown engine '%s'\n", engine);
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+      }
+      else if (streq(mode, "fastforward")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'fastforward' requires a <number>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.fastforward = std::stoull(argv[curr_arg++]);
+      }
+      else if (streq(mode, "simpoint")) {
+        if (curr_arg + 2 >= argc) {
+          fprintf(stderr, "[ERROR]: 'simpoint' requires <interval> <k> <warmup>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.simpoint_interval = std::stoull(argv[curr_arg++]);
+        config.simpoint_k        = std::stoul (argv[curr_arg++]);
+        config.simpoint_warmup   = std::stoull(argv[curr_arg++]);
+        if (!config.simpoint_interval || !config.simpoint_k) {
+          fprintf(stderr, "[ERROR]: 'simpoint' <interval> and <k> should be positive\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+      }
+      else if (streq(mode, "simpointcmp")) {
+        config.is_simpoint_cmp = true;
+      }
+      else if (streq(mode, "checkpoint")) {
+        if (curr_arg + 2 >= argc || !streq(argv[curr_arg + 1], "every")) {
+          fprintf(stderr, "[ERROR]: 'checkpoint' requires <path> every <cycles>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.checkpoint_path  = argv[curr_arg];
+        config.checkpoint_every = std::stoull(argv[curr_arg + 2]);
+        curr_arg += 3;
+      }
+      else if (streq(mode, "lanes")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'lanes' requires a <number>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.gold_lanes = std::stoul(argv[curr_arg++]);
+        if (config.gold_lanes == 0 || config.gold_lanes > GLANES_MAX) {
+          fprintf(stderr, "[ERROR]: 'lanes' should be in [1, %u]\n", GLANES_MAX);
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+      }
+      else if (streq(mode, "lanescheck")) {
+        config.is_lanes_check = true;
+      }
+      else if (streq(mode, "hugepages")) {
+        config.is_hugepages = true;
+      }
+      else if (streq(mode, "commitlog")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'commitlog' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.commitlog_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "logcmp")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'logcmp' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.logcmp_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "hashcmp")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'hashcmp' requires <n_insts>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.hashcmp_insts = std::stoull(argv[curr_arg++]);
+      }
+      else if (streq(mode, "pack")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'pack' requires a <number>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.pack = std::stoul(argv[curr_arg++]);
+      }
+      else if (streq(mode, "jobs")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'jobs' requires a <number>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.jobs = std::stoul(argv[curr_arg++]);
+      }
+      else if (streq(mode, "shrink")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'shrink' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.shrink_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "replay")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'replay' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.replay_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "suite")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'suite' requires a <list-file|dir>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.suite_path = argv[curr_arg++];
+      }
+      else if (streq(mode, "threads")) {
+        config.is_threads = true;
+      }
+      else if (streq(mode, "batch")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'batch' requires <cycles>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.batch_cycles = std::stoull(argv[curr_arg++]);
+      }
+      else if (streq(mode, "restore")) {
+        if (curr_arg >= argc) {
+          fprintf(stderr, "[ERROR]: 'restore' requires a <path>\n");
+          usage(argv[0]);
+          exit_code = EXIT_FAILURE;
+          goto exit_label;
+        }
+        config.restore_path = argv[curr_arg++];
+      }
       else if (streq(mode, "measure")) {
         if (curr_arg >= argc) {
           fprintf(stderr, "[ERROR]: 'measure' requires a <path>\n");
@@ -1384,12 +2536,41 @@ int main(int argc, char** argv, char** env) {
         goto exit_label;
       }
     }
+    if (config.is_decodebench) {
+      if (!decode_bench()) exit_code = EXIT_FAILURE;
+      goto exit_label;
+    }
     TestBench tb = new_testbench(config);
     dpi_init(&tb);
+    sim_loops_select(&tb);
+
+    options_check(&tb);
+
+    // NOTE: at most one instruction retires per cycle, a batch ends with the first one retired after its cycles
+    if (tb.batch_cycles) {
+      tb.commits = commit_ring_new(tb.batch_cycles + 1, false);
+    }
+
+    // NOTE: gold can not read the UART registers of a model that runs on another thread
+    if (tb.is_threads) {
+      tb.gcpu->vuart = g_own_uart(tb.gcpu);
+    }
+
+    if (tb.timing_path || tb.calibrate_csv) {
+      GtimingParams params = GTIMING_DEFAULT;
+      if (tb.timing_path && !streq(tb.timing_path, "default") && !g_timing_params_read(tb.timing_path, &params)) {
+        exit_code = EXIT_FAILURE;
+        goto cleanup_label;
+      }
+      tb.gtiming = g_timing_new(params);
+    }
 
-    if (tb.is_bin && tb.is_random) {
-      printf("[WARNING] bin test and random test together are not supported: doing only bin test\n");
-      tb.is_random = 0;
+    if (tb.profile_path) {
+      tb.gprofile = g_profile_new();
+      if (tb.symbols_path && !g_profile_symbols_read(tb.gprofile, tb.symbols_path)) {
+        exit_code = EXIT_FAILURE;
+        goto cleanup_label;
+      }
     }
 
     if (!tb.is_gold && !tb.is_vcpu && !tb.is_vsoc) {
@@ -1406,8 +2587,12 @@ int main(int argc, char** argv, char** env) {
       bool result = test_random(&tb);
       if (!result) exit_code = EXIT_FAILURE;
     }
+    else if (tb.suite_path) {
+      bool result = test_suite(&tb);
+      if (!result) exit_code = EXIT_FAILURE;
+    }
     else {
-      printf("[ERROR] should choose bin or random test\n");
+      printf("[ERROR] should choose bin, random or suite test\n");
       usage(argv[0]);
       goto cleanup_label;
     }
@@ -0,0 +1,140 @@
+/*
+  Suite of bins run on the models built once: every bin starts from a reset with the flash
+  rewritten in place. With jobs the bins are spread over forked workers that claim them from a counter in
+  shared memory; the workers print nothing and the summary has a row per bin in the order of the suite.
+  With calibrate the timing events of gold on every bin come back with its result and feed one fit.
+*/
+struct SuiteResult {
+  bool     is_done;
+  bool     is_success;
+  uint64_t instrets;
+  uint64_t cycles;
+  double   seconds;
+  // NOTE: the timing events of gold for calibrate
+  CalibrateSample calibrate;
+};
+
+struct SuiteShared {
+  std::atomic<uint64_t> next;
+};
+
+// NOTE: a list file has a bin path per line, '#' starts a comment; a directory gives its *.bin files in name order
+bool suite_read(const char* path, std::vector<std::string>* bins) {
+  DIR* dir = opendir(path);
+  if (dir) {
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+        bins->push_back(std::string(path) + "/" + name);
+      }
+    }
+    closedir(dir);
+    std::sort(bins->begin(), bins->end());
+    return true;
+  }
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    printf("[ERROR] suite: could not open %s\n", path);
+    return false;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), file)) {
+    char* end = strchr(line, '#');
+    if (!end) end = line + strlen(line);
+    while (end > line && isspace((unsigned char)end[-1])) end--;
+    char* start = line;
+    while (start < end && isspace((unsigned char)*start)) start++;
+    if (start < end) bins->push_back(std::string(start, end));
+  }
+  fclose(file);
+  return true;
+}
+
+void suite_worker(TestBench* tb, SuiteShared* shared, SuiteResult* results, const std::vector<std::string>& bins) {
+  uint64_t i;
+  while ((i = shared->next.fetch_add(1)) < bins.size()) {
+    if (tb->verbose >= VerboseInfo4) {
+      printf("======== SUITE: %s ===== %lu/%lu =========\n", bins[i].c_str(), i, bins.size());
+    }
+    tb->bin_path = (char*)bins[i].c_str();
+    auto start = std::chrono::steady_clock::now();
+    results[i].is_success = test_bin(tb);
+    results[i].seconds    = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    results[i].is_done    = true;
+    // NOTE: the counters are those of the previous bin if this one was not read
+    if (tb->insts) {
+      results[i].instrets = tb->is_vsoc || tb->is_vcpu ? tb->instrets : tb->gcpu->instret;
+      results[i].cycles   = tb->is_vsoc ? tb->vsoc_cpu->event_counts.mcycle : tb->is_vcpu ? tb->vcpu_cpu->event_counts.mcycle : 0;
+      if (tb->gtiming) results[i].calibrate = calibrate_sample(tb->gtiming);
+    }
+    free(tb->insts);
+    tb->insts = NULL;
+  }
+}
+
+bool test_suite(TestBench* tb) {
+  std::vector<std::string> bins;
+  if (!suite_read(tb->suite_path, &bins)) return false;
+  size_t shared_size = sizeof(SuiteShared) + bins.size() * sizeof(SuiteResult);
+  SuiteShared* shared = (SuiteShared*)mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    printf("[ERROR] suite: could not map the results\n");
+    return false;
+  }
+  SuiteResult* results = (SuiteResult*)(shared + 1);
+  shared->next.store(0);
+
+  auto start = std::chrono::steady_clock::now();
+  uint32_t n_workers = 0;
+  if (tb->jobs) {
+    // NOTE: or the workers would print the buffered output again
+    fflush(stdout);
+    pid_t* pids = new pid_t[tb->jobs];
+    for (; n_workers < tb->jobs; n_workers++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        if (freopen("/dev/null", "w", stdout)) suite_worker(tb, shared, results, bins);
+        fflush(stdout);
+        _exit(0);
+      }
+      if (pid < 0) {
+        printf("[ERROR] suite: could not start worker %u\n", n_workers);
+        break;
+      }
+      pids[n_workers] = pid;
+    }
+    for (uint32_t w = 0; w < n_workers; w++) {
+      waitpid(pids[w], NULL, 0);
+    }
+    delete[] pids;
+  }
+  else {
+    n_workers = 1;
+    suite_worker(tb, shared, results, bins);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  uint64_t tests_passed = 0;
+  printf("%-6s %12s %12s %9s  %s\n", "result", "instrets", "cycles", "seconds", "bin");
+  for (size_t i = 0; i < bins.size(); i++) {
+    SuiteResult* result = &results[i];
+    const char* status = !result->is_done ? "CRASH" : result->is_success ? "PASS" : "FAIL";
+    printf("%-6s %12lu %12lu %9.3f  %s\n", status, result->instrets, result->cycles, result->seconds, bins[i].c_str());
+    tests_passed += result->is_done && result->is_success;
+  }
+  printf("[INFO] suite finished: %zu bins on %u workers in %.3f s\n", bins.size(), n_workers, seconds);
+  printf("Tests results: %" PRIu64 " / %zu have passed\n", tests_passed, bins.size());
+  bool is_success = tests_passed == bins.size();
+  if (tb->calibrate_csv) {
+    if (is_success) {
+      std::vector<CalibrateSample> samples;
+      for (size_t i = 0; i < bins.size(); i++) samples.push_back(results[i].calibrate);
+      is_success = calibrate_rows(tb, samples.data(), samples.size());
+    }
+    else {
+      printf("[ERROR] calibrate: not every bin of the suite passed, not calibrating\n");
+    }
+  }
+  munmap(shared, shared_size);
+  return is_success;
+}
@@ -0,0 +1,125 @@
+#define THREADS_RING_SIZE   (1 << 16)
+#define THREADS_VSOC_CYCLES (1 << 12)
+
+void threads_vsoc(TestBench* tb, CommitRing* ring) {
+  dpi_model = DpiModel{&tb->vsoc_cpu->event_counts, ring, &tb->vsoc_cycles, NULL, NULL, &tb->vsoc_cpu->mem_written};
+  VEventCounts* counts = &tb->vsoc_cpu->event_counts;
+  while (!ring->is_stop.load(std::memory_order_relaxed) && !counts->ebreak && !(tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles)) {
+    vsoc_batch(tb, THREADS_VSOC_CYCLES);
+  }
+  ring->is_done.store(true, std::memory_order_release);
+}
+
+// NOTE: the counters of vcpu are not cleared by its reset, which runs on the main thread
+void threads_vcpu(TestBench* tb, CommitRing* ring) {
+  dpi_model = DpiModel{&tb->vcpu_cpu->event_counts, ring, &tb->vcpu_cycles};
+  event_counts_clear(&tb->vcpu_cpu->event_counts);
+  while (!ring->is_stop.load(std::memory_order_relaxed)) {
+    if (vcpu_fetch_exec(tb) != InstRet) break;
+  }
+  ring->is_done.store(true, std::memory_order_release);
+}
+
+// NOTE: max_cycles is the instruction budget of gold, like in test_gold_run
+void threads_gold(TestBench* tb, CommitRing* ring) {
+  while (!ring->is_stop.load(std::memory_order_relaxed) && !(tb->max_cycles && tb->instrets >= tb->max_cycles)) {
+    CommitRecord record = gold_commit_step(tb);
+    if (tb->gcpu->is_not_mapped && tb->is_random) break;
+    if (!commit_ring_push(ring, &record)) break;
+    if (gold_is_done(tb)) break;
+  }
+  ring->is_done.store(true, std::memory_order_release);
+}
+
+/*
+  Every model on its own thread, the calling thread checks their records: gold is the reference if it runs,
+  otherwise vsoc is. The run ends when the reference is done or on the first mismatch, then the models
+  are stopped; the full states are compared only if all of them stopped on ebreak.
+*/
+bool test_threads(TestBench* tb) {
+  const char* names[3];
+  CommitRing* rings[3];
+  std::thread threads[3];
+  uint32_t n = 0;
+  // NOTE: the writes of the models are not tracked across threads, the final states are compared in full
+  tb->gcpu->mem_dirty     = NULL;
+  tb->vcpu_cpu->mem_dirty = NULL;
+  if (tb->is_gold) {
+    names[n] = "gcpu";
+    rings[n] = commit_ring_new(THREADS_RING_SIZE, true);
+    threads[n] = std::thread(threads_gold, tb, rings[n]);
+    n++;
+  }
+  if (tb->is_vsoc) {
+    names[n] = "vsoc";
+    rings[n] = commit_ring_new(THREADS_RING_SIZE, true);
+    threads[n] = std::thread(threads_vsoc, tb, rings[n]);
+    n++;
+  }
+  if (tb->is_vcpu) {
+    names[n] = "vcpu";
+    rings[n] = commit_ring_new(THREADS_RING_SIZE, true);
+    threads[n] = std::thread(threads_vcpu, tb, rings[n]);
+    n++;
+  }
+
+  bool is_test_success = true;
+  uint64_t index = 0;
+  const CommitRecord* g;
+  while (is_test_success && (g = commit_ring_wait(rings[0]))) {
+    for (uint32_t i = 1; i < n && is_test_success; i++) {
+      const CommitRecord* r = commit_ring_wait(rings[i]);
+      if (!r) {
+        printf("[FAILED] %s stopped after %lu instructions, %s did not\n", names[i], index, names[0]);
+        is_test_success = false;
+      }
+      else if (!compare_commit(r, g)) {
+        printf("[FAILED] %s differs from %s\n", names[i], names[0]);
+        is_test_success = false;
+      }
+    }
+    if (!is_test_success) {
+      printf("[%lx] pc=0x%08x inst: [0x%x] ", index + 1, g->pc, g->inst);
+      print_instruction(g->inst);
+      break;
+    }
+    for (uint32_t i = 0; i < n; i++) commit_ring_pop(rings[i]);
+    index++;
+  }
+  for (uint32_t i = 0; i < n; i++) rings[i]->is_stop.store(true, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < n; i++) threads[i].join();
+  tb->gcpu->mem_dirty     = tb->mem_dirty;
+  tb->vcpu_cpu->mem_dirty = tb->mem_dirty;
+  if (tb->mem_dirty) mem_dirty_all(tb->mem_dirty);
+  for (uint32_t i = 0; i < n; i++) commit_ring_free(rings[i]);
+
+  if (tb->is_vsoc && tb->max_cycles && tb->vsoc_cycles >= tb->max_cycles) {
+    printf("[FAILED] test is not successful: vsoc timeout %" PRIu64 "/%" PRIu64 "\n", tb->vsoc_cycles, tb->max_cycles);
+    is_test_success = false;
+  }
+  if (tb->is_vcpu && tb->max_cycles && tb->vcpu_cycles >= tb->max_cycles) {
+    printf("[FAILED] test is not successful: vcpu timeout %" PRIu64 "/%" PRIu64 "\n", tb->vcpu_cycles, tb->max_cycles);
+    is_test_success = false;
+  }
+  if (!is_test_success) return false;
+
+  bool is_ebreak = true;
+  if (tb->is_gold) {
+    is_test_success &= ebreak_check(tb, "gcpu", tb->gcpu->ebreak, tb->gcpu->regs[10]);
+    is_ebreak &= tb->gcpu->ebreak;
+  }
+  if (tb->is_vsoc) {
+    is_test_success &= ebreak_check(tb, "vsoc", tb->vsoc_cpu->event_counts.ebreak, tb->vsoc_cpu->regs[10]);
+    is_ebreak &= tb->vsoc_cpu->event_counts.ebreak;
+  }
+  if (tb->is_vcpu) {
+    is_test_success &= ebreak_check(tb, "vcpu", tb->vcpu_cpu->event_counts.ebreak, tb->vcpu_cpu->regs[10]);
+    is_ebreak &= tb->vcpu_cpu->event_counts.ebreak;
+  }
+  if (is_ebreak) {
+    if (tb->is_gold && tb->is_vsoc) is_test_success &= compare_vsoc_gold(tb);
+    if (tb->is_gold && tb->is_vcpu) is_test_success &= compare_vcpu_gold(tb);
+    if (!tb->is_gold)               is_test_success &= compare_vcpu_vsoc(tb);
+  }
+  return is_test_success;
+}